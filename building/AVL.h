@@ -0,0 +1,34 @@
+#ifndef AVL_H
+#define AVL_H
+
+#include "Dependencies.h"
+
+// Intrusive AVL tree node: embed it (or derive from it) in the element
+// type. cnt is the size of the subtree, which makes rank and offset
+// queries O(log n). The tree does not own or compare nodes: the caller
+// links a new leaf in place and calls avl_fix() on it.
+struct AVLNode {
+    AVLNode *parent = NULL;
+    AVLNode *left = NULL;
+    AVLNode *right = NULL;
+    uint32_t height = 1;
+    uint32_t cnt = 1;
+};
+
+inline uint32_t avl_height(const AVLNode *node) {
+    return node ? node->height : 0;
+}
+
+inline uint32_t avl_cnt(const AVLNode *node) {
+    return node ? node->cnt : 0;
+}
+
+// Rebalance from node up to the root after node was linked or changed,
+// returns the new root
+AVLNode *avl_fix(AVLNode *node);
+// Unlink node, returns the new root
+AVLNode *avl_del(AVLNode *node);
+// The node offset positions away in sort order, NULL if out of range
+AVLNode *avl_offset(AVLNode *node, int64_t offset);
+
+#endif
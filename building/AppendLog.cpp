@@ -0,0 +1,184 @@
+#include "AppendLog.h"
+#include "Snapshot.h"
+
+static bool write_all(int fd, const char *data, size_t n) {
+    while (n > 0) {
+        ssize_t rv = write(fd, data, n);
+        if (rv < 0 && errno == EINTR) {
+            continue;
+        }
+        if (rv <= 0) {
+            return false;
+        }
+        data += rv;
+        n -= (size_t)rv;
+    }
+    return true;
+}
+
+// a log that cannot be written no longer matches the keyspace, stop here
+// rather than keep acknowledging writes that will not survive a restart
+static void log_failed(const char *what) {
+    fprintf(stderr, "Server: append log %s failed: %s\n", what, strerror(errno));
+    abort();
+}
+
+AppendLog::~AppendLog() {
+    if (syncer.joinable()) {
+        {
+            std::lock_guard<std::mutex> lk(syncMu);
+            stopping = true;
+        }
+        syncCv.notify_one();
+        syncer.join();
+    }
+    if (fd >= 0) {
+        flush();
+        (void)fdatasync(fd);
+        close(fd);
+    }
+}
+
+bool AppendLog::parseFsync(const char *name, Fsync &out) {
+    if (strcmp(name, "always") == 0) {
+        out = FSYNC_ALWAYS;
+    } else if (strcmp(name, "everysec") == 0) {
+        out = FSYNC_EVERYSEC;
+    } else if (strcmp(name, "no") == 0) {
+        out = FSYNC_NO;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool AppendLog::open(const char *file, Fsync fsync) {
+    assert(fd < 0);
+    fd = ::open(file, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    path = file;
+    policy = fsync;
+    uint64_t size = (uint64_t)lseek(fd, 0, SEEK_END);
+    fileSize = size;
+    baseSize = size;
+    if (policy == FSYNC_EVERYSEC) {
+        syncer = std::thread(&AppendLog::syncLoop, this);
+    }
+    return true;
+}
+
+void AppendLog::append(const void *data, size_t n) {
+    std::lock_guard<std::mutex> lk(mu);
+    pending.append((const char *)data, n);
+    if (rewriting) {
+        rewriteBuf.append((const char *)data, n);
+    }
+    appended.store(appended.load(std::memory_order_relaxed) + n, std::memory_order_release);
+}
+
+void AppendLog::flush() {
+    if (fd < 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> io(writeMu);
+    uint64_t upto;
+    {
+        std::lock_guard<std::mutex> lk(mu);
+        if (pending.empty()) {
+            return;
+        }
+        writing.swap(pending);
+        upto = appended.load(std::memory_order_relaxed);
+    }
+    if (!write_all(fd, writing.data(), writing.size())) {
+        log_failed("write()");
+    }
+    fileSize.fetch_add(writing.size(), std::memory_order_relaxed);
+    writing.clear();
+    if (policy == FSYNC_ALWAYS) {
+        if (fdatasync(fd)) {
+            log_failed("fdatasync()");
+        }
+        synced.store(upto, std::memory_order_release);
+    } else {
+        dirty.store(true, std::memory_order_relaxed);
+    }
+}
+
+// everysec: at most one fdatasync a second, off the reactors, for whatever
+// was written meanwhile. The fd is dup'ed so a rewrite can switch files
+// without waiting for the sync.
+void AppendLog::syncLoop() {
+    std::unique_lock<std::mutex> lk(syncMu);
+    while (!stopping) {
+        syncCv.wait_for(lk, std::chrono::seconds(1));
+        if (stopping || !dirty.exchange(false, std::memory_order_relaxed)) {
+            continue;
+        }
+        int sfd;
+        {
+            std::lock_guard<std::mutex> io(writeMu);
+            sfd = dup(fd);
+        }
+        if (sfd < 0 || fdatasync(sfd)) {
+            log_failed("fdatasync()");
+        }
+        close(sfd);
+    }
+}
+
+bool AppendLog::wantsRewrite() const {
+    uint64_t size = fileSize.load(std::memory_order_relaxed);
+    return size >= k_rewrite_min && size >= 2 * baseSize.load(std::memory_order_relaxed);
+}
+
+void AppendLog::beginRewrite() {
+    std::lock_guard<std::mutex> lk(mu);
+    rewriting = true;
+    rewriteBuf.clear();
+}
+
+void AppendLog::abortRewrite() {
+    std::lock_guard<std::mutex> lk(mu);
+    rewriting = false;
+    std::string().swap(rewriteBuf);
+    // no retry until the log doubles again
+    baseSize = fileSize.load();
+}
+
+bool AppendLog::finishRewrite(const std::string &tmp) {
+    std::lock_guard<std::mutex> io(writeMu);
+    std::lock_guard<std::mutex> lk(mu);
+    // the old log stays complete in case the switch fails
+    if (!write_all(fd, pending.data(), pending.size())) {
+        log_failed("write()");
+    }
+    fileSize.fetch_add(pending.size(), std::memory_order_relaxed);
+    pending.clear();
+    rewriting = false;
+    int nfd = ::open(tmp.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    bool ok = nfd >= 0 && write_all(nfd, rewriteBuf.data(), rewriteBuf.size()) && fsync(nfd) == 0 &&
+              rename(tmp.c_str(), path.c_str()) == 0;
+    std::string().swap(rewriteBuf);
+    if (!ok) {
+        if (nfd >= 0) {
+            close(nfd);
+        }
+        unlink(tmp.c_str());
+        baseSize = fileSize.load();
+        return false;
+    }
+    // renamed already, the old log is gone: no going back from here
+    if (!fsync_dir_of(path.c_str())) {
+        log_failed("fsync() of the directory");
+    }
+    close(fd);
+    fd = nfd;
+    uint64_t size = (uint64_t)lseek(fd, 0, SEEK_END);
+    fileSize = size;
+    baseSize = size;
+    synced.store(appended.load(std::memory_order_relaxed), std::memory_order_release);
+    return true;
+}
@@ -0,0 +1,84 @@
+#ifndef APPENDLOG_H
+#define APPENDLOG_H
+
+#include "Dependencies.h"
+
+// Append-only log file of the changes made to the keyspace. Any thread
+// queues records with append(); flush() writes everything queued with a
+// single write() and is meant to run once per loop turn. fsync follows the
+// policy: in flush() itself (always), from a background thread once a
+// second when something was written (everysec), or left to the kernel (no).
+// While a rewrite runs, records are also kept for the new file, which
+// finishRewrite() appends before renaming it over the log.
+class AppendLog {
+public:
+    enum Fsync {
+        FSYNC_NO = 0,
+        FSYNC_EVERYSEC = 1,
+        FSYNC_ALWAYS = 2,
+    };
+
+    AppendLog() {}
+    ~AppendLog();
+    AppendLog(const AppendLog &) = delete;
+    AppendLog &operator=(const AppendLog &) = delete;
+
+    // "always", "everysec" or "no", false for anything else
+    static bool parseFsync(const char *name, Fsync &out);
+    bool open(const char *path, Fsync policy);
+    bool enabled() const {
+        return fd >= 0;
+    }
+    Fsync fsyncPolicy() const {
+        return policy;
+    }
+    const std::string &filePath() const {
+        return path;
+    }
+
+    void append(const void *data, size_t n);
+    void flush();
+    // bytes appended so far, and how many of those are known to be on disk
+    // (only tracked with FSYNC_ALWAYS)
+    uint64_t appendedBytes() const {
+        return appended.load(std::memory_order_acquire);
+    }
+    uint64_t syncedBytes() const {
+        return synced.load(std::memory_order_acquire);
+    }
+
+    // the file doubled since the last rewrite and is worth compacting
+    bool wantsRewrite() const;
+    void beginRewrite();
+    // append what came in meanwhile to tmp, then rename it over the log;
+    // false leaves the log as it was
+    bool finishRewrite(const std::string &tmp);
+    void abortRewrite();
+
+    // no rewrite below this size
+    static const uint64_t k_rewrite_min = 64 << 20;
+
+private:
+    void syncLoop();
+
+    int fd = -1;
+    std::string path;
+    Fsync policy = FSYNC_EVERYSEC;
+    std::mutex mu;           // pending, rewriteBuf, rewriting
+    std::mutex writeMu;      // the file: writes, fsync, switching fd
+    std::string pending;     // appended, not written yet
+    std::string writing;     // taken by the flush in progress
+    std::string rewriteBuf;  // appended since the rewrite started
+    bool rewriting = false;
+    std::atomic<uint64_t> appended{0};
+    std::atomic<uint64_t> synced{0};
+    std::atomic<bool> dirty{false};  // written, not fsync'ed
+    std::atomic<uint64_t> fileSize{0};
+    std::atomic<uint64_t> baseSize{0};  // size after open or the last rewrite
+    std::thread syncer;
+    std::mutex syncMu;
+    std::condition_variable syncCv;
+    bool stopping = false;
+};
+
+#endif
@@ -0,0 +1,37 @@
+#include "Buffer.h"
+
+// free blocks kept per thread, the rest go back to malloc
+const size_t k_pool_keep = 1024;
+
+struct BufPool {
+    std::vector<uint8_t *> blocks;
+    ~BufPool() {
+        for (uint8_t *block : blocks) {
+            free(block);
+        }
+    }
+};
+
+// every reactor borrows and returns on its own thread, so no locking
+static thread_local BufPool t_pool;
+
+uint8_t *bufpool_get() {
+    if (!t_pool.blocks.empty()) {
+        uint8_t *block = t_pool.blocks.back();
+        t_pool.blocks.pop_back();
+        return block;
+    }
+    uint8_t *block = (uint8_t *)malloc(k_pool_block);
+    if (!block) {
+        abort();
+    }
+    return block;
+}
+
+void bufpool_put(uint8_t *block) {
+    if (t_pool.blocks.size() < k_pool_keep) {
+        t_pool.blocks.push_back(block);
+    } else {
+        free(block);
+    }
+}
@@ -17,6 +17,25 @@ Client::Client(uint16_t port, const char* ip_address) {
     }
 }
 
+Client::Client(const char *unix_path) {
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (strlen(unix_path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        die("unix socket path");
+    }
+    strcpy(addr.sun_path, unix_path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        die("socket()");
+    }
+    int rv = connect(fd, (const struct sockaddr *)&addr, sizeof(addr));
+    if (rv) {
+        die("connect");
+    }
+}
+
 Client::~Client() {
     close(fd);
 }
@@ -61,10 +80,11 @@ int32_t Client::write_all(int fd, const char *buf, size_t n) {
     return 0;
 }
 
-const size_t k_max_msg = 4096;
+// protocol limit, the server default
+const size_t k_max_msg = (size_t)512 << 20;
 
 int32_t Client::sendRequest(int fd, const std::vector<std::string> &cmd) {
-    uint32_t len = 4;
+    size_t len = 4;
     for (const std::string &s : cmd) {
         len += 4 + s.size();
     }
@@ -72,8 +92,9 @@ int32_t Client::sendRequest(int fd, const std::vector<std::string> &cmd) {
         return -1;
     }
 
-    char wbuf[4 + k_max_msg];
-    memcpy(&wbuf[0], &len, 4);  // assume little endian
+    std::vector<char> wbuf(4 + len);
+    uint32_t wlen = (uint32_t)len;
+    memcpy(&wbuf[0], &wlen, 4);  // assume little endian
     uint32_t n = cmd.size();
     memcpy(&wbuf[4], &n, 4);
     size_t cur = 8;
@@ -83,13 +104,13 @@ int32_t Client::sendRequest(int fd, const std::vector<std::string> &cmd) {
         memcpy(&wbuf[cur + 4], s.data(), s.size());
         cur += 4 + s.size();
     }
-    return write_all(fd, wbuf, 4 + len);
+    return write_all(fd, wbuf.data(), wbuf.size());
 }
 
 int32_t Client::readRequest(int fd) {
-    char rbuf[4 + k_max_msg + 1];
+    char hdr[4];
     errno = 0;
-    int32_t err = read_full(fd, rbuf, 4);
+    int32_t err = read_full(fd, hdr, 4);
     if (err) {
         if (errno == 0) {
             msg("EOF");
@@ -100,13 +121,14 @@ int32_t Client::readRequest(int fd) {
     }
 
     uint32_t len = 0;
-    memcpy(&len, rbuf, 4);  // assume little endian
+    memcpy(&len, hdr, 4);  // assume little endian
     if (len > k_max_msg) {
         msg("too long");
         return -1;
     }
 
     // reply body
+    std::vector<char> rbuf(4 + len);
     err = read_full(fd, &rbuf[4], len);
     if (err) {
         msg("read() error");
@@ -0,0 +1,25 @@
+#include "Cycles.h"
+
+static uint64_t monotonic_nsec() {
+    struct timespec tv = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return (uint64_t)tv.tv_sec * 1000000000 + (uint64_t)tv.tv_nsec;
+}
+
+// the counter against the clock over a couple of ms, once per process
+static double measure_ns_per_cycle() {
+#if defined(__x86_64__) || defined(__i386__)
+    uint64_t ns0 = monotonic_nsec();
+    uint64_t c0 = cycles_now();
+    uint64_t ns1 = ns0;
+    while (ns1 - ns0 < 2000000) {
+        ns1 = monotonic_nsec();
+    }
+    uint64_t c1 = cycles_now();
+    return c1 > c0 ? (double)(ns1 - ns0) / (double)(c1 - c0) : 1.0;
+#else
+    return 1.0;
+#endif
+}
+
+const double g_ns_per_cycle = measure_ns_per_cycle();
@@ -0,0 +1,29 @@
+#ifndef CYCLES_H
+#define CYCLES_H
+
+#include "Dependencies.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Cheap timestamps for timing requests: the time stamp counter on x86,
+// where a read is a single instruction instead of a clock_gettime() call,
+// CLOCK_MONOTONIC in ns elsewhere. Differences only, the origin means
+// nothing; cycles_to_ns() converts with a rate measured at startup.
+inline uint64_t cycles_now() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec tv = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return (uint64_t)tv.tv_sec * 1000000000 + (uint64_t)tv.tv_nsec;
+#endif
+}
+
+extern const double g_ns_per_cycle;
+
+inline uint64_t cycles_to_ns(uint64_t cycles) {
+    return (uint64_t)((double)cycles * g_ns_per_cycle);
+}
+
+#endif
@@ -0,0 +1,84 @@
+#include "Epoch.h"
+
+// threads that read at the same time at most
+const size_t k_max_readers = 1024;
+
+// 0 while the thread holds no guard
+struct alignas(64) EpochSlot {
+    std::atomic<uint64_t> pinned{0};
+    std::atomic<bool> used{false};
+};
+
+static std::atomic<uint64_t> g_epoch{1};
+static EpochSlot g_slots[k_max_readers];
+// slots ever handed out, collect() scans no further
+static std::atomic<size_t> g_nslots{0};
+
+// a thread's slot, claimed by its first guard and given back at thread exit
+struct EpochReader {
+    EpochSlot *slot = NULL;
+    uint32_t depth = 0;
+    ~EpochReader() {
+        if (slot) {
+            slot->pinned.store(0, std::memory_order_release);
+            slot->used.store(false, std::memory_order_release);
+        }
+    }
+};
+
+static thread_local EpochReader t_reader;
+
+static EpochSlot *epoch_claim() {
+    for (size_t i = 0; i < k_max_readers; i++) {
+        bool expected = false;
+        if (!g_slots[i].used.load(std::memory_order_relaxed) &&
+            g_slots[i].used.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+            size_t n = g_nslots.load(std::memory_order_relaxed);
+            while (n < i + 1 && !g_nslots.compare_exchange_weak(n, i + 1, std::memory_order_release)) {}
+            return &g_slots[i];
+        }
+    }
+    fprintf(stderr, "Server: more than %zu reader threads\n", k_max_readers);
+    abort();
+}
+
+EpochGuard::EpochGuard() {
+    EpochReader &r = t_reader;
+    if (r.depth++ > 0) {
+        return;
+    }
+    if (!r.slot) {
+        r.slot = epoch_claim();
+    }
+    r.slot->pinned.store(g_epoch.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    // the pin is visible before any pointer is read: either collect() sees
+    // it, or the reader sees the structure with the object unlinked
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+EpochGuard::~EpochGuard() {
+    EpochReader &r = t_reader;
+    if (--r.depth == 0) {
+        r.slot->pinned.store(0, std::memory_order_release);
+    }
+}
+
+uint64_t epoch_current() {
+    // the unlink comes before the tag
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return g_epoch.load(std::memory_order_relaxed);
+}
+
+uint64_t epoch_collect() {
+    // pairs with the fence in EpochGuard(), the unlinks come before the scan
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    uint64_t oldest = g_epoch.fetch_add(1, std::memory_order_acq_rel) + 1;
+    size_t n = g_nslots.load(std::memory_order_acquire);
+    for (size_t i = 0; i < n; i++) {
+        uint64_t pinned = g_slots[i].pinned.load(std::memory_order_acquire);
+        if (pinned && pinned < oldest) {
+            oldest = pinned;
+        }
+    }
+    return oldest;
+}
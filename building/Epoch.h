@@ -0,0 +1,26 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include "Dependencies.h"
+
+// Epoch-based reclamation, for readers that walk a shared structure with no
+// lock. A reader holds an EpochGuard for as long as it uses pointers into
+// the structure; the guard pins the global epoch in a slot of the reader's
+// thread. A writer unlinks an object, tags it with epoch_current() and
+// keeps it until epoch_collect() returns something above the tag: every
+// reader that could have seen the object has left by then.
+// Pinning costs one store and a fence, readers never wait on writers.
+class EpochGuard {
+public:
+    EpochGuard();
+    ~EpochGuard();
+    EpochGuard(const EpochGuard &) = delete;
+    EpochGuard &operator=(const EpochGuard &) = delete;
+};
+
+// the tag for an object unlinked just now
+uint64_t epoch_current();
+// advance the epoch; objects tagged below the returned one are unreachable
+uint64_t epoch_collect();
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include "Dependencies.h"
+
+// Interest / readiness bits understood by every backend
+enum {
+    LOOP_READ = 1,   // fd is (or should be watched for being) readable
+    LOOP_WRITE = 2,  // fd is (or should be watched for being) writable
+    LOOP_ERR = 4,    // reported only: error or hangup on the fd
+    LOOP_EDGE = 8,   // requested only: edge-triggered notification
+};
+
+// One ready fd returned by EventLoop::wait
+struct LoopEvent {
+    int fd = -1;
+    uint32_t events = 0;
+};
+
+// Readiness notification backend used by Server::run.
+// Interest is registered once per fd and only changed through modify(),
+// so a wakeup costs O(ready fds) instead of O(connections).
+class EventLoop {
+public:
+    virtual ~EventLoop() {}
+    // Start watching fd for the given LOOP_* interest
+    virtual int add(int fd, uint32_t events) = 0;
+    // Change the interest of an fd that is already watched
+    virtual int modify(int fd, uint32_t events) = 0;
+    // Stop watching fd, must be called before the fd is closed
+    virtual int remove(int fd) = 0;
+    // Block up to timeout_ms (-1 = forever) and fill out with the ready fds
+    virtual int wait(std::vector<LoopEvent> &out, int timeout_ms) = 0;
+    // Human readable backend name, e.g. "epoll"
+    virtual const char *name() const = 0;
+
+    // Best backend for this platform: epoll on Linux, kqueue on BSD/macOS,
+    // poll everywhere else. Falls back to poll if the native one fails.
+    static EventLoop *create();
+    // Portable poll() backend, always available
+    static EventLoop *createPoll();
+};
+
+#endif // EVENT_LOOP_H
@@ -0,0 +1,122 @@
+#include "HashTable.h"
+
+HMap::~HMap() {
+    free(newer.tab.load(std::memory_order_relaxed));
+    free(older.tab.load(std::memory_order_relaxed));
+}
+
+HMap::Table *HMap::newTable(size_t n) {
+    assert(n > 0 && ((n - 1) & n) == 0);
+    // calloc of a large table is served by fresh zero pages: no O(n) memset
+    Table *table = (Table *)calloc(1, offsetof(Table, slots) + n * sizeof(std::atomic<HNode *>));
+    if (!table) {
+        abort();
+    }
+    table->mask = n - 1;
+    return table;
+}
+
+void HMap::retireTable(Table *table) {
+    if (retireFn) {
+        retireFn(retireCtx, table);
+    } else {
+        free(table);
+    }
+}
+
+// every store a reader can follow is a release: it sees the node filled in
+void HMap::insertInto(HTab &htab, HNode *node) {
+    Table *table = htab.tab.load(std::memory_order_relaxed);
+    std::atomic<HNode *> &slot = table->slots[node->hcode & table->mask];
+    node->next.store(slot.load(std::memory_order_relaxed), std::memory_order_release);
+    slot.store(node, std::memory_order_release);
+    htab.size++;
+}
+
+// node->next is left as it is, a reader standing on the node carries on
+HNode *HMap::detach(HTab &htab, std::atomic<HNode *> *from) {
+    HNode *node = from->load(std::memory_order_relaxed);
+    from->store(node->next.load(std::memory_order_relaxed), std::memory_order_release);
+    htab.size--;
+    return node;
+}
+
+void HMap::replace(HNode *old, HNode *with) {
+    assert(old->hcode == with->hcode);
+    auto same = [old](HNode *node) { return node == old; };
+    std::atomic<HNode *> *from = find(newer, old->hcode, same);
+    if (!from) {
+        from = find(older, old->hcode, same);
+    }
+    assert(from);
+    with->next.store(old->next.load(std::memory_order_relaxed), std::memory_order_release);
+    from->store(with, std::memory_order_release);
+}
+
+void HMap::rehashStep() {
+    Table *old = older.tab.load(std::memory_order_relaxed);
+    if (!old) {
+        return;
+    }
+    // seqlock style: odd while nodes are moving, until the end of this step
+    moves.store(moves.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    // empty buckets count too, but less than moved nodes
+    size_t nwork = 0;
+    size_t nempty = 0;
+    while (nwork < k_rehash_work && nempty < 10 * k_rehash_work && older.size > 0) {
+        std::atomic<HNode *> *from = &old->slots[migratePos];
+        if (!from->load(std::memory_order_relaxed)) {
+            migratePos++;
+            nempty++;
+            continue;
+        }
+        insertInto(newer, detach(older, from));
+        nwork++;
+    }
+    if (older.size == 0) {
+        older.tab.store(NULL, std::memory_order_release);
+        retireTable(old);
+        migratePos = 0;
+    }
+    moves.store(moves.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void HMap::reserve(size_t n) {
+    if (newer.size || rehashing()) {
+        return;
+    }
+    size_t cap = 4;
+    while (cap * k_max_load_factor <= n) {
+        cap *= 2;
+    }
+    Table *table = newer.tab.load(std::memory_order_relaxed);
+    newer.tab.store(newTable(cap), std::memory_order_release);
+    if (table) {
+        retireTable(table);
+    }
+}
+
+void HMap::insert(HNode *node) {
+    if (!newer.tab.load(std::memory_order_relaxed)) {
+        newer.tab.store(newTable(4), std::memory_order_release);
+    }
+    insertInto(newer, node);
+
+    if (!rehashing()) {
+        // start a resize once the load factor is reached
+        Table *table = newer.tab.load(std::memory_order_relaxed);
+        size_t threshold = (table->mask + 1) * k_max_load_factor;
+        if (newer.size >= threshold) {
+            // old table in place before the new one shows up empty, so a
+            // reader checking newer then older finds everything
+            older.tab.store(table, std::memory_order_release);
+            older.size = newer.size;
+            newer.size = 0;
+            newer.tab.store(newTable((table->mask + 1) * 2), std::memory_order_release);
+            migratePos = 0;
+        }
+    }
+    rehashStep();
+}
@@ -0,0 +1,196 @@
+#ifndef HASHTABLE_H
+#define HASHTABLE_H
+
+#include "Dependencies.h"
+
+// Intrusive hash table node: embed it (or derive from it) in the entry type
+struct HNode {
+    std::atomic<HNode *> next{NULL};
+    uint64_t hcode = 0;
+};
+
+// Chained hash table with progressive rehashing. When the load factor is
+// reached the current table becomes the old one and a table twice the size
+// is started; entries then move over a bounded number at a time on every
+// insert / remove and on rehashStep(), so no single call pays for a full
+// O(n) resize. lookup() checks both tables and never moves anything, so it
+// is safe under a shared lock.
+// Modifications need a single writer, the table does not own the nodes.
+//
+// lookupShared() also runs with no lock at all, concurrently with the
+// writer: nodes and bucket arrays are published with release stores, and a
+// node that moves between tables bumps a sequence count so that a miss
+// during the move is reported as such instead of as "absent". Such a reader
+// must keep unlinked nodes and retired bucket arrays alive until it is done
+// (see Epoch.h and setTableRetire()).
+class HMap {
+public:
+    HMap() {}
+    ~HMap();
+    HMap(const HMap &) = delete;
+    HMap &operator=(const HMap &) = delete;
+
+    // eq(HNode *) tells whether a node with the same hcode is the one wanted
+    template <class Eq>
+    HNode *lookup(uint64_t hcode, Eq eq) const {
+        HNode *node = findIn(newer, hcode, eq);
+        return node ? node : findIn(older, hcode, eq);
+    }
+
+    // Lookup concurrent with the writer. false when nodes were moving
+    // between tables meanwhile: out is then not to be trusted as a miss,
+    // retry or fall back to lookup() under the lock.
+    template <class Eq>
+    bool lookupShared(uint64_t hcode, Eq eq, HNode *&out) const {
+        uint64_t seq = moves.load(std::memory_order_acquire);
+        if (seq & 1) {
+            return false;
+        }
+        out = findIn(newer, hcode, eq);
+        if (!out) {
+            out = findIn(older, hcode, eq);
+        }
+        if (out) {
+            return true;
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return moves.load(std::memory_order_relaxed) == seq;
+    }
+
+    // node->hcode must be set, duplicates are not checked
+    void insert(HNode *node);
+
+    // Unlink and return the matching node, NULL if absent
+    template <class Eq>
+    HNode *remove(uint64_t hcode, Eq eq) {
+        rehashStep();
+        std::atomic<HNode *> *from = find(newer, hcode, eq);
+        if (from) {
+            return detach(newer, from);
+        }
+        from = find(older, hcode, eq);
+        if (from) {
+            return detach(older, from);
+        }
+        return NULL;
+    }
+
+    // Put with in the place of old, which must be in the table, in a single
+    // store: a concurrent reader sees either of them
+    void replace(HNode *old, HNode *with);
+
+    // Size an empty table for n nodes up front, so filling it never resizes
+    void reserve(size_t n);
+
+    // Move at most k_rehash_work nodes into the new table, a no-op when
+    // no resize is in progress
+    void rehashStep();
+    bool rehashing() const {
+        return older.tab.load(std::memory_order_relaxed) != NULL;
+    }
+    size_t size() const {
+        return newer.size + older.size;
+    }
+    // bucket slots allocated, both tables
+    size_t buckets() const {
+        Table *n = newer.tab.load(std::memory_order_relaxed);
+        Table *o = older.tab.load(std::memory_order_relaxed);
+        return (n ? n->mask + 1 : 0) + (o ? o->mask + 1 : 0);
+    }
+
+    // Bucket arrays the table is done with go to fn(ctx, mem), which must
+    // free() them once no lookupShared() can be reading them. By default
+    // they are freed right away.
+    void setTableRetire(void (*fn)(void *ctx, void *mem), void *ctx) {
+        retireFn = fn;
+        retireCtx = ctx;
+    }
+
+    template <class F>
+    void forEach(F f) const {
+        forEachIn(newer, f);
+        forEachIn(older, f);
+    }
+
+    static const size_t k_rehash_work = 128;
+    static const size_t k_max_load_factor = 2;
+
+private:
+    // the mask lives with the buckets so a reader gets both from one load
+    struct Table {
+        size_t mask;
+        std::atomic<HNode *> slots[1];  // mask + 1 of them
+    };
+    struct HTab {
+        std::atomic<Table *> tab{NULL};
+        size_t size = 0;
+    };
+
+    static Table *newTable(size_t n);
+    static void insertInto(HTab &htab, HNode *node);
+    static HNode *detach(HTab &htab, std::atomic<HNode *> *from);
+    void retireTable(Table *table);
+
+    template <class Eq>
+    static std::atomic<HNode *> *find(const HTab &htab, uint64_t hcode, Eq &eq) {
+        Table *table = htab.tab.load(std::memory_order_relaxed);
+        if (!table) {
+            return NULL;
+        }
+        std::atomic<HNode *> *from = &table->slots[hcode & table->mask];
+        for (HNode *cur; (cur = from->load(std::memory_order_relaxed)) != NULL; from = &cur->next) {
+            if (cur->hcode == hcode && eq(cur)) {
+                return from;
+            }
+        }
+        return NULL;
+    }
+
+    template <class Eq>
+    static HNode *findIn(const HTab &htab, uint64_t hcode, Eq &eq) {
+        Table *table = htab.tab.load(std::memory_order_acquire);
+        if (!table) {
+            return NULL;
+        }
+        HNode *cur = table->slots[hcode & table->mask].load(std::memory_order_acquire);
+        for (; cur; cur = cur->next.load(std::memory_order_acquire)) {
+            if (cur->hcode == hcode && eq(cur)) {
+                return cur;
+            }
+        }
+        return NULL;
+    }
+
+    template <class F>
+    static void forEachIn(const HTab &htab, F &f) {
+        Table *table = htab.tab.load(std::memory_order_relaxed);
+        if (!table) {
+            return;
+        }
+        for (size_t i = 0; i <= table->mask; i++) {
+            HNode *node = table->slots[i].load(std::memory_order_relaxed);
+            for (; node; node = node->next.load(std::memory_order_relaxed)) {
+                f(node);
+            }
+        }
+    }
+
+    HTab newer;
+    HTab older;
+    size_t migratePos = 0;
+    // odd while nodes are moving from older to newer
+    std::atomic<uint64_t> moves{0};
+    void (*retireFn)(void *ctx, void *mem) = NULL;
+    void *retireCtx = NULL;
+};
+
+// FNV-1a
+inline uint64_t str_hash(const uint8_t *data, size_t len) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ data[i]) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+#include "Dependencies.h"
+
+// Binary min-heap item. ref points at the owner's index field, which the
+// heap keeps equal to the item's position, so the owner can update or
+// remove its item in O(log n) without searching.
+struct HeapItem {
+    uint64_t val = 0;
+    size_t *ref = NULL;
+    void *owner = NULL;
+};
+
+// Restore the heap property after a[pos] changed
+void heap_update(HeapItem *a, size_t pos, size_t len);
+// Insert t when *t.ref is out of range, otherwise replace the item there
+void heap_upsert(std::vector<HeapItem> &a, HeapItem t);
+// Remove the item at pos, its *ref is left alone
+void heap_delete(std::vector<HeapItem> &a, size_t pos);
+
+#endif
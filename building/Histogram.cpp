@@ -0,0 +1,59 @@
+#include "Histogram.h"
+
+size_t Histogram::indexOf(uint64_t v) {
+    if (v < 2 * k_half) {
+        return (size_t)v;
+    }
+    // shift so that v >> shift lands in [k_half, 2 * k_half)
+    int msb = 63 - __builtin_clzll(v);
+    int shift = msb - (k_sub_bits - 1);
+    return (size_t)shift * k_half + (size_t)(v >> shift);
+}
+
+uint64_t Histogram::highestOf(size_t idx) {
+    if (idx < 2 * k_half) {
+        return idx;
+    }
+    size_t shift = idx / k_half - 1;
+    uint64_t m = idx - shift * k_half;
+    return ((m + 1) << shift) - 1;
+}
+
+void Histogram::record(uint64_t v) {
+    counts[indexOf(v)]++;
+    total++;
+    sum += v;
+    lo = std::min(lo, v);
+    hi = std::max(hi, v);
+}
+
+void Histogram::merge(const Histogram &other) {
+    for (size_t i = 0; i < k_nbuckets; i++) {
+        counts[i] += other.counts[i];
+    }
+    total += other.total;
+    sum += other.sum;
+    lo = std::min(lo, other.lo);
+    hi = std::max(hi, other.hi);
+}
+
+void Histogram::reset() {
+    *this = Histogram();
+}
+
+uint64_t Histogram::percentile(double p) const {
+    if (total == 0) {
+        return 0;
+    }
+    // rank of the value, 1-based, at least the first one
+    uint64_t rank = (uint64_t)std::ceil(p / 100.0 * (double)total);
+    rank = std::max<uint64_t>(rank, 1);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < k_nbuckets; i++) {
+        seen += counts[i];
+        if (seen >= rank) {
+            return std::min(highestOf(i), hi);
+        }
+    }
+    return hi;
+}
@@ -0,0 +1,47 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include "Dependencies.h"
+
+// Log-linear histogram in the style of HdrHistogram: values below 2^k_sub_bits
+// are counted exactly, above that every power of two is split into
+// 2^(k_sub_bits-1) buckets, so a reported value is within 1/64 of the
+// recorded one. Recording is an index computation and an increment; two
+// histograms merge by adding their counts. Not thread safe.
+class Histogram {
+public:
+    static const int k_sub_bits = 7;
+
+    void record(uint64_t v);
+    void merge(const Histogram &other);
+    void reset();
+    uint64_t count() const {
+        return total;
+    }
+    uint64_t min() const {
+        return total ? lo : 0;
+    }
+    uint64_t max() const {
+        return hi;
+    }
+    double mean() const {
+        return total ? (double)sum / (double)total : 0.0;
+    }
+    // Highest value equivalent to the one at percentile p (0..100),
+    // clamped to the largest value recorded
+    uint64_t percentile(double p) const;
+
+private:
+    static const size_t k_half = (size_t)1 << (k_sub_bits - 1);
+    static const size_t k_nbuckets = (66 - k_sub_bits) * k_half;
+    static size_t indexOf(uint64_t v);
+    static uint64_t highestOf(size_t idx);
+
+    uint64_t counts[k_nbuckets] = {};
+    uint64_t total = 0;
+    uint64_t sum = 0;
+    uint64_t lo = UINT64_MAX;
+    uint64_t hi = 0;
+};
+
+#endif
@@ -0,0 +1,56 @@
+#include "LazyFree.h"
+
+LazyFree::LazyFree(void (*destroy)(LazyNode *node)) : destroy(destroy) {}
+
+LazyFree::~LazyFree() {
+    if (thread.joinable()) {
+        stopping = true;
+        push(&wake);
+        thread.join();
+    }
+}
+
+void LazyFree::push(LazyNode *node) {
+    std::call_once(started, [this] {
+        thread = std::thread(&LazyFree::worker, this);
+    });
+    if (node != &wake) {
+        pushed.fetch_add(1, std::memory_order_relaxed);
+    }
+    LazyNode *old = head.load(std::memory_order_relaxed);
+    do {
+        node->lazy_next = old;
+    } while (!head.compare_exchange_weak(old, node, std::memory_order_release,
+                                         std::memory_order_relaxed));
+    // the worker only sleeps on an empty stack
+    if (!old) {
+        head.notify_one();
+    }
+}
+
+void LazyFree::worker() {
+#if defined(__linux__)
+    // batch threads don't preempt the event loops when woken up, freeing
+    // waits for a time slice instead of stalling a reactor on its core
+    struct sched_param param = {};
+    (void)pthread_setschedparam(pthread_self(), SCHED_BATCH, &param);
+#endif
+    for (;;) {
+        LazyNode *batch = head.exchange(NULL, std::memory_order_acquire);
+        if (!batch) {
+            if (stopping) {
+                return;
+            }
+            head.wait(NULL, std::memory_order_acquire);
+            continue;
+        }
+        while (batch) {
+            LazyNode *next = batch->lazy_next;
+            if (batch != &wake) {
+                destroy(batch);
+                freed.fetch_add(1, std::memory_order_relaxed);
+            }
+            batch = next;
+        }
+    }
+}
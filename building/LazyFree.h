@@ -0,0 +1,41 @@
+#ifndef LAZYFREE_H
+#define LAZYFREE_H
+
+#include "Dependencies.h"
+
+// Intrusive node for objects handed to a LazyFree thread
+struct LazyNode {
+    LazyNode *lazy_next = NULL;
+};
+
+// Frees objects off the event loop. Any thread pushes onto a lock-free
+// stack; one background thread, started on the first push, takes the
+// whole stack at once and calls destroy() on every node. The destructor
+// frees whatever is still queued.
+class LazyFree {
+public:
+    explicit LazyFree(void (*destroy)(LazyNode *node));
+    ~LazyFree();
+    LazyFree(const LazyFree &) = delete;
+    LazyFree &operator=(const LazyFree &) = delete;
+
+    void push(LazyNode *node);
+    // objects queued and not freed yet
+    uint64_t pending() const {
+        return pushed.load(std::memory_order_relaxed) - freed.load(std::memory_order_relaxed);
+    }
+
+private:
+    void worker();
+
+    void (*destroy)(LazyNode *node);
+    std::atomic<LazyNode *> head{NULL};
+    std::atomic<uint64_t> pushed{0};
+    std::atomic<uint64_t> freed{0};
+    std::atomic<bool> stopping{false};
+    LazyNode wake;  // pushed to stop the worker, never destroyed
+    std::once_flag started;
+    std::thread thread;
+};
+
+#endif
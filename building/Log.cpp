@@ -0,0 +1,264 @@
+#include "Log.h"
+
+struct LogRecord {
+    uint64_t unixMs;
+    const char *prefix;  // message() only, NULL for write()
+    uint8_t level;
+    uint16_t len;
+    char text[Log::k_max_record];
+};
+
+// filled by its thread only, drained by the log thread only. head and
+// tail on lines of their own so the two sides don't share a cache line.
+struct LogRing {
+    LogRecord slots[Log::k_ring_slots];
+    alignas(64) std::atomic<uint64_t> head{0};  // next record to drain
+    alignas(64) std::atomic<uint64_t> tail{0};  // next record to fill
+    alignas(64) std::atomic<bool> orphaned{false};  // its thread is gone
+};
+
+static std::mutex g_rings_mutex;
+static std::vector<LogRing *> g_rings;
+static int g_log_fd = -1;
+static std::thread g_drainer;
+static std::mutex g_stop_mutex;
+static std::condition_variable g_stop_cv;
+static bool g_stopping = false;
+
+// a thread's ring, registered on its first record and left to the drainer
+// to free once the thread has exited and the ring is empty
+struct LogRingRef {
+    LogRing *ring = NULL;
+    ~LogRingRef() {
+        if (ring) {
+            ring->orphaned.store(true, std::memory_order_release);
+        }
+    }
+};
+
+static thread_local LogRingRef t_ring;
+
+static LogRing *local_ring() {
+    if (!t_ring.ring) {
+        LogRing *ring = new LogRing();
+        std::lock_guard<std::mutex> lk(g_rings_mutex);
+        g_rings.push_back(ring);
+        t_ring.ring = ring;
+    }
+    return t_ring.ring;
+}
+
+// wall clock at tick resolution, a few ns instead of a full clock read
+static uint64_t coarse_unix_msec() {
+    struct timespec tv = {0, 0};
+#if defined(CLOCK_REALTIME_COARSE)
+    clock_gettime(CLOCK_REALTIME_COARSE, &tv);
+#else
+    clock_gettime(CLOCK_REALTIME, &tv);
+#endif
+    return (uint64_t)tv.tv_sec * 1000 + (uint64_t)tv.tv_nsec / 1000000;
+}
+
+static bool write_all(int fd, const char *data, size_t n) {
+    while (n > 0) {
+        ssize_t rv = ::write(fd, data, n);
+        if (rv < 0 && errno == EINTR) {
+            continue;
+        }
+        if (rv <= 0) {
+            return false;
+        }
+        data += rv;
+        n -= (size_t)rv;
+    }
+    return true;
+}
+
+// a forked child (BGSAVE, log rewrite) has no drainer, and its rings may
+// be half taken: off in the child, msg() goes straight to stderr there
+static void log_off_in_child() {
+    Log::setLevel(LOG_OFF);
+}
+
+bool Log::open(const char *path, LogLevel level) {
+    assert(g_log_fd < 0);
+    if (strcmp(path, "-") == 0) {
+        g_log_fd = dup(2);
+    } else {
+        g_log_fd = ::open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    }
+    if (g_log_fd < 0) {
+        return false;
+    }
+    static std::once_flag atfork;
+    std::call_once(atfork, []() { pthread_atfork(NULL, NULL, log_off_in_child); });
+    g_stopping = false;
+    g_drainer = std::thread(drainLoop);
+    setLevel(level);
+    return true;
+}
+
+void Log::close() {
+    if (g_log_fd < 0) {
+        return;
+    }
+    setLevel(LOG_OFF);
+    {
+        std::lock_guard<std::mutex> lk(g_stop_mutex);
+        g_stopping = true;
+    }
+    g_stop_cv.notify_one();
+    g_drainer.join();
+    ::close(g_log_fd);
+    g_log_fd = -1;
+}
+
+void Log::setLevel(LogLevel level) {
+    threshold.store(level, std::memory_order_relaxed);
+}
+
+bool Log::parseLevel(const char *name, LogLevel &out) {
+    static const char *const names[] = {"debug", "info", "warn", "error"};
+    for (int i = 0; i < 4; i++) {
+        if (strcmp(name, names[i]) == 0) {
+            out = (LogLevel)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// the next free record of this thread's ring, NULL when full
+static LogRecord *ring_claim(LogRing *ring, LogLevel level) {
+    uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+    if (tail - ring->head.load(std::memory_order_acquire) == Log::k_ring_slots) {
+        return NULL;
+    }
+    LogRecord *rec = &ring->slots[tail & (Log::k_ring_slots - 1)];
+    rec->unixMs = coarse_unix_msec();
+    rec->level = (uint8_t)level;
+    rec->prefix = NULL;
+    return rec;
+}
+
+static void ring_publish(LogRing *ring) {
+    ring->tail.store(ring->tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void Log::write(LogLevel level, const char *fmt, ...) {
+    if (!enabled(level)) {
+        return;
+    }
+    LogRing *ring = local_ring();
+    LogRecord *rec = ring_claim(ring, level);
+    if (!rec) {
+        ndropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(rec->text, sizeof(rec->text), fmt, ap);
+    va_end(ap);
+    rec->len = (uint16_t)std::min(std::max(n, 0), (int)sizeof(rec->text) - 1);
+    ring_publish(ring);
+}
+
+void Log::message(LogLevel level, const char *prefix, std::string_view data) {
+    if (!enabled(level)) {
+        return;
+    }
+    LogRing *ring = local_ring();
+    LogRecord *rec = ring_claim(ring, level);
+    if (!rec) {
+        ndropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    rec->prefix = prefix;
+    rec->len = (uint16_t)std::min(data.size(), sizeof(rec->text));
+    memcpy(rec->text, data.data(), rec->len);
+    ring_publish(ring);
+}
+
+// "2026-01-02 15:04:05.678 I text", the date part reused within a second
+static void format_record(std::string &out, const LogRecord &rec) {
+    static const char levels[] = "DIWE";
+    static time_t lastSec = -1;
+    static char date[32];
+    time_t sec = (time_t)(rec.unixMs / 1000);
+    if (sec != lastSec) {
+        struct tm tm;
+        localtime_r(&sec, &tm);
+        strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm);
+        lastSec = sec;
+    }
+    char head[48];
+    int n = snprintf(head, sizeof(head), "%s.%03u %c ", date, (unsigned)(rec.unixMs % 1000),
+                     levels[rec.level]);
+    out.append(head, (size_t)n);
+    if (rec.prefix) {
+        out.append(rec.prefix);
+        out.append(": ");
+    }
+    out.append(rec.text, rec.len);
+    out.push_back('\n');
+}
+
+// take every queued record, one write() for all of them
+size_t Log::drain() {
+    std::vector<LogRing *> rings;
+    {
+        std::lock_guard<std::mutex> lk(g_rings_mutex);
+        rings = g_rings;
+    }
+    static std::string batch;
+    static uint64_t reportedDrops = 0;
+    size_t n = 0;
+    batch.clear();
+    for (LogRing *ring : rings) {
+        // orphaned first: records queued before the thread exited are seen
+        bool orphaned = ring->orphaned.load(std::memory_order_acquire);
+        uint64_t head = ring->head.load(std::memory_order_relaxed);
+        uint64_t tail = ring->tail.load(std::memory_order_acquire);
+        for (; head < tail; head++, n++) {
+            format_record(batch, ring->slots[head & (k_ring_slots - 1)]);
+        }
+        ring->head.store(head, std::memory_order_release);
+        if (orphaned) {
+            std::lock_guard<std::mutex> lk(g_rings_mutex);
+            g_rings.erase(std::find(g_rings.begin(), g_rings.end(), ring));
+            delete ring;
+        }
+    }
+    uint64_t drops = dropped();
+    if (drops != reportedDrops) {
+        LogRecord rec;
+        rec.unixMs = coarse_unix_msec();
+        rec.prefix = NULL;
+        rec.level = LOG_WARN;
+        rec.len = (uint16_t)snprintf(rec.text, sizeof(rec.text), "log: %llu records dropped, rings full",
+                                     (unsigned long long)(drops - reportedDrops));
+        format_record(batch, rec);
+        reportedDrops = drops;
+    }
+    if (!batch.empty()) {
+        // nowhere left to report a failure
+        (void)write_all(g_log_fd, batch.data(), batch.size());
+    }
+    return n;
+}
+
+void Log::drainLoop() {
+    std::unique_lock<std::mutex> lk(g_stop_mutex);
+    while (!g_stopping) {
+        lk.unlock();
+        size_t n = drain();
+        lk.lock();
+        // producers never signal, so a thread logging costs no wakeup;
+        // the drainer only skips its nap while rings are filling up fast
+        if (n < k_ring_slots / 4 && !g_stopping) {
+            g_stop_cv.wait_for(lk, std::chrono::milliseconds(k_drain_ms));
+        }
+    }
+    lk.unlock();
+    drain();
+}
@@ -0,0 +1,103 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include "Buffer.h"
+
+// A large value queued for sending: its bytes go out right after
+// buf[at] without ever being copied into the buffer
+struct ValueRef {
+    size_t at = 0;
+    std::shared_ptr<const std::string> val;
+    size_t sent = 0;
+};
+
+// Responses queued on a connection. Small payloads are copied into buf,
+// large stored values are referenced and written with writev().
+struct Output {
+    Buffer buf;
+    std::vector<ValueRef> refs;  // ordered by at, refs[refHead] is the first
+                                 // unsent one; no memory until a large value
+    size_t refHead = 0;
+    size_t refBytes = 0;         // unsent bytes of refs
+
+    size_t pending() const {
+        return buf.pending() + refBytes;
+    }
+    void appendRef(std::shared_ptr<const std::string> val) {
+        refBytes += val->size();
+        refs.push_back(ValueRef{buf.size, std::move(val), 0});
+    }
+    bool hasRefs() const {
+        return refHead < refs.size();
+    }
+    // Fill up to max iovecs with the pending bytes in order, returns the count
+    int iov(struct iovec *iov, int max) const {
+        int n = 0;
+        size_t pos = buf.head;
+        for (size_t i = refHead; i < refs.size(); i++) {
+            const ValueRef &ref = refs[i];
+            if (n + 2 > max) {
+                return n;
+            }
+            if (ref.at > pos) {
+                iov[n].iov_base = &buf.data[pos];
+                iov[n].iov_len = ref.at - pos;
+                n++;
+            }
+            iov[n].iov_base = (void *)(ref.val->data() + ref.sent);
+            iov[n].iov_len = ref.val->size() - ref.sent;
+            n++;
+            pos = ref.at;
+        }
+        if (n < max && buf.size > pos) {
+            iov[n].iov_base = &buf.data[pos];
+            iov[n].iov_len = buf.size - pos;
+            n++;
+        }
+        return n;
+    }
+    // Drop n bytes sent from the front
+    void consume(size_t n) {
+        while (n) {
+            if (hasRefs() && refs[refHead].at == buf.head) {
+                ValueRef &ref = refs[refHead];
+                size_t take = std::min(n, ref.val->size() - ref.sent);
+                ref.sent += take;
+                refBytes -= take;
+                n -= take;
+                if (ref.sent == ref.val->size()) {
+                    ref.val.reset();
+                    refHead++;
+                }
+                continue;
+            }
+            size_t end = hasRefs() ? refs[refHead].at : buf.size;
+            size_t take = std::min(n, end - buf.head);
+            assert(take > 0);
+            buf.head += take;
+            n -= take;
+        }
+        if (!hasRefs()) {
+            refs.clear();
+            refHead = 0;
+            if (buf.head == buf.size) {
+                buf.head = buf.size = 0;
+            }
+        }
+    }
+    // Give the memory back once everything is sent
+    void release() {
+        assert(!pending());
+        buf.release();
+        std::vector<ValueRef>().swap(refs);
+        refHead = 0;
+    }
+    void swap(Output &other) {
+        buf.swap(other.buf);
+        refs.swap(other.refs);
+        std::swap(refHead, other.refHead);
+        std::swap(refBytes, other.refBytes);
+    }
+};
+
+#endif
@@ -1,6 +1,97 @@
 #include "Server.h"
 
-Server::Server(uint16_t port) : running(true) {
+// socket option that spreads connections over listeners sharing a port.
+// BSD's plain SO_REUSEPORT does not balance, so it is not used there.
+#if defined(__linux__) && defined(SO_REUSEPORT)
+#define REUSEPORT_LB SO_REUSEPORT
+#elif defined(SO_REUSEPORT_LB)
+#define REUSEPORT_LB SO_REUSEPORT_LB
+#endif
+
+// connections accepted per loop turn at most
+const int k_accept_budget = 256;
+
+#ifdef REDICPP_IO_URING
+// io_uring reactor sizing: queue depth, provided recv buffers and the
+// received bytes a stalled connection may buffer before its recv is cancelled
+const unsigned k_uring_entries = 1024;
+const unsigned k_uring_bufs = 256;
+const unsigned k_uring_bufsize = 4096;
+const size_t k_uring_rbuf_max = 1 << 20;
+#endif
+
+static uint64_t get_monotonic_msec() {
+    struct timespec tv = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return (uint64_t)tv.tv_sec * 1000 + (uint64_t)tv.tv_nsec / 1000 / 1000;
+}
+
+static uint64_t get_monotonic_usec() {
+    struct timespec tv = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return (uint64_t)tv.tv_sec * 1000000 + (uint64_t)tv.tv_nsec / 1000;
+}
+
+// wall clock, for expiry times that outlive the process
+static uint64_t get_unix_msec() {
+    struct timespec tv = {0, 0};
+    clock_gettime(CLOCK_REALTIME, &tv);
+    return (uint64_t)tv.tv_sec * 1000 + (uint64_t)tv.tv_nsec / 1000 / 1000;
+}
+
+// for INFO's uptime
+static const uint64_t g_start_msec = get_monotonic_msec();
+
+// set once reactors run, the shard array is fixed from then on
+static std::atomic<bool> g_serving{false};
+
+// the sooner of two loop timeouts, -1 meaning none
+static int min_timeout(int a, int b) {
+    if (a < 0) {
+        return b;
+    }
+    if (b < 0) {
+        return a;
+    }
+    return std::min(a, b);
+}
+
+Server::Server(uint16_t port, unsigned nthreads, const char *unixPath) : running(true) {
+    if (nthreads == 0) {
+        nthreads = 1;
+    }
+    if (port == 0) {
+        listeners.assign(nthreads, -1);
+    } else {
+#ifdef REUSEPORT_LB
+        // one listening socket per reactor, the kernel spreads connections
+        for (unsigned i = 0; i < nthreads; i++) {
+            listeners.push_back(listenOn(port, nthreads > 1));
+        }
+#else
+        // no balancing option: reactors share a single listener
+        int lfd = listenOn(port, false);
+        for (unsigned i = 0; i < nthreads; i++) {
+            listeners.push_back(lfd);
+        }
+#endif
+    }
+    if (unixPath) {
+        unixfd = listenUnix(unixPath);
+        this->unixPath = unixPath;
+    } else if (port == 0) {
+        die("no listener");
+    }
+
+    // written by stop() to wake up run()
+    if (pipe(wakefd)) {
+        die("pipe()");
+    }
+    fd_set_nb(wakefd[0]);
+    fd_set_nb(wakefd[1]);
+}
+
+int Server::listenOn(uint16_t port, bool reuseport) {
     int fd = socket(AF_INET, SOCK_STREAM, 0);
     if (fd < 0) {
         die("socket()");
@@ -8,11 +99,18 @@ Server::Server(uint16_t port) : running(true) {
 
     int val = 1;
     setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
+#ifdef REUSEPORT_LB
+    if (reuseport && setsockopt(fd, SOL_SOCKET, REUSEPORT_LB, &val, sizeof(val))) {
+        die("setsockopt(SO_REUSEPORT)");
+    }
+#else
+    (void)reuseport;
+#endif
 
     // bind
     struct sockaddr_in addr = {};
     addr.sin_family = AF_INET;
-    addr.sin_port = ntohs(1234);
+    addr.sin_port = htons(port);
     addr.sin_addr.s_addr = ntohl(0);    // wildcard address 0.0.0.0
     int rv = bind(fd, (const sockaddr *)&addr, sizeof(addr));
     if (rv) {
@@ -24,56 +122,208 @@ Server::Server(uint16_t port) : running(true) {
     if (rv) {
         die("listen()");
     }
+    fd_set_nb(fd);
+    return fd;
+}
+
+int Server::listenUnix(const char *path) {
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        die("unix socket path");
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        die("socket()");
+    }
+    // a socket left behind by a previous run, anything else is an error
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+    if (bind(fd, (const sockaddr *)&addr, sizeof(addr))) {
+        die("bind()");
+    }
+    if (listen(fd, SOMAXCONN)) {
+        die("listen()");
+    }
+    fd_set_nb(fd);
+    return fd;
 }
 
 Server::~Server() {
-    close(fd);
+    for (size_t i = 0; i < listeners.size(); i++) {
+        if (listeners[i] >= 0 && (i == 0 || listeners[i] != listeners[0])) {
+            close(listeners[i]);
+        }
+    }
+    if (unixfd >= 0) {
+        close(unixfd);
+        unlink(unixPath.c_str());
+    }
+    close(wakefd[0]);
+    close(wakefd[1]);
+}
+
+void Server::stop() {
+    running = false;
+    // never drained: the level-triggered pipe wakes every reactor
+    (void)write(wakefd[1], "x", 1);
+}
+
+void Server::useIoUring(bool on) {
+    ioUring = on;
+}
+
+size_t Server::wbufHighWater = 64 * 1024;
+
+void Server::setWbufHighWater(size_t bytes) {
+    wbufHighWater = bytes ? bytes : 1;
+}
+
+size_t Server::maxMsg = (size_t)512 << 20;
+
+uint64_t Server::idleTimeoutMs = 300 * 1000;
+
+void Server::setIdleTimeout(uint64_t ms) {
+    idleTimeoutMs = ms;
+}
+
+uint64_t Server::slowlogNs = 10 * 1000 * 1000;
+
+static SlowLog g_slowlog;
+
+void Server::setSlowlog(int64_t slowerThanUs, size_t maxLen) {
+    slowlogNs = (slowerThanUs < 0) ? UINT64_MAX : (uint64_t)slowerThanUs * 1000;
+    g_slowlog.setMaxLen(maxLen);
+}
+
+void Server::setMaxMsg(size_t bytes) {
+    // lengths are 32 bits on the wire, responses add their header
+    maxMsg = std::min(bytes, (size_t)UINT32_MAX - 16);
 }
 
 int Server::run() {
+    g_serving = true;
+    // reactor 0 runs on the calling thread, the others get their own
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < listeners.size(); i++) {
+        threads.emplace_back([this, i] { startReactor(listeners[i]); });
+    }
+    int rv = startReactor(listeners[0]);
+    for (std::thread &t : threads) {
+        t.join();
+    }
+    return rv;
+}
+
+int Server::startReactor(int fd) {
+#ifdef REDICPP_IO_URING
+    if (ioUring) {
+        Uring *ring = Uring::create(k_uring_entries, k_uring_bufs, k_uring_bufsize);
+        if (ring) {
+            int rv = runUringReactor(fd, ring);
+            delete ring;
+            return rv;
+        }
+        msg("io_uring not supported, using the event loop");
+    }
+#else
+    if (ioUring) {
+        msg("built without io_uring, using the event loop");
+    }
+#endif
+    return runReactor(fd);
+}
+
+int Server::runReactor(int fd) {
+    std::vector<Conn *> fd2conn;
+    DList idle;     // connections by last activity, oldest first
+    EventLoop *loop = EventLoop::create();
+    // listeners and wakeup pipe are level-triggered, connections edge-triggered
+    const int lfds[2] = {fd, unixfd};
+    for (int lfd : lfds) {
+        if (lfd >= 0 && loop->add(lfd, LOOP_READ)) {
+            die("EventLoop::add()");
+        }
+    }
+    if (loop->add(wakefd[0], LOOP_READ)) {
+        die("EventLoop::add()");
+    }
+    std::vector<LoopEvent> events;
+    std::vector<int> held;
     while (running) {
-        std::vector<Conn *> fd2conn;
-        fd_set_nb(fd);
-        std::vector<struct pollfd> pollArgs;
-        while (true) {
-            pollArgs.clear();
-            struct pollfd pfd = {fd, POLLIN, 0};
-            pollArgs.push_back(pfd);
-            for (Conn *conn: fd2conn) {
-                if (!conn) {
-                    continue;
-                }
-                struct pollfd pfd = {};
-                pfd.fd = conn->fd;
-                pfd.events = (conn->state == STATE_REQ) ? POLLIN : POLLOUT;
-                pfd.events |= POLLERR;
-                pollArgs.push_back(pfd);
-            }
-            int rv = poll(pollArgs.data(), (nfds_t)pollArgs.size(), 10000);
-            if (rv < 0) {
-                die("poll()");
-            }
-            for (size_t i = 1; i < pollArgs.size(); i++) {
-                if (pollArgs[i].revents) {
-                    Conn *conn = fd2conn[pollArgs[i].fd];
-                    connectionIO(conn);
-                    if (conn->state == STATE_DONE) {
-                        fd2conn[conn->fd] = NULL;
-                        (void)close(conn->fd);
-                        delete conn;
-                    }
-                }
+        // sleep until the nearest key expiry or idle deadline, not at all
+        // with work pending
+        int timeout = min_timeout(keyspaceCron(), idleWait(&idle, get_monotonic_msec()));
+        int rv = loop->wait(events, timeout);
+        if (rv < 0) {
+            die(loop->name());
+        }
+        uint64_t now = get_monotonic_msec();
+        bool acceptReady[2] = {false, false};
+        for (const LoopEvent &ev : events) {
+            if (ev.fd == lfds[0] || ev.fd == lfds[1]) {
+                acceptReady[ev.fd == lfds[1]] = true;
+                continue;
+            }
+            if (ev.fd == wakefd[0]) {
+                continue;
+            }
+            if ((size_t)ev.fd >= fd2conn.size() || !fd2conn[ev.fd]) {
+                continue;
+            }
+            Conn *conn = fd2conn[ev.fd];
+            connectionIO(conn);
+            if (conn->state != STATE_DONE) {
+                connTouch(&idle, conn, now);
             }
+            connSettle(fd2conn, loop, conn);
+        }
+        // one log write (and fsync) for the turn, then the responses that
+        // waited for it
+        aofFlush(held);
+        for (int hfd : held) {
+            Conn *conn = (size_t)hfd < fd2conn.size() ? fd2conn[hfd] : NULL;
+            if (conn && conn->aof_held) {
+                conn->aof_held = false;
+                stateResponse(conn);
+                connSettle(fd2conn, loop, conn);
+            }
+        }
 
-            if (pollArgs[0].revents) {
-                (void)acceptNewConn(fd2conn, fd);
+        for (int l = 0; l < 2; l++) {
+            if (!acceptReady[l]) {
+                continue;
+            }
+            // drain the accept queue, bounded so a reconnect storm can't
+            // starve the clients already connected
+            for (int i = 0; i < k_accept_budget; i++) {
+                if (acceptNewConn(fd2conn, loop, &idle, lfds[l]) < 0) {
+                    break;
+                }
             }
         }
+        reapIdle(fd2conn, loop, &idle, now);
+    }
+
+    for (Conn *conn : fd2conn) {
+        if (conn) {
+            connDone(fd2conn, loop, conn);
+        }
     }
+    delete loop;
     return 0;
 }
 
 void Server::msg(const char *msg) {
+    if (Log::enabled(LOG_INFO)) {
+        Log::write(LOG_INFO, "%s", msg);
+        return;
+    }
     fprintf(stderr, "Server: %s\n", msg);
 }
 
@@ -83,6 +333,13 @@ void Server::die(const char *msg) {
     abort();
 }
 
+void Server::fd_set_nodelay(int fd) {
+    // responses are written once per turn already, don't let Nagle hold them.
+    // fails harmlessly on unix sockets
+    int val = 1;
+    (void)setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val));
+}
+
 void Server::fd_set_nb(int fd) {
     errno = 0;
     int flags = fcntl(fd, F_GETFL, 0);
@@ -98,41 +355,166 @@ void Server::fd_set_nb(int fd) {
     }
 }
 
-const size_t k_max_msg = 4096;
+// read size of the small-request fast path, rbuf starts this big
+const size_t k_rbuf_size = 4 + 4096;
+// rbuf capacity kept once a large request is done with
+const size_t k_rbuf_keep = 64 << 10;
+// values above this are stored shared and written straight from the keyspace
+const size_t k_inline_val = 4096;
+
+// freed Conn objects kept per reactor thread for the next accept
+const size_t k_conn_pool_keep = 1024;
+
+struct ConnPool : public std::vector<void *> {
+    ~ConnPool() {
+        for (void *mem : *this) {
+            ::operator delete(mem);
+        }
+    }
+};
+
+// Conn memory of this thread's reactor, recycled instead of freed
+static thread_local ConnPool t_conn_pool;
+
+Conn *Server::connNew() {
+    void *mem = NULL;
+    if (!t_conn_pool.empty()) {
+        mem = t_conn_pool.back();
+        t_conn_pool.pop_back();
+    } else {
+        mem = ::operator new(sizeof(Conn));
+    }
+    Stats::bump(Stats::local().connsOpened);
+    return new (mem) Conn();
+}
+
+void Server::connFree(Conn *conn) {
+    Stats::bump(Stats::local().connsClosed);
+    conn->~Conn();
+    if (t_conn_pool.size() < k_conn_pool_keep) {
+        t_conn_pool.push_back(conn);
+    } else {
+        ::operator delete(conn);
+    }
+}
+
+void Server::connRelease(Conn *conn) {
+    // end of a turn: drained buffers go back to the pool
+    if (conn->rbuf.cap && !conn->rbuf.pending()) {
+        conn->rbuf.release();
+    }
+    if (conn->wbuf.buf.cap && !conn->wbuf.pending()) {
+        conn->wbuf.release();
+    }
+#ifdef REDICPP_IO_URING
+    if (conn->sending.buf.cap && !conn->sending.pending()) {
+        conn->sending.release();
+    }
+#endif
+}
 
 void Server::connPut(std::vector<Conn*> &fd2conn, struct Conn *conn) {
+    if (fd2conn.size() <= (size_t)conn->fd) {
+        fd2conn.resize(conn->fd + 1);
+    }
     fd2conn[conn->fd] = conn;
 }
 
-int32_t Server::acceptNewConn(std::vector<Conn*> &fd2conn, int fd) {
-    struct sockaddr_in client_addr = {};
-    socklen_t socklen = sizeof(client_addr);
-    int connfd = accept(fd, (struct sockaddr *)&client_addr, &socklen);
-    if (connfd < 0) {
-        // msg("accept() error");
-        return -1;  // error
+void Server::connDone(std::vector<Conn*> &fd2conn, EventLoop *loop, Conn *conn) {
+    fd2conn[conn->fd] = NULL;
+    (void)loop->remove(conn->fd);
+    (void)close(conn->fd);
+    conn->detach();
+    connFree(conn);
+}
+
+// after a connection's IO: closed, or drained buffers released and the
+// interest set updated
+void Server::connSettle(std::vector<Conn*> &fd2conn, EventLoop *loop, Conn *conn) {
+    if (conn->state == STATE_DONE) {
+        connDone(fd2conn, loop, conn);
+        return;
     }
+    connRelease(conn);
+    // only touch the interest set when it changes
+    uint32_t want = connInterest(conn);
+    if (want != conn->interest) {
+        conn->interest = want;
+        if (loop->modify(conn->fd, want | LOOP_EDGE)) {
+            connDone(fd2conn, loop, conn);
+        }
+    }
+}
 
-    // set the new connection fd to nonblocking mode
-    fd_set_nb(connfd);
-    // creating the struct Conn
-    struct Conn *conn = (struct Conn *)malloc(sizeof(struct Conn));
-    if (!conn) {
-        close(connfd);
+void Server::connTouch(DList *idle, Conn *conn, uint64_t now) {
+    // most recently active at the tail, O(1)
+    conn->idle_start = now;
+    conn->detach();
+    idle->insertBefore(conn);
+}
+
+int Server::idleWait(const DList *idle, uint64_t now) {
+    // the oldest connection is the first to time out
+    if (!idleTimeoutMs || idle->empty()) {
+        return -1;
+    }
+    uint64_t deadline = static_cast<const Conn *>(idle->next)->idle_start + idleTimeoutMs;
+    return deadline <= now ? 0 : (int)std::min(deadline - now, (uint64_t)INT32_MAX);
+}
+
+void Server::reapIdle(std::vector<Conn*> &fd2conn, EventLoop *loop, DList *idle, uint64_t now) {
+    // stops at the first live one: O(expired), not O(connections)
+    while (idleWait(idle, now) == 0) {
+        connDone(fd2conn, loop, static_cast<Conn *>(idle->next));
+    }
+}
+
+// accept a connection already non-blocking and close-on-exec
+static int accept_nb(int fd) {
+#if defined(__linux__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
+    return accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+    int connfd = accept(fd, NULL, NULL);
+    if (connfd >= 0) {
+        Server::fd_set_nb(connfd);
+        (void)fcntl(connfd, F_SETFD, FD_CLOEXEC);
+    }
+    return connfd;
+#endif
+}
+
+int32_t Server::acceptNewConn(std::vector<Conn*> &fd2conn, EventLoop *loop, DList *idle, int fd) {
+    int connfd = accept_nb(fd);
+    if (connfd < 0) {
+        // EAGAIN: the queue is drained
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNABORTED) {
+            msg("accept() error");
+        }
         return -1;
     }
+    fd_set_nodelay(connfd);
+    struct Conn *conn = connNew();
     conn->fd = connfd;
     conn->state = STATE_REQ;
-    conn->rbuf_size = 0;
-    conn->wbuf_size = 0;
-    conn->wbuf_sent = 0;
+    conn->interest = LOOP_READ;
     connPut(fd2conn, conn);
+    connTouch(idle, conn, get_monotonic_msec());
+    // edge-triggered: stateRequest / stateResponse drain until EAGAIN
+    if (loop->add(connfd, LOOP_READ | LOOP_EDGE)) {
+        msg("EventLoop::add() error");
+        fd2conn[connfd] = NULL;
+        close(connfd);
+        conn->detach();
+        connFree(conn);
+        return -1;
+    }
     return 0;
 }
 
 const size_t k_max_args = 1024;
 
-int32_t Server::parseReq(const uint8_t *data, size_t len, std::vector<std::string> &out) {
+// the arguments are views into data: valid until the request is consumed
+int32_t Server::parseReq(const uint8_t *data, size_t len, std::vector<std::string_view> &out) {
     if (len < 4) {
         return -1;
     }
@@ -152,7 +534,7 @@ int32_t Server::parseReq(const uint8_t *data, size_t len, std::vector<std::strin
         if (pos + 4 + sz > len) {
             return -1;
         }
-        out.push_back(std::string((char *)&data[pos + 4], sz));
+        out.emplace_back((const char *)&data[pos + 4], sz);
         pos += 4 + sz;
     }
 
@@ -162,188 +544,2070 @@ int32_t Server::parseReq(const uint8_t *data, size_t len, std::vector<std::strin
     return 0;
 }
 
-static std::unordered_map<std::string, std::string> g_map;
+enum {
+    T_STR = 0,
+    T_ZSET = 1,
+};
 
-uint32_t Server::do_get(const std::vector<std::string> &cmd, uint8_t *res, uint32_t *reslen) {
-    if (!g_map.count(cmd[1])) {
-        return RES_NX;
+// keyspace entry, linked into its shard's map through its HNode base. The
+// header, the key and a value up to k_inline_val share one slab block;
+// larger values and sorted sets hang off ptr.
+// GET reads entries with no lock, so a string entry never changes once it
+// is in the map: SET puts a new one in its place, and the old one is freed
+// when no reader can be on it any more (see entry_retire()).
+struct Entry : public HNode {
+    size_t heap_idx = (size_t)-1;  // expiry timer in the shard's heap, if any
+    // the timer's deadline, 0 without one; a copy for lock-free readers
+    std::atomic<uint64_t> expire_at{0};
+    uint32_t klen = 0;
+    uint32_t vlen = 0;             // inline value bytes
+    uint8_t type = T_STR;
+    uint8_t sclass = 0;            // slab class of the block
+    // T_STR: NULL or a std::shared_ptr<const std::string> shared with the
+    // connections still sending it, T_ZSET: the ZSet
+    void *ptr = NULL;
+
+    char *kdata() {
+        return (char *)(this + 1);
     }
-    std::string &val = g_map[cmd[1]];
-    assert(val.size() <= k_max_msg);
-    memcpy(res, val.data(), val.size());
-    *reslen = (uint32_t)val.size();
-    return RES_OK;
-}
+    char *vdata() {
+        return kdata() + klen;
+    }
+    std::string_view key() const {
+        return std::string_view((const char *)(this + 1), klen);
+    }
+    std::shared_ptr<const std::string> &big() const {
+        return *(std::shared_ptr<const std::string> *)ptr;
+    }
+    ZSet *zset() const {
+        return (ZSet *)ptr;
+    }
+};
 
-uint32_t Server::do_set(const std::vector<std::string> &cmd, uint8_t *res, uint32_t *reslen) {
-    (void)res;
-    (void)reslen;
-    g_map[cmd[1]] = cmd[2];
-    return RES_OK;
-}
+// a value detached from its entry, for the lazy free thread
+struct LazyValue : public LazyNode {
+    ZSet *zset = NULL;
+    std::shared_ptr<const std::string> big;
+    ~LazyValue() {
+        delete zset;
+    }
+};
 
-uint32_t Server::do_del(const std::vector<std::string> &cmd, uint8_t *res, uint32_t *reslen) {
-    (void)res;
-    (void)reslen;
-    g_map.erase(cmd[1]);
-    return RES_OK;
+static void lazy_value_destroy(LazyNode *node) {
+    delete static_cast<LazyValue *>(node);
 }
 
-bool Server::cmd_is(const std::string &word, const char *cmd) {
-    return 0 == strcasecmp(word.c_str(), cmd);
-}
+// frees detached values in the background. Declared before the shards so
+// that it is destroyed after them: ~Shard can still hand it large values.
+static LazyFree g_lazy_free(lazy_value_destroy);
 
-int32_t Server::do_request(const uint8_t *req, uint32_t reqlen, uint32_t *rescode, uint8_t *res, uint32_t *reslen) {
-    std::vector<std::string> cmd;
-    if (0 != parseReq(req, reqlen, cmd)) {
-        msg("bad req");
-        return -1;
+// One stripe of the keyspace. A key lives in the shard picked by its hash,
+// and each shard is a whole keyspace with its own lock: readers share it,
+// writers own it, and commands on different shards run in parallel. Own
+// cache lines, so that locking one shard doesn't slow its neighbours.
+struct alignas(64) Shard {
+    HMap map;
+    std::shared_mutex mutex;
+    // the blocks of map entries, guarded by mutex
+    Slab slab;
+    // set while map has a resize in progress, read without the lock
+    std::atomic<bool> rehashing{false};
+    // expiry timers of map entries, guarded by mutex
+    std::vector<HeapItem> heap;
+    // deadline at the top of heap, read without the lock
+    std::atomic<uint64_t> next_expire{UINT64_MAX};
+    // unlinked entries and bucket arrays, freed once the epoch has moved
+    // past them; guarded by mutex, the count is read without it
+    struct Retired {
+        void *mem;
+        uint64_t epoch;
+        bool table;
+        bool lazy;
+    };
+    std::vector<Retired> retired;
+    std::atomic<size_t> nretired{0};
+    // bytes of the values kept outside the slab, guarded by mutex
+    size_t bigBytes = 0;
+
+    Shard() {
+        map.setTableRetire(retireTable, this);
     }
-    if (cmd.size() == 2 && cmd_is(cmd[0], "get")) {
-        *rescode = do_get(cmd, res, reslen);
-    } else if (cmd.size() == 3 && cmd_is(cmd[0], "set")) {
-        *rescode = do_set(cmd, res, reslen);
-    } else if (cmd.size() == 2 && cmd_is(cmd[0], "del")) {
-        *rescode = do_del(cmd, res, reslen);
-    } else {
-        // cmd is not recognized
-        *rescode = RES_ERR;
-        const char *msg = "Unknown cmd";
-        strcpy((char *)res, msg);
-        *reslen = strlen(msg);
-        return 0;
+    ~Shard();
+    static void retireTable(void *ctx, void *mem) {
+        Shard *sh = (Shard *)ctx;
+        sh->retired.push_back({mem, epoch_current(), true, false});
+        sh->nretired = sh->retired.size();
     }
-    return 0;
+};
+
+const size_t k_default_shards = 16;
+const size_t k_max_shards = 1024;
+static std::unique_ptr<Shard[]> g_shards(new Shard[k_default_shards]);
+static size_t g_nshards = k_default_shards;
+
+// the high hash bits pick the shard, the low ones the bucket within it
+static Shard &shard_of(uint64_t hcode) {
+    return g_shards[(hcode >> 48) & (g_nshards - 1)];
 }
 
-bool Server::tryOneRequest(Conn *conn) {
-    // try to parse a request from the buffer
-    if (conn->rbuf_size < 4) {
-        // not enough data in the buffer. Will retry in the next iteration
-        return false;
-    }
-    uint32_t len = 0;
-    memcpy(&len, &conn->rbuf[0], 4);
-    if (len > k_max_msg) {
-        msg("too long");
-        conn->state = STATE_DONE;
-        return false;
+// every shard locked, in index order so that two of these can't deadlock
+template <class Lock>
+struct AllShardsLock {
+    std::vector<Lock> locks;
+    AllShardsLock() {
+        locks.reserve(g_nshards);
+        for (size_t i = 0; i < g_nshards; i++) {
+            locks.emplace_back(g_shards[i].mutex);
+        }
     }
-    if (4 + len > conn->rbuf_size) {
-        // not enough data in the buffer. Will retry in the next iteration
-        return false;
+};
+
+static size_t keyspace_size() {
+    size_t n = 0;
+    for (size_t i = 0; i < g_nshards; i++) {
+        n += g_shards[i].map.size();
     }
+    return n;
+}
 
-    // got one request, generate the response.
-    uint32_t rescode = 0;
-    uint32_t wlen = 0;
-    int32_t err = do_request(
-        &conn->rbuf[4], len,
-        &rescode, &conn->wbuf[4 + 4], &wlen
-    );
-    if (err) {
-        conn->state = STATE_DONE;
-        return false;
+void Server::setShards(size_t n) {
+    // before the first key and before serving: entries don't move between
+    // shards, and nothing else may hold a reference into the old ones
+    assert(!g_serving.load());
+    assert(keyspace_size() == 0 && g_lazy_free.pending() == 0);
+    for (size_t i = 0; i < g_nshards; i++) {
+        assert(g_shards[i].retired.empty());
     }
-    wlen += 4;
-    memcpy(&conn->wbuf[0], &wlen, 4);
-    memcpy(&conn->wbuf[4], &rescode, 4);
-    conn->wbuf_size = 4 + wlen;
+    size_t pow2 = 1;
+    while (pow2 < n && pow2 < k_max_shards) {
+        pow2 *= 2;
+    }
+    g_shards.reset(new Shard[pow2]);
+    g_nshards = pow2;
+}
 
-    // remove the request from the buffer.
-    // note: frequent memmove is inefficient.
-    // note: need better handling for production code.
-    size_t remain = conn->rbuf_size - 4 - len;
-    if (remain) {
-        memmove(conn->rbuf, &conn->rbuf[4 + len], remain);
+size_t Server::shardCount() {
+    return g_nshards;
+}
+
+// expired keys deleted per loop turn at most
+const size_t k_max_expire_work = 2000;
+// retired entries a writer leaves behind before it reclaims them
+const size_t k_reclaim_batch = 64;
+// lock-free lookups interrupted by a resize before GET takes the lock
+const int k_lookup_retries = 4;
+// values costlier than this to free go to the lazy free thread on DEL,
+// expiry and overwrite; UNLINK sends every separately allocated value
+const size_t k_lazy_free_bytes = 1 << 20;
+const size_t k_lazy_free_members = 1024;
+
+// the BGSAVE child while it runs, 0 otherwise
+static std::atomic<pid_t> g_bgsave_pid(0);
+// loop timeout while a BGSAVE or log rewrite child is waiting to be reaped,
+// or retired entries for a reader to leave
+const int k_bgsave_poll_ms = 100;
+// one SAVE at a time
+static std::mutex g_save_mutex;
+
+// the append-only log, off unless openAppendLog() was called
+static AppendLog g_aof;
+// the BGREWRITEAOF child while it runs, 0 otherwise
+static std::atomic<pid_t> g_aof_rewrite_pid(0);
+// this reactor's connections with responses held for the log
+static thread_local std::vector<int> t_aof_held;
+
+// a record of the log, in the request encoding so that replay is just
+// do_request() over the file
+static void aof_encode(std::string &out, std::initializer_list<std::string_view> args) {
+    uint32_t len = 4;
+    for (std::string_view a : args) {
+        len += 4 + (uint32_t)a.size();
+    }
+    uint32_t n = (uint32_t)args.size();
+    out.append((const char *)&len, 4);
+    out.append((const char *)&n, 4);
+    for (std::string_view a : args) {
+        uint32_t sz = (uint32_t)a.size();
+        out.append((const char *)&sz, 4);
+        out.append(a.data(), a.size());
     }
-    conn->rbuf_size = remain;
+}
 
-    // change state
-    conn->state = STATE_RESP;
-    stateResponse(conn);
+// log a change; the caller holds the key's shard exclusively, so the
+// records of a key are in the order its changes were made
+static void aof_log(std::initializer_list<std::string_view> args) {
+    if (!g_aof.enabled()) {
+        return;
+    }
+    static thread_local std::string rec;
+    rec.clear();
+    aof_encode(rec, args);
+    g_aof.append(rec.data(), rec.size());
+}
 
-    // continue the outer loop if the request was fully processed
-    return (conn->state == STATE_REQ);
+// expiry times go to the log as absolute unix ms, so replay at any later
+// time restores the same deadline
+static std::string_view aof_unix_ms(char (&buf)[24], int64_t ttl_ms) {
+    auto rv = std::to_chars(buf, buf + sizeof(buf), (int64_t)get_unix_msec() + ttl_ms);
+    return std::string_view(buf, (size_t)(rv.ptr - buf));
 }
 
-bool Server::tryFillRbuf(Conn *conn) {
-    assert(conn->rbuf_size < sizeof(conn->rbuf));
-    ssize_t rv = 0;
-    do {
-        size_t cap = sizeof(conn->rbuf) - conn->rbuf_size;
-        rv = read(conn->fd, &conn->rbuf[conn->rbuf_size], cap);
-    } while (rv < 0 && errno == EINTR);
-    if (rv < 0 && errno == EAGAIN) {
-        // got EAGAIN, stop.
+bool Server::aofHold(Conn *conn) {
+    if (conn->aof_seq <= g_aof.syncedBytes()) {
         return false;
     }
-    if (rv < 0) {
-        msg("read() error");
-        conn->state = STATE_DONE;
-        return false;
+    if (!conn->aof_held) {
+        conn->aof_held = true;
+        t_aof_held.push_back(conn->fd);
     }
-    if (rv == 0) {
-        if (conn->rbuf_size > 0) {
-            msg("unexpected EOF");
-        } else {
-            msg("EOF");
+    return true;
+}
+
+void Server::aofFlush(std::vector<int> &held) {
+    held.clear();
+    g_aof.flush();
+    held.swap(t_aof_held);
+}
+
+
+static uint64_t key_hash(std::string_view key) {
+    return str_hash((const uint8_t *)key.data(), key.size());
+}
+
+static Entry *entry_lookup(Shard &sh, std::string_view key, uint64_t hcode) {
+    return static_cast<Entry *>(sh.map.lookup(hcode, [&](HNode *node) {
+        const Entry *ent = static_cast<Entry *>(node);
+        return ent->key() == key;
+    }));
+}
+
+// set the expiry time of an entry, or clear it with a negative ttl
+static void entry_set_ttl(Shard &sh, Entry *ent, int64_t ttl_ms) {
+    if (ttl_ms < 0) {
+        if (ent->heap_idx != (size_t)-1) {
+            heap_delete(sh.heap, ent->heap_idx);
+            ent->heap_idx = (size_t)-1;
         }
-        conn->state = STATE_DONE;
-        return false;
+    } else {
+        HeapItem item;
+        item.val = get_monotonic_msec() + (uint64_t)ttl_ms;
+        item.ref = &ent->heap_idx;
+        item.owner = ent;
+        heap_upsert(sh.heap, item);
     }
+    ent->expire_at.store(ent->heap_idx == (size_t)-1 ? 0 : sh.heap[ent->heap_idx].val,
+                         std::memory_order_relaxed);
+    sh.next_expire = sh.heap.empty() ? UINT64_MAX : sh.heap[0].val;
+}
 
-    conn->rbuf_size += (size_t)rv;
-    assert(conn->rbuf_size <= sizeof(conn->rbuf));
+static bool entry_expired(const Entry *ent, uint64_t now) {
+    uint64_t at = ent->expire_at.load(std::memory_order_relaxed);
+    return at && at <= now;
+}
 
-    // Try to process requests one by one.
-    // Why is there a loop? Please read the explanation of "pipelining".
-    while (tryOneRequest(conn)) {}
-    return (conn->state == STATE_REQ);
+static size_t entry_block_size(size_t klen, size_t vlen) {
+    return sizeof(Entry) + klen + vlen;
 }
 
-void Server::stateRequest(Conn *conn) {
-    while (tryFillRbuf(conn)) {}
+// a new entry with room for an inline value of vlen bytes, not in the map
+static Entry *entry_new(Shard &sh, std::string_view key, uint64_t hcode, size_t vlen) {
+    uint8_t sclass = 0;
+    void *block = sh.slab.alloc(entry_block_size(key.size(), vlen), sclass);
+    Entry *ent = new (block) Entry();
+    ent->sclass = sclass;
+    ent->klen = (uint32_t)key.size();
+    ent->vlen = (uint32_t)vlen;
+    memcpy(ent->kdata(), key.data(), key.size());
+    ent->hcode = hcode;
+    return ent;
 }
 
-bool Server::tryFlushWbuf(Conn *conn) {
-    ssize_t rv = 0;
-    do {
-        size_t remain = conn->wbuf_size - conn->wbuf_sent;
-        rv = write(conn->fd, &conn->wbuf[conn->wbuf_sent], remain);
-    } while (rv < 0 && errno == EINTR);
-    if (rv < 0 && errno == EAGAIN) {
-        // got EAGAIN, stop.
+// whether freeing the value would hold up the loop
+static bool entry_free_is_slow(const Entry *ent, bool lazy) {
+    if (!ent->ptr) {
         return false;
     }
-    if (rv < 0) {
-        msg("write() error");
-        conn->state = STATE_DONE;
-        return false;
+    if (ent->type == T_ZSET) {
+        return lazy || ent->zset()->size() > k_lazy_free_members;
     }
-    conn->wbuf_sent += (size_t)rv;
-    assert(conn->wbuf_sent <= conn->wbuf_size);
-    if (conn->wbuf_sent == conn->wbuf_size) {
-        // response was fully sent, change state back
-        conn->state = STATE_REQ;
-        conn->wbuf_sent = 0;
-        conn->wbuf_size = 0;
-        return false;
+    return lazy || ent->big()->size() > k_lazy_free_bytes;
+}
+
+// free what hangs off ptr, in the background if that is slow
+static void entry_drop_ptr(Entry *ent, bool lazy) {
+    if (!ent->ptr) {
+        return;
     }
-    // still got some data in wbuf, could try to write again
-    return true;
+    if (entry_free_is_slow(ent, lazy)) {
+        LazyValue *old = new LazyValue();
+        if (ent->type == T_ZSET) {
+            old->zset = ent->zset();
+        } else {
+            old->big = std::move(ent->big());
+        }
+        g_lazy_free.push(old);
+    } else if (ent->type == T_ZSET) {
+        delete ent->zset();
+    }
+    if (ent->type == T_STR) {
+        delete &ent->big();
+    }
+    ent->ptr = NULL;
 }
 
-void Server::stateResponse(Conn *conn) {
-    while (tryFlushWbuf(conn)) {}
+static void entry_free(Shard &sh, Entry *ent, bool lazy) {
+    if (ent->type == T_STR && ent->ptr) {
+        sh.bigBytes -= ent->big()->size();
+    }
+    entry_drop_ptr(ent, lazy);
+    size_t n = entry_block_size(ent->klen, ent->vlen);
+    uint8_t sclass = ent->sclass;
+    ent->~Entry();
+    sh.slab.free(ent, n, sclass);
 }
 
-void Server::connectionIO(Conn *conn) {
-    if (conn->state == STATE_REQ) {
-        stateRequest(conn);
-    } else if (conn->state == STATE_RESP) {
-        stateResponse(conn);
-    } else {
-        assert(0);  // not expected
+// free what the shard retired before the oldest epoch still pinned
+static void shard_reclaim(Shard &sh) {
+    uint64_t oldest = epoch_collect();
+    size_t n = 0;
+    // tagged in order, the ones still in use are at the back
+    for (; n < sh.retired.size() && sh.retired[n].epoch < oldest; n++) {
+        Shard::Retired &r = sh.retired[n];
+        if (r.table) {
+            free(r.mem);
+        } else {
+            entry_free(sh, (Entry *)r.mem, r.lazy);
+        }
     }
-}
\ No newline at end of file
+    sh.retired.erase(sh.retired.begin(), sh.retired.begin() + n);
+    sh.nretired = sh.retired.size();
+}
+
+// an entry out of the map, freed once lock-free readers are done with it
+static void entry_retire(Shard &sh, Entry *ent, bool lazy) {
+    sh.retired.push_back({ent, epoch_current(), false, lazy});
+    sh.nretired = sh.retired.size();
+    if (sh.retired.size() % k_reclaim_batch == 0) {
+        shard_reclaim(sh);
+    }
+}
+
+Shard::~Shard() {
+    for (Retired &r : retired) {
+        if (r.table) {
+            free(r.mem);
+        } else {
+            entry_free(*this, (Entry *)r.mem, false);
+        }
+    }
+}
+
+// unlink, untime and free an entry
+static void entry_remove(Shard &sh, Entry *ent, bool lazy = false) {
+    (void)sh.map.remove(ent->hcode, [&](HNode *node) {
+        return node == ent;
+    });
+    entry_set_ttl(sh, ent, -1);
+    entry_retire(sh, ent, lazy);
+}
+
+// a string entry holding val, not in the map. The only copy of a value,
+// straight from the read buffer.
+static Entry *entry_new_str(Shard &sh, std::string_view key, uint64_t hcode, std::string_view val) {
+    bool big = val.size() > k_inline_val;
+    Entry *ent = entry_new(sh, key, hcode, big ? 0 : val.size());
+    if (big) {
+        ent->ptr = new std::shared_ptr<const std::string>(std::make_shared<const std::string>(val));
+        sh.bigBytes += val.size();
+    } else {
+        memcpy(ent->vdata(), val.data(), val.size());
+    }
+    return ent;
+}
+
+// put ent in the place of old in one store, then untime and free old
+static void entry_replace(Shard &sh, Entry *old, Entry *ent) {
+    sh.map.replace(old, ent);
+    entry_set_ttl(sh, old, -1);
+    entry_retire(sh, old, false);
+}
+
+// writers only: an expired entry met on the way is deleted for good
+static Entry *entry_lookup_live(Shard &sh, std::string_view key, uint64_t hcode) {
+    Entry *ent = entry_lookup(sh, key, hcode);
+    if (ent && entry_expired(ent, get_monotonic_msec())) {
+        entry_remove(sh, ent);
+        return NULL;
+    }
+    return ent;
+}
+
+// the shortest log that rebuilds the keyspace: a SET or one ZADD per
+// member, then PEXPIREAT for a timed key. The caller keeps writers out of
+// the keyspace.
+static bool aof_rewrite(const std::string &tmp) {
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    std::string buf;
+    bool ok = true;
+    // written out a MiB at a time
+    auto spill = [&](size_t limit) {
+        if (buf.size() >= limit) {
+            ok = ok && Server::write_all(fd, buf.data(), buf.size()) == 0;
+            buf.clear();
+        }
+    };
+    uint64_t now = get_monotonic_msec();
+    for (size_t i = 0; i < g_nshards; i++) {
+        Shard &sh = g_shards[i];
+        sh.map.forEach([&](HNode *node) {
+            Entry *ent = static_cast<Entry *>(node);
+            if (entry_expired(ent, now)) {
+                return;
+            }
+            if (ent->type == T_ZSET) {
+                ent->zset()->forEach([&](const ZNode *znode) {
+                    char score[32];
+                    auto rv = std::to_chars(score, score + sizeof(score), znode->score);
+                    aof_encode(buf, {"zadd", ent->key(), std::string_view(score, (size_t)(rv.ptr - score)),
+                                     znode->name});
+                    spill(1 << 20);
+                });
+            } else if (ent->ptr) {
+                aof_encode(buf, {"set", ent->key(), *ent->big()});
+            } else {
+                aof_encode(buf, {"set", ent->key(), std::string_view(ent->vdata(), ent->vlen)});
+            }
+            if (ent->heap_idx != (size_t)-1) {
+                char at[24];
+                aof_encode(buf, {"pexpireat", ent->key(),
+                                 aof_unix_ms(at, (int64_t)(sh.heap[ent->heap_idx].val - now))});
+            }
+            spill(1 << 20);
+        });
+    }
+    spill(0);
+    ok = ok && fsync(fd) == 0;
+    return close(fd) == 0 && ok;
+}
+
+static std::string aof_rewrite_tmp() {
+    return g_aof.filePath() + ".rewrite";
+}
+
+// fork the rewrite child; the caller holds every shard exclusively, so
+// the child's image and the start of the rewrite buffer are the same
+// point in the log. NULL once started, the reason otherwise.
+static const char *aof_start_rewrite() {
+    if (g_aof_rewrite_pid) {
+        return "Log rewrite already in progress";
+    }
+    g_aof.beginRewrite();
+    pid_t pid = fork();
+    if (pid < 0) {
+        g_aof.abortRewrite();
+        return "fork() failed";
+    }
+    if (pid == 0) {
+        uint64_t t0 = get_monotonic_usec();
+        bool ok = aof_rewrite(aof_rewrite_tmp());
+        if (ok) {
+            char buf[128];
+            snprintf(buf, sizeof(buf), "log rewrite took %.3f s",
+                     (double)(get_monotonic_usec() - t0) / 1e6);
+            Server::msg(buf);
+        }
+        _exit(ok ? 0 : 1);
+    }
+    g_aof_rewrite_pid = pid;
+    return NULL;
+}
+
+int Server::keyspaceCron() {
+    uint64_t now = get_monotonic_msec();
+    // active expiry, bounded across shards so a mass expiry can't stall
+    // the loop
+    size_t nwork = 0;
+    bool busy = false;
+    uint64_t next = UINT64_MAX;
+    bool retired = false;
+    for (size_t i = 0; i < g_nshards; i++) {
+        Shard &sh = g_shards[i];
+        if (sh.rehashing || sh.nretired || (sh.next_expire <= now && nwork < k_max_expire_work)) {
+            std::unique_lock<std::shared_mutex> guard(sh.mutex);
+            sh.map.rehashStep();
+            while (!sh.heap.empty() && sh.heap[0].val <= now && nwork < k_max_expire_work) {
+                entry_remove(sh, static_cast<Entry *>(sh.heap[0].owner));
+                nwork++;
+            }
+            sh.rehashing = sh.map.rehashing();
+            // what the writers retired this turn, before it piles up
+            shard_reclaim(sh);
+        }
+        busy = busy || sh.rehashing;
+        retired = retired || sh.nretired;
+        next = std::min(next, sh.next_expire.load());
+    }
+    // whichever reactor gets here first reaps the BGSAVE child
+    pid_t child = g_bgsave_pid;
+    if (child > 0) {
+        int status = 0;
+        if (waitpid(child, &status, WNOHANG) == child) {
+            g_bgsave_pid = 0;
+            bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+            msg(ok ? "background save done" : "background save failed");
+        }
+    }
+    child = g_aof_rewrite_pid;
+    if (child > 0) {
+        int status = 0;
+        if (waitpid(child, &status, WNOHANG) == child) {
+            bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+            if (ok) {
+                ok = g_aof.finishRewrite(aof_rewrite_tmp());
+            } else {
+                g_aof.abortRewrite();
+                unlink(aof_rewrite_tmp().c_str());
+            }
+            g_aof_rewrite_pid = 0;
+            msg(ok ? "log rewrite done" : "log rewrite failed");
+        }
+    } else if (g_aof.wantsRewrite()) {
+        AllShardsLock<std::unique_lock<std::shared_mutex>> guard;
+        if (!g_aof_rewrite_pid && !aof_start_rewrite()) {
+            msg("log doubled since the last rewrite, rewriting");
+        }
+    }
+    // don't sleep while there is work left
+    if (busy || next <= now) {
+        return 0;
+    }
+    int timeout = g_bgsave_pid || g_aof_rewrite_pid || retired ? k_bgsave_poll_ms : -1;
+    if (next == UINT64_MAX) {
+        return timeout;
+    }
+    return min_timeout(timeout, (int)std::min(next - now, (uint64_t)INT32_MAX));
+}
+
+static bool str2int(std::string_view s, int64_t &out) {
+    auto rv = std::from_chars(s.data(), s.data() + s.size(), out);
+    return rv.ec == std::errc() && rv.ptr == s.data() + s.size();
+}
+
+static bool str2dbl(std::string_view s, double &out) {
+    auto rv = std::from_chars(s.data(), s.data() + s.size(), out);
+    return rv.ec == std::errc() && rv.ptr == s.data() + s.size() && !std::isnan(out);
+}
+
+static uint32_t out_err(Output &out, const char *msg) {
+    out.buf.append(msg, strlen(msg));
+    return RES_ERR;
+}
+
+static void out_int(Output &out, int64_t val) {
+    char buf[24];
+    auto rv = std::to_chars(buf, buf + sizeof(buf), val);
+    out.buf.append(buf, (size_t)(rv.ptr - buf));
+}
+
+static void out_dbl(Output &out, double val) {
+    char buf[32];
+    auto rv = std::to_chars(buf, buf + sizeof(buf), val);
+    out.buf.append(buf, (size_t)(rv.ptr - buf));
+}
+
+// arrays use the request encoding: a count, then length-prefixed strings.
+// out_arr() reserves the count, out_arr_end() fills it in.
+static size_t out_arr(Output &out) {
+    size_t at = out.buf.size;
+    out.buf.append("\0\0\0\0", 4);
+    return at;
+}
+
+static void out_arr_end(Output &out, size_t at, uint32_t n) {
+    memcpy(&out.buf.data[at], &n, 4);
+}
+
+static void out_str(Output &out, std::string_view s) {
+    uint32_t len = (uint32_t)s.size();
+    out.buf.append(&len, 4);
+    out.buf.append(s.data(), s.size());
+}
+
+static void out_dbl_str(Output &out, double val) {
+    // length first, the digits are written in place after it
+    size_t at = out.buf.size;
+    out.buf.append("\0\0\0\0", 4);
+    out_dbl(out, val);
+    uint32_t len = (uint32_t)(out.buf.size - at - 4);
+    memcpy(&out.buf.data[at], &len, 4);
+}
+
+static void out_int_str(Output &out, int64_t val) {
+    size_t at = out.buf.size;
+    out.buf.append("\0\0\0\0", 4);
+    out_int(out, val);
+    uint32_t len = (uint32_t)(out.buf.size - at - 4);
+    memcpy(&out.buf.data[at], &len, 4);
+}
+
+// GET's lookup, with no lock. A miss while a resize moves nodes can't be
+// trusted; after a few of those the lookup is done under the lock. The
+// caller holds an EpochGuard for as long as it uses the entry.
+static Entry *entry_lookup_shared(Shard &sh, std::string_view key, uint64_t hcode) {
+    auto eq = [&](HNode *node) {
+        return static_cast<Entry *>(node)->key() == key;
+    };
+    HNode *node = NULL;
+    for (int i = 0; i < k_lookup_retries; i++) {
+        if (sh.map.lookupShared(hcode, eq, node)) {
+            return static_cast<Entry *>(node);
+        }
+    }
+    std::shared_lock<std::shared_mutex> guard(sh.mutex);
+    return entry_lookup(sh, key, hcode);
+}
+
+// no lock: a SET on the key replaces the entry rather than change it, and
+// the one read here stays allocated until the guard is gone
+uint32_t Server::do_get(const std::vector<std::string_view> &cmd, Output &out) {
+    uint64_t hcode = key_hash(cmd[1]);
+    Shard &sh = shard_of(hcode);
+    EpochGuard pin;
+    Entry *ent = entry_lookup_shared(sh, cmd[1], hcode);
+    if (!ent || entry_expired(ent, get_monotonic_msec())) {
+        // an expired key is gone already, the next writer or the cron frees it
+        return RES_NX;
+    }
+    if (ent->type != T_STR) {
+        return out_err(out, "Expect string type");
+    }
+    if (ent->ptr) {
+        // no copy: the connection keeps a reference until it is sent
+        out.appendRef(ent->big());
+    } else {
+        out.buf.append(ent->vdata(), ent->vlen);
+    }
+    return RES_OK;
+}
+
+// SET key val [PX ms]
+uint32_t Server::do_set(const std::vector<std::string_view> &cmd, Output &out) {
+    int64_t ttl_ms = -1;
+    if (cmd.size() == 5 && (!cmd_is(cmd[3], "px") || !str2int(cmd[4], ttl_ms) || ttl_ms <= 0)) {
+        return out_err(out, "Bad expire time");
+    }
+    uint64_t hcode = key_hash(cmd[1]);
+    Shard &sh = shard_of(hcode);
+    std::unique_lock<std::shared_mutex> guard(sh.mutex);
+    Entry *old = entry_lookup_live(sh, cmd[1], hcode);
+    Entry *ent = entry_new_str(sh, cmd[1], hcode, cmd[2]);
+    if (old) {
+        // a plain SET drops the old timer along with the old entry
+        entry_replace(sh, old, ent);
+    } else {
+        sh.map.insert(ent);
+    }
+    entry_set_ttl(sh, ent, ttl_ms);
+    sh.rehashing = sh.map.rehashing();
+    aof_log({"set", cmd[1], cmd[2]});
+    if (ttl_ms > 0) {
+        char buf[24];
+        aof_log({"pexpireat", cmd[1], aof_unix_ms(buf, ttl_ms)});
+    }
+    return RES_OK;
+}
+
+// DEL key frees small values in place, UNLINK key leaves any separately
+// allocated value to the lazy free thread
+uint32_t Server::do_del(const std::vector<std::string_view> &cmd, Output &out) {
+    (void)out;
+    uint64_t hcode = key_hash(cmd[1]);
+    Shard &sh = shard_of(hcode);
+    std::unique_lock<std::shared_mutex> guard(sh.mutex);
+    Entry *ent = entry_lookup(sh, cmd[1], hcode);
+    if (ent) {
+        entry_remove(sh, ent, cmd_is(cmd[0], "unlink"));
+        aof_log({"del", cmd[1]});
+    }
+    sh.rehashing = sh.map.rehashing();
+    return RES_OK;
+}
+
+// EXPIRE key seconds, PEXPIRE key ms, PEXPIREAT key unix-ms; a time not in
+// the future deletes the key
+uint32_t Server::do_expire(const std::vector<std::string_view> &cmd, Output &out) {
+    int64_t ttl = 0;
+    if (!str2int(cmd[2], ttl) || ttl > INT64_MAX / 1000 || ttl < INT64_MIN / 1000) {
+        return out_err(out, "Bad expire time");
+    }
+    int64_t ttl_ms = ttl;
+    if (cmd_is(cmd[0], "expire")) {
+        ttl_ms = ttl * 1000;
+    } else if (cmd_is(cmd[0], "pexpireat")) {
+        ttl_ms = ttl - (int64_t)get_unix_msec();
+    }
+    uint64_t hcode = key_hash(cmd[1]);
+    Shard &sh = shard_of(hcode);
+    std::unique_lock<std::shared_mutex> guard(sh.mutex);
+    Entry *ent = entry_lookup_live(sh, cmd[1], hcode);
+    if (!ent) {
+        return RES_NX;
+    }
+    if (ttl_ms <= 0) {
+        entry_remove(sh, ent);
+        aof_log({"del", cmd[1]});
+    } else {
+        entry_set_ttl(sh, ent, ttl_ms);
+        char buf[24];
+        aof_log({"pexpireat", cmd[1], aof_unix_ms(buf, ttl_ms)});
+    }
+    return RES_OK;
+}
+
+// TTL key in seconds, PTTL key in ms; -1 when the key does not expire
+uint32_t Server::do_ttl(const std::vector<std::string_view> &cmd, Output &out) {
+    uint64_t hcode = key_hash(cmd[1]);
+    Shard &sh = shard_of(hcode);
+    std::shared_lock<std::shared_mutex> guard(sh.mutex);
+    uint64_t now = get_monotonic_msec();
+    Entry *ent = entry_lookup(sh, cmd[1], hcode);
+    if (!ent || entry_expired(ent, now)) {
+        return RES_NX;
+    }
+    int64_t ttl_ms = -1;
+    if (ent->heap_idx != (size_t)-1) {
+        ttl_ms = (int64_t)(sh.heap[ent->heap_idx].val - now);
+    }
+    if (ttl_ms > 0 && cmd_is(cmd[0], "ttl")) {
+        // round up, a live key never reports 0
+        ttl_ms = (ttl_ms + 999) / 1000;
+    }
+    out_int(out, ttl_ms);
+    return RES_OK;
+}
+
+uint32_t Server::do_persist(const std::vector<std::string_view> &cmd, Output &out) {
+    (void)out;
+    uint64_t hcode = key_hash(cmd[1]);
+    Shard &sh = shard_of(hcode);
+    std::unique_lock<std::shared_mutex> guard(sh.mutex);
+    Entry *ent = entry_lookup_live(sh, cmd[1], hcode);
+    if (!ent) {
+        return RES_NX;
+    }
+    entry_set_ttl(sh, ent, -1);
+    aof_log({"persist", cmd[1]});
+    return RES_OK;
+}
+
+// the sorted set at key for a reader: NULL with RES_NX if there is none,
+// NULL with an error in out if key holds another type
+static ZSet *zset_lookup(Shard &sh, std::string_view key, uint64_t hcode, Output &out,
+                         uint32_t &rescode) {
+    Entry *ent = entry_lookup(sh, key, hcode);
+    if (!ent || entry_expired(ent, get_monotonic_msec())) {
+        rescode = RES_NX;
+        return NULL;
+    }
+    if (ent->type != T_ZSET) {
+        rescode = out_err(out, "Expect zset type");
+        return NULL;
+    }
+    return ent->zset();
+}
+
+// ZADD key score name, replies 1 if name was added, 0 if updated
+uint32_t Server::do_zadd(const std::vector<std::string_view> &cmd, Output &out) {
+    double score = 0;
+    if (!str2dbl(cmd[2], score)) {
+        return out_err(out, "Expect float score");
+    }
+    uint64_t hcode = key_hash(cmd[1]);
+    Shard &sh = shard_of(hcode);
+    std::unique_lock<std::shared_mutex> guard(sh.mutex);
+    Entry *ent = entry_lookup_live(sh, cmd[1], hcode);
+    if (!ent) {
+        ent = entry_new(sh, cmd[1], hcode, 0);
+        ent->type = T_ZSET;
+        ent->ptr = new ZSet();
+        sh.map.insert(ent);
+        sh.rehashing = sh.map.rehashing();
+    } else if (ent->type != T_ZSET) {
+        return out_err(out, "Expect zset type");
+    }
+    out_int(out, ent->zset()->insert(cmd[3], score));
+    aof_log({"zadd", cmd[1], cmd[2], cmd[3]});
+    return RES_OK;
+}
+
+// ZREM key name, replies 1 if name was removed; an empty set is deleted
+uint32_t Server::do_zrem(const std::vector<std::string_view> &cmd, Output &out) {
+    uint64_t hcode = key_hash(cmd[1]);
+    Shard &sh = shard_of(hcode);
+    std::unique_lock<std::shared_mutex> guard(sh.mutex);
+    Entry *ent = entry_lookup_live(sh, cmd[1], hcode);
+    if (!ent) {
+        return RES_NX;
+    }
+    if (ent->type != T_ZSET) {
+        return out_err(out, "Expect zset type");
+    }
+    bool removed = ent->zset()->remove(cmd[2]);
+    out_int(out, removed);
+    if (!ent->zset()->size()) {
+        entry_remove(sh, ent);
+    }
+    if (removed) {
+        aof_log({"zrem", cmd[1], cmd[2]});
+    }
+    return RES_OK;
+}
+
+// ZSCORE key name
+uint32_t Server::do_zscore(const std::vector<std::string_view> &cmd, Output &out) {
+    uint64_t hcode = key_hash(cmd[1]);
+    Shard &sh = shard_of(hcode);
+    std::shared_lock<std::shared_mutex> guard(sh.mutex);
+    uint32_t rescode = RES_OK;
+    ZSet *zset = zset_lookup(sh, cmd[1], hcode, out, rescode);
+    if (!zset) {
+        return rescode;
+    }
+    ZNode *node = zset->lookup(cmd[2]);
+    if (!node) {
+        return RES_NX;
+    }
+    out_dbl(out, node->score);
+    return RES_OK;
+}
+
+// name, score pairs from node on, at most limit of them or up to max score
+static void zset_output(Output &out, ZNode *node, int64_t limit, double max) {
+    size_t at = out_arr(out);
+    int64_t pairs = 0;
+    while (node && pairs < limit && node->score <= max) {
+        out_str(out, node->name);
+        out_dbl_str(out, node->score);
+        pairs++;
+        node = ZSet::offset(node, +1);
+    }
+    out_arr_end(out, at, (uint32_t)(pairs * 2));
+}
+
+// ZRANGEBYSCORE key min max, every member with min <= score <= max
+uint32_t Server::do_zrangebyscore(const std::vector<std::string_view> &cmd, Output &out) {
+    double min = 0;
+    double max = 0;
+    if (!str2dbl(cmd[2], min) || !str2dbl(cmd[3], max)) {
+        return out_err(out, "Expect float score");
+    }
+    uint64_t hcode = key_hash(cmd[1]);
+    Shard &sh = shard_of(hcode);
+    std::shared_lock<std::shared_mutex> guard(sh.mutex);
+    uint32_t rescode = RES_OK;
+    ZSet *zset = zset_lookup(sh, cmd[1], hcode, out, rescode);
+    if (!zset) {
+        // a missing key is an empty set
+        if (rescode == RES_NX) {
+            out_arr_end(out, out_arr(out), 0);
+            rescode = RES_OK;
+        }
+        return rescode;
+    }
+    zset_output(out, zset->seekge(min, ""), INT64_MAX, max);
+    return RES_OK;
+}
+
+// ZQUERY key score name offset limit: seek to the first member >=
+// (score, name), move offset members from there, return up to limit
+uint32_t Server::do_zquery(const std::vector<std::string_view> &cmd, Output &out) {
+    double score = 0;
+    int64_t offset = 0;
+    int64_t limit = 0;
+    if (!str2dbl(cmd[2], score)) {
+        return out_err(out, "Expect float score");
+    }
+    if (!str2int(cmd[4], offset) || !str2int(cmd[5], limit)) {
+        return out_err(out, "Expect int");
+    }
+    uint64_t hcode = key_hash(cmd[1]);
+    Shard &sh = shard_of(hcode);
+    std::shared_lock<std::shared_mutex> guard(sh.mutex);
+    uint32_t rescode = RES_OK;
+    ZSet *zset = zset_lookup(sh, cmd[1], hcode, out, rescode);
+    if (!zset) {
+        if (rescode == RES_NX) {
+            out_arr_end(out, out_arr(out), 0);
+            rescode = RES_OK;
+        }
+        return rescode;
+    }
+    ZNode *node = ZSet::offset(zset->seekge(score, cmd[3]), offset);
+    zset_output(out, node, std::max(limit, (int64_t)0), INFINITY);
+    return RES_OK;
+}
+
+bool Server::cmd_is(std::string_view word, const char *cmd) {
+    size_t len = strlen(cmd);
+    return word.size() == len && 0 == strncasecmp(word.data(), cmd, len);
+}
+
+std::string Server::snapshotPath = "dump.snap";
+
+void Server::setSnapshotPath(const char *path) {
+    snapshotPath = path;
+}
+
+// every live key to path, through a temporary file renamed over it once
+// complete. The caller keeps writers out of the keyspace.
+static bool snapshot_save(const std::string &path, uint64_t &nkeys) {
+    std::string tmp = path + ".tmp-" + std::to_string(getpid());
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    SnapshotWriter w(fd);
+    uint64_t now = get_monotonic_msec();
+    uint64_t unix_now = get_unix_msec();
+    nkeys = 0;
+    for (size_t i = 0; i < g_nshards; i++) {
+        Shard &sh = g_shards[i];
+        sh.map.forEach([&](HNode *node) {
+            Entry *ent = static_cast<Entry *>(node);
+            if (entry_expired(ent, now)) {
+                return;
+            }
+            bool timed = ent->heap_idx != (size_t)-1;
+            w.putU8(ent->type);
+            w.putU8(timed ? k_snap_expire : 0);
+            if (timed) {
+                w.putU64(unix_now + (sh.heap[ent->heap_idx].val - now));
+            }
+            w.putStr(ent->key());
+            if (ent->type == T_ZSET) {
+                w.putU32((uint32_t)ent->zset()->size());
+                ent->zset()->forEach([&](const ZNode *znode) {
+                    w.putF64(znode->score);
+                    w.putStr(znode->name);
+                });
+            } else if (ent->ptr) {
+                w.putStr(*ent->big());
+            } else {
+                w.putStr(std::string_view(ent->vdata(), ent->vlen));
+            }
+            nkeys++;
+        });
+    }
+    bool ok = w.finish(nkeys);
+    ok = close(fd) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str())) {
+        unlink(tmp.c_str());
+        return false;
+    }
+    return fsync_dir_of(path.c_str());
+}
+
+// SAVE writes the snapshot before replying with the key count. BGSAVE
+// forks, the child writes the copy-on-write image of the keyspace and
+// keyspaceCron() reaps it.
+uint32_t Server::do_save(const std::vector<std::string_view> &cmd, Output &out) {
+    uint64_t nkeys = 0;
+    if (cmd_is(cmd[0], "save")) {
+        std::lock_guard<std::mutex> saving(g_save_mutex);
+        AllShardsLock<std::shared_lock<std::shared_mutex>> guard;
+        if (!snapshot_save(snapshotPath, nkeys)) {
+            return out_err(out, "Snapshot write failed");
+        }
+        out_int(out, (int64_t)nkeys);
+        return RES_OK;
+    }
+    // exclusive, so no other thread is halfway through a change
+    AllShardsLock<std::unique_lock<std::shared_mutex>> guard;
+    if (g_bgsave_pid) {
+        return out_err(out, "Background save already in progress");
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        return out_err(out, "fork() failed");
+    }
+    if (pid == 0) {
+        // only this thread is left in the child: no locks, just a read
+        // of the map and plain writes
+        uint64_t t0 = get_monotonic_usec();
+        bool ok = snapshot_save(snapshotPath, nkeys);
+        if (ok) {
+            char buf[128];
+            snprintf(buf, sizeof(buf), "background save of %llu keys took %.3f s",
+                     (unsigned long long)nkeys, (double)(get_monotonic_usec() - t0) / 1e6);
+            msg(buf);
+        }
+        _exit(ok ? 0 : 1);
+    }
+    g_bgsave_pid = pid;
+    return RES_OK;
+}
+
+bool Server::loadSnapshot() {
+    uint64_t t0 = get_monotonic_usec();
+    SnapshotFile file;
+    int rv = file.open(snapshotPath.c_str());
+    if (rv == 0) {
+        return true;
+    }
+    char buf[512];
+    if (rv < 0) {
+        snprintf(buf, sizeof(buf), "snapshot %s: %s", snapshotPath.c_str(), file.err);
+        msg(buf);
+        return false;
+    }
+
+    AllShardsLock<std::unique_lock<std::shared_mutex>> guard;
+    // every key goes straight in, the tables never resize; keys spread
+    // evenly, give or take a few percent
+    size_t per_shard = (size_t)file.nkeys / g_nshards;
+    for (size_t i = 0; i < g_nshards; i++) {
+        g_shards[i].map.reserve(per_shard + per_shard / 8 + 64);
+    }
+    SnapshotReader &r = file.records;
+    uint64_t now = get_unix_msec();
+    uint64_t loaded = 0;
+    uint64_t expired = 0;
+    for (uint64_t i = 0; i < file.nkeys && r.ok; i++) {
+        uint8_t type = r.get<uint8_t>();
+        uint8_t flags = r.get<uint8_t>();
+        uint64_t expire_at = (flags & k_snap_expire) ? r.get<uint64_t>() : 0;
+        std::string_view key = r.getStr();
+        bool live = !expire_at || expire_at > now;
+        uint64_t hcode = key_hash(key);
+        Shard &sh = shard_of(hcode);
+        Entry *ent = NULL;
+        if (type == T_STR) {
+            std::string_view val = r.getStr();
+            if (r.ok && live) {
+                ent = entry_new_str(sh, key, hcode, val);
+                sh.map.insert(ent);
+            }
+        } else if (type == T_ZSET) {
+            uint32_t n = r.get<uint32_t>();
+            ZSet *zset = live ? new ZSet() : NULL;
+            for (uint32_t j = 0; j < n && r.ok; j++) {
+                double score = r.get<double>();
+                std::string_view name = r.getStr();
+                if (zset && r.ok) {
+                    zset->insert(name, score);
+                }
+            }
+            if (zset) {
+                ent = entry_new(sh, key, hcode, 0);
+                ent->type = T_ZSET;
+                ent->ptr = zset;
+                sh.map.insert(ent);
+            }
+        } else {
+            r.ok = false;
+        }
+        if (ent && expire_at) {
+            entry_set_ttl(sh, ent, (int64_t)(expire_at - now));
+        }
+        loaded += ent != NULL;
+        expired += r.ok && !live;
+    }
+    for (size_t i = 0; i < g_nshards; i++) {
+        g_shards[i].rehashing = g_shards[i].map.rehashing();
+    }
+    if (!r.ok || r.pos != r.end) {
+        snprintf(buf, sizeof(buf), "snapshot %s: bad record", snapshotPath.c_str());
+        msg(buf);
+        return false;
+    }
+    double secs = (double)(get_monotonic_usec() - t0) / 1e6;
+    snprintf(buf, sizeof(buf), "loaded %llu keys (%llu expired) from %s in %.3f s, %.0f keys/s",
+             (unsigned long long)loaded, (unsigned long long)expired, snapshotPath.c_str(), secs,
+             (double)loaded / std::max(secs, 1e-6));
+    msg(buf);
+    return true;
+}
+
+// BGREWRITEAOF compacts the log in a forked child like BGSAVE. Changes
+// made meanwhile still go to the old log, and to a buffer that
+// keyspaceCron() appends to the new one before renaming it over the old.
+uint32_t Server::do_bgrewriteaof(const std::vector<std::string_view> &cmd, Output &out) {
+    (void)cmd;
+    if (!g_aof.enabled()) {
+        return out_err(out, "Append-only log is off");
+    }
+    AllShardsLock<std::unique_lock<std::shared_mutex>> guard;
+    const char *err = aof_start_rewrite();
+    return err ? out_err(out, err) : RES_OK;
+}
+
+// Whether the avail bytes at the end of the log, after a length prefix of
+// len, are a record cut short by a crash: a length a request can have, and
+// a request that runs past the end of the file as well. A flipped bit in
+// the prefix of an earlier record also points past the end, but a whole
+// request follows it there; cutting the log at it would throw away every
+// record after it.
+static bool aof_torn_record(const uint8_t *body, size_t avail, uint32_t len, size_t maxLen) {
+    if (len < 4 || len > maxLen) {
+        return false;
+    }
+    if (avail < 4) {
+        return true;
+    }
+    uint32_t n = 0;
+    memcpy(&n, body, 4);
+    if (n > k_max_args) {
+        return false;
+    }
+    size_t pos = 4;
+    while (n--) {
+        if (pos + 4 > len) {
+            return false;
+        }
+        if (pos + 4 > avail) {
+            return true;
+        }
+        uint32_t sz = 0;
+        memcpy(&sz, &body[pos], 4);
+        if (pos + 4 + sz > len) {
+            return false;
+        }
+        pos += 4 + sz;
+        if (pos > avail) {
+            return true;
+        }
+    }
+    // the request ends inside the file, the prefix is wrong
+    return false;
+}
+
+bool Server::openAppendLog(const char *path, AppendLog::Fsync fsync) {
+    uint64_t t0 = get_monotonic_usec();
+    uint64_t ncmds = 0;
+    char buf[512];
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0 && errno != ENOENT) {
+        snprintf(buf, sizeof(buf), "append log %s: %s", path, strerror(errno));
+        msg(buf);
+        return false;
+    }
+    if (fd >= 0) {
+        struct stat st;
+        size_t size = fstat(fd, &st) ? 0 : (size_t)st.st_size;
+        size_t good = 0;
+        bool bad = false;
+        if (size) {
+            void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map == MAP_FAILED) {
+                snprintf(buf, sizeof(buf), "append log %s: mmap() failed", path);
+                msg(buf);
+                close(fd);
+                return false;
+            }
+            (void)madvise(map, size, MADV_SEQUENTIAL);
+            const uint8_t *data = (const uint8_t *)map;
+            // every record through the command path, responses dropped;
+            // not client traffic, so not in INFO or the slow log. Only
+            // changes that succeeded were logged, so an error reply means
+            // the record is damaged.
+            Output out;
+            while (size - good >= 4) {
+                uint32_t len = 0;
+                memcpy(&len, data + good, 4);
+                if (size - good - 4 < len) {
+                    bad = !aof_torn_record(data + good + 4, size - good - 4, len, maxMsg);
+                    break;
+                }
+                size_t start = out.buf.size;
+                if (exec_request(data + good + 4, len, out, false)) {
+                    bad = true;
+                    break;
+                }
+                uint32_t rescode = 0;
+                memcpy(&rescode, &out.buf.data[start + 4], 4);
+                if (rescode == RES_ERR) {
+                    bad = true;
+                    break;
+                }
+                out.consume(out.pending());
+                good += 4 + len;
+                ncmds++;
+            }
+            munmap(map, size);
+        }
+        if (bad) {
+            snprintf(buf, sizeof(buf), "append log %s: bad record at offset %zu", path, good);
+            msg(buf);
+            close(fd);
+            return false;
+        }
+        if (good < size) {
+            // a write cut short by a crash, the records before it stand
+            snprintf(buf, sizeof(buf), "append log %s: dropped %zu bytes of a torn record", path,
+                     size - good);
+            msg(buf);
+            if (ftruncate(fd, (off_t)good)) {
+                snprintf(buf, sizeof(buf), "append log %s: ftruncate() failed", path);
+                msg(buf);
+                close(fd);
+                return false;
+            }
+        }
+        close(fd);
+    }
+    if (!g_aof.open(path, fsync)) {
+        snprintf(buf, sizeof(buf), "append log %s: %s", path, strerror(errno));
+        msg(buf);
+        return false;
+    }
+    AllShardsLock<std::shared_lock<std::shared_mutex>> guard;
+    double secs = (double)(get_monotonic_usec() - t0) / 1e6;
+    snprintf(buf, sizeof(buf), "replayed %llu commands (%zu keys) from %s in %.3f s, %.0f commands/s",
+             (unsigned long long)ncmds, keyspace_size(), path, secs, (double)ncmds / std::max(secs, 1e-6));
+    msg(buf);
+    return true;
+}
+
+int32_t Server::write_all(int fd, const char *buf, size_t n) {
+    while (n > 0) {
+        ssize_t rv = write(fd, buf, n);
+        if (rv < 0 && errno == EINTR) {
+            continue;
+        }
+        if (rv <= 0) {
+            return -1;
+        }
+        n -= (size_t)rv;
+        buf += rv;
+    }
+    return 0;
+}
+
+// the commands, matched on the name and the argument count (argc, or
+// argc2 when that is not 0). Stats are kept per line, in this order.
+struct Command {
+    const char *name;
+    size_t argc;
+    size_t argc2;
+    uint32_t (*handler)(const std::vector<std::string_view> &cmd, Output &out);
+};
+
+static const Command k_commands[] = {
+    {"get", 2, 0, Server::do_get},
+    {"set", 3, 5, Server::do_set},
+    {"del", 2, 0, Server::do_del},
+    {"unlink", 2, 0, Server::do_del},
+    {"expire", 3, 0, Server::do_expire},
+    {"pexpire", 3, 0, Server::do_expire},
+    {"pexpireat", 3, 0, Server::do_expire},
+    {"ttl", 2, 0, Server::do_ttl},
+    {"pttl", 2, 0, Server::do_ttl},
+    {"persist", 2, 0, Server::do_persist},
+    {"zadd", 4, 0, Server::do_zadd},
+    {"zrem", 3, 0, Server::do_zrem},
+    {"zscore", 3, 0, Server::do_zscore},
+    {"zrangebyscore", 4, 0, Server::do_zrangebyscore},
+    {"zquery", 6, 0, Server::do_zquery},
+    {"save", 1, 0, Server::do_save},
+    {"bgsave", 1, 0, Server::do_save},
+    {"bgrewriteaof", 1, 0, Server::do_bgrewriteaof},
+    {"info", 1, 2, Server::do_info},
+    {"slowlog", 2, 3, Server::do_slowlog},
+};
+
+const size_t k_ncommands = sizeof(k_commands) / sizeof(k_commands[0]);
+// the stats slot of requests that match no command
+static_assert(k_ncommands < k_max_commands, "Stats has no room for the commands");
+
+static size_t command_of(const std::vector<std::string_view> &cmd) {
+    for (size_t i = 0; i < k_ncommands; i++) {
+        const Command &c = k_commands[i];
+        if ((cmd.size() == c.argc || (c.argc2 && cmd.size() == c.argc2)) && Server::cmd_is(cmd[0], c.name)) {
+            return i;
+        }
+    }
+    return k_ncommands;
+}
+
+static void info_line(std::string &text, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void info_line(std::string &text, const char *fmt, ...) {
+    char buf[256];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    text.append(buf, (size_t)std::min(std::max(n, 0), (int)sizeof(buf) - 1));
+    text.push_back('\n');
+}
+
+// upper bound in us of the latency bucket holding percentile p of c
+static double info_percentile(const CmdStats &c, double p) {
+    uint64_t calls = c.calls.load(std::memory_order_relaxed);
+    uint64_t want = (uint64_t)std::ceil((double)calls * p / 100.0);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < k_lat_buckets; i++) {
+        seen += c.lat[i].load(std::memory_order_relaxed);
+        if (seen >= want) {
+            return (double)((uint64_t)1 << i) / 1000.0;
+        }
+    }
+    return (double)((uint64_t)1 << (k_lat_buckets - 1)) / 1000.0;
+}
+
+// INFO [section]: "name:value" lines under "# Section" headers, every
+// section when none is named. The counters are summed over the threads'
+// Stats blocks; the keyspace figures take each shard's lock in turn.
+uint32_t Server::do_info(const std::vector<std::string_view> &cmd, Output &out) {
+    std::string_view want = cmd.size() > 1 ? cmd[1] : "all";
+    auto section = [&](const char *name) {
+        return cmd_is(want, "all") || cmd_is(want, name);
+    };
+    static const char *const k_sections[] = {"server", "clients", "stats", "keyspace", "memory",
+                                             "commandstats", "latency"};
+    if (!section("all") && std::none_of(std::begin(k_sections), std::end(k_sections), section)) {
+        return out_err(out, "Unknown INFO section");
+    }
+
+    Stats sum;
+    Stats::forEach([&](const Stats &s) {
+        for (size_t i = 0; i <= k_ncommands; i++) {
+            const CmdStats &c = s.cmds[i];
+            CmdStats &to = sum.cmds[i];
+            Stats::bump(to.calls, c.calls.load(std::memory_order_relaxed));
+            Stats::bump(to.errors, c.errors.load(std::memory_order_relaxed));
+            Stats::bump(to.nsec, c.nsec.load(std::memory_order_relaxed));
+            for (size_t b = 0; b < k_lat_buckets; b++) {
+                Stats::bump(to.lat[b], c.lat[b].load(std::memory_order_relaxed));
+            }
+        }
+        Stats::bump(sum.connsOpened, s.connsOpened.load(std::memory_order_relaxed));
+        Stats::bump(sum.connsClosed, s.connsClosed.load(std::memory_order_relaxed));
+        Stats::bump(sum.bytesIn, s.bytesIn.load(std::memory_order_relaxed));
+        Stats::bump(sum.bytesOut, s.bytesOut.load(std::memory_order_relaxed));
+    });
+    auto name_of = [](size_t i) {
+        return i < k_ncommands ? k_commands[i].name : "unknown";
+    };
+    typedef unsigned long long ull;
+
+    std::string text;
+    if (section("server")) {
+        info_line(text, "# Server");
+        info_line(text, "uptime_ms:%llu", (ull)(get_monotonic_msec() - g_start_msec));
+        info_line(text, "shards:%zu", g_nshards);
+        info_line(text, "appendonly:%d", (int)g_aof.enabled());
+    }
+    if (section("clients")) {
+        uint64_t opened = sum.connsOpened.load();
+        uint64_t closed = sum.connsClosed.load();
+        info_line(text, "# Clients");
+        info_line(text, "connected_clients:%llu", (ull)(opened - std::min(closed, opened)));
+        info_line(text, "total_connections:%llu", (ull)opened);
+    }
+    if (section("stats")) {
+        uint64_t calls = 0;
+        uint64_t errors = 0;
+        for (size_t i = 0; i <= k_ncommands; i++) {
+            calls += sum.cmds[i].calls.load();
+            errors += sum.cmds[i].errors.load();
+        }
+        info_line(text, "# Stats");
+        info_line(text, "total_commands:%llu", (ull)calls);
+        info_line(text, "total_errors:%llu", (ull)errors);
+        info_line(text, "bytes_in:%llu", (ull)sum.bytesIn.load());
+        info_line(text, "bytes_out:%llu", (ull)sum.bytesOut.load());
+        info_line(text, "log_dropped:%llu", (ull)Log::dropped());
+    }
+    if (section("keyspace") || section("memory")) {
+        size_t keys = 0, expires = 0, used = 0, reserved = 0, big = 0, tables = 0, retired = 0;
+        for (size_t i = 0; i < g_nshards; i++) {
+            Shard &sh = g_shards[i];
+            std::shared_lock<std::shared_mutex> guard(sh.mutex);
+            keys += sh.map.size();
+            expires += sh.heap.size();
+            used += sh.slab.usedBytes();
+            reserved += sh.slab.reservedBytes();
+            big += sh.bigBytes;
+            tables += sh.map.buckets() * sizeof(HNode *) + sh.heap.capacity() * sizeof(HeapItem);
+            retired += sh.retired.size();
+        }
+        if (section("keyspace")) {
+            info_line(text, "# Keyspace");
+            info_line(text, "keys:%zu", keys);
+            info_line(text, "expires:%zu", expires);
+        }
+        if (section("memory")) {
+            // sorted sets are not counted
+            info_line(text, "# Memory");
+            info_line(text, "used_memory_estimate:%zu", reserved + big + tables);
+            info_line(text, "slab_used_bytes:%zu", used);
+            info_line(text, "slab_reserved_bytes:%zu", reserved);
+            info_line(text, "large_value_bytes:%zu", big);
+            info_line(text, "table_bytes:%zu", tables);
+            info_line(text, "retired_entries:%zu", retired);
+        }
+    }
+    if (section("commandstats")) {
+        info_line(text, "# Commandstats");
+        for (size_t i = 0; i <= k_ncommands; i++) {
+            const CmdStats &c = sum.cmds[i];
+            uint64_t calls = c.calls.load();
+            if (!calls) {
+                continue;
+            }
+            double usec = (double)c.nsec.load() / 1000.0;
+            info_line(text, "cmd_%s:calls=%llu,errors=%llu,usec=%.0f,usec_per_call=%.3f,"
+                      "p50_usec=%.3f,p99_usec=%.3f,p999_usec=%.3f",
+                      name_of(i), (ull)calls, (ull)c.errors.load(), usec, usec / (double)calls,
+                      info_percentile(c, 50), info_percentile(c, 99), info_percentile(c, 99.9));
+        }
+    }
+    if (section("latency")) {
+        // the non-empty buckets, by their upper bound in ns
+        info_line(text, "# Latency");
+        for (size_t i = 0; i <= k_ncommands; i++) {
+            const CmdStats &c = sum.cmds[i];
+            if (!c.calls.load()) {
+                continue;
+            }
+            std::string line = std::string("lat_") + name_of(i) + ":";
+            for (size_t b = 0; b < k_lat_buckets; b++) {
+                uint64_t n = c.lat[b].load();
+                if (n) {
+                    char buf[64];
+                    snprintf(buf, sizeof(buf), "%sle_%llu=%llu", line.back() == ':' ? "" : ",",
+                             (ull)1 << b, (ull)n);
+                    line += buf;
+                }
+            }
+            info_line(text, "%s", line.c_str());
+        }
+    }
+    out.buf.append(text.data(), text.size());
+    return RES_OK;
+}
+
+// SLOWLOG GET [n] | LEN | RESET. GET answers an array per entry: id, unix
+// time in ms, duration in us, the arguments as an array, the client.
+uint32_t Server::do_slowlog(const std::vector<std::string_view> &cmd, Output &out) {
+    if (cmd_is(cmd[1], "len") && cmd.size() == 2) {
+        out_int(out, (int64_t)g_slowlog.len());
+    } else if (cmd_is(cmd[1], "reset") && cmd.size() == 2) {
+        g_slowlog.reset();
+    } else if (cmd_is(cmd[1], "get")) {
+        int64_t n = 10;
+        if (cmd.size() == 3 && (!str2int(cmd[2], n) || n < 0)) {
+            return out_err(out, "Expect int");
+        }
+        std::vector<SlowLogEntry> ents = g_slowlog.get((size_t)n);
+        out_arr_end(out, out_arr(out), (uint32_t)ents.size());
+        for (const SlowLogEntry &ent : ents) {
+            out_arr_end(out, out_arr(out), 5);
+            out_int_str(out, (int64_t)ent.id);
+            out_int_str(out, (int64_t)ent.unixMs);
+            out_int_str(out, (int64_t)ent.durationUs);
+            out_arr_end(out, out_arr(out), (uint32_t)ent.args.size());
+            for (const std::string &arg : ent.args) {
+                out_str(out, arg);
+            }
+            out_str(out, ent.client);
+        }
+    } else {
+        return out_err(out, "Unknown SLOWLOG subcommand");
+    }
+    return RES_OK;
+}
+
+// "ip:port" of the peer, "unix" for a unix domain socket
+static std::string peer_name(int fd) {
+    struct sockaddr_storage addr = {};
+    socklen_t addrlen = sizeof(addr);
+    if (fd < 0 || getpeername(fd, (struct sockaddr *)&addr, &addrlen) < 0) {
+        return "";
+    }
+    char ip[INET6_ADDRSTRLEN] = "";
+    if (addr.ss_family == AF_INET) {
+        const struct sockaddr_in *in = (const struct sockaddr_in *)&addr;
+        inet_ntop(AF_INET, &in->sin_addr, ip, sizeof(ip));
+        return std::string(ip) + ":" + std::to_string(ntohs(in->sin_port));
+    }
+    if (addr.ss_family == AF_INET6) {
+        const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)&addr;
+        inet_ntop(AF_INET6, &in6->sin6_addr, ip, sizeof(ip));
+        return "[" + std::string(ip) + "]:" + std::to_string(ntohs(in6->sin6_port));
+    }
+    return addr.ss_family == AF_UNIX ? "unix" : "";
+}
+
+// the connection of the request in do_request(), -1 outside a reactor
+static thread_local int t_request_fd = -1;
+
+// "cmd arg arg ..." cut at a log record, copied without formatting
+static void log_command(const std::vector<std::string_view> &cmd) {
+    char line[Log::k_max_record];
+    size_t n = 0;
+    for (std::string_view arg : cmd) {
+        if (n && n < sizeof(line)) {
+            line[n++] = ' ';
+        }
+        size_t take = std::min(arg.size(), sizeof(line) - n);
+        memcpy(&line[n], arg.data(), take);
+        n += take;
+    }
+    Log::message(LOG_DEBUG, "request", std::string_view(line, n));
+}
+
+int32_t Server::do_request(const uint8_t *req, uint32_t reqlen, Output &out) {
+    return exec_request(req, reqlen, out, true);
+}
+
+int32_t Server::exec_request(const uint8_t *req, uint32_t reqlen, Output &out, bool client) {
+    // reused across requests, so parsing allocates nothing once warm
+    static thread_local std::vector<std::string_view> cmd;
+    cmd.clear();
+    if (0 != parseReq(req, reqlen, cmd)) {
+        msg("bad req");
+        return -1;
+    }
+    // the header is filled in once the payload size is known
+    size_t start = out.buf.size;
+    size_t refBytes = out.refBytes;
+    out.buf.reserve(4 + 4);
+    out.buf.size += 4 + 4;
+    if (client && Log::enabled(LOG_DEBUG)) {
+        log_command(cmd);
+    }
+
+    uint64_t t0 = client ? cycles_now() : 0;
+    size_t idx = command_of(cmd);
+    uint32_t rescode = 0;
+    if (idx < k_ncommands) {
+        rescode = k_commands[idx].handler(cmd, out);
+    } else {
+        // cmd is not recognized
+        rescode = out_err(out, "Unknown cmd");
+    }
+    if (client) {
+        uint64_t ns = cycles_to_ns(cycles_now() - t0);
+        Stats::local().command(idx, ns, rescode == RES_ERR);
+        if (ns >= slowlogNs) {
+            g_slowlog.add(cmd, ns / 1000, get_unix_msec(), peer_name(t_request_fd));
+        }
+    }
+    uint32_t wlen = (uint32_t)(out.buf.size - start - 4 + out.refBytes - refBytes);
+    memcpy(&out.buf.data[start], &wlen, 4);
+    memcpy(&out.buf.data[start + 4], &rescode, 4);
+    return 0;
+}
+
+void Server::compactRbuf(Conn *conn) {
+    // one memmove per read, not one per request
+    Buffer &rbuf = conn->rbuf;
+    size_t remain = rbuf.pending();
+    if (remain && rbuf.head) {
+        memmove(rbuf.data, &rbuf.data[rbuf.head], remain);
+    }
+    rbuf.head = 0;
+    rbuf.size = remain;
+    if (!remain && rbuf.cap > k_rbuf_keep) {
+        // a large request is done, don't keep its memory
+        rbuf.release();
+    }
+}
+
+void Server::rbufReserve(Conn *conn) {
+    // room for a batch of small requests, or all of a large one
+    Buffer &rbuf = conn->rbuf;
+    size_t need = k_rbuf_size;
+    if (rbuf.pending() >= 4) {
+        uint32_t len = 0;
+        memcpy(&len, &rbuf.data[rbuf.head], 4);
+        need = std::max(need, 4 + (size_t)len);
+    }
+    size_t used = rbuf.size - rbuf.head;
+    rbuf.reserve(need > used ? need - used : 1);
+}
+
+bool Server::handleOneRequest(Conn *conn) {
+    // try to parse a request from the buffer
+    size_t avail = conn->rbuf.pending();
+    if (avail < 4) {
+        // not enough data in the buffer. Will retry in the next iteration
+        return false;
+    }
+    const uint8_t *req = &conn->rbuf.data[conn->rbuf.head];
+    uint32_t len = 0;
+    memcpy(&len, req, 4);
+    if (len > maxMsg) {
+        msg("too long");
+        conn->state = STATE_DONE;
+        return false;
+    }
+    if (4 + len > avail) {
+        // not enough data in the buffer. Will retry in the next iteration
+        return false;
+    }
+    size_t queued = conn->wbuf.pending();
+#ifdef REDICPP_IO_URING
+    queued += conn->sending.pending();
+#endif
+    if (queued >= wbufHighWater) {
+        // too much output queued, leave the request until it drains
+        return false;
+    }
+
+    // got one request, append the response to the output queue.
+    t_request_fd = conn->fd;
+    int32_t err = do_request(&req[4], len, conn->wbuf);
+    if (err) {
+        conn->state = STATE_DONE;
+        return false;
+    }
+    if (g_aof.fsyncPolicy() == AppendLog::FSYNC_ALWAYS) {
+        // the response may show changes not on disk yet, from this
+        // connection or any other
+        conn->aof_seq = g_aof.appendedBytes();
+    }
+
+    // consume the request by moving the cursor, the bytes are
+    // reclaimed by compactRbuf() before the next read
+    conn->rbuf.consume(4 + len);
+    return true;
+}
+
+bool Server::tryOneRequest(Conn *conn) {
+    if (conn->wbuf.pending() >= wbufHighWater) {
+        // the output queue is full: write it out before parsing more
+        stateResponse(conn);
+        if (conn->state != STATE_REQ) {
+            return false;
+        }
+        if (conn->wbuf.pending() >= wbufHighWater) {
+            // the client is not reading, stop reading from it too
+            conn->state = STATE_RESP;
+            return false;
+        }
+    }
+    // responses are only queued here, stateRequest() writes them in one go
+    return handleOneRequest(conn);
+}
+
+bool Server::tryFillRbuf(Conn *conn) {
+    compactRbuf(conn);
+    rbufReserve(conn);
+    Buffer &rbuf = conn->rbuf;
+    ssize_t rv = 0;
+    do {
+        rv = read(conn->fd, &rbuf.data[rbuf.size], rbuf.cap - rbuf.size);
+    } while (rv < 0 && errno == EINTR);
+    if (rv < 0 && errno == EAGAIN) {
+        // got EAGAIN, stop.
+        return false;
+    }
+    if (rv < 0) {
+        msg("read() error");
+        conn->state = STATE_DONE;
+        return false;
+    }
+    if (rv == 0) {
+        if (rbuf.pending()) {
+            msg("unexpected EOF");
+        } else {
+            msg("EOF");
+        }
+        conn->state = STATE_DONE;
+        return false;
+    }
+
+    rbuf.size += (size_t)rv;
+    assert(rbuf.size <= rbuf.cap);
+    Stats::bump(Stats::local().bytesIn, (uint64_t)rv);
+
+    // Try to process requests one by one.
+    // Why is there a loop? Please read the explanation of "pipelining".
+    while (tryOneRequest(conn)) {}
+    return (conn->state == STATE_REQ);
+}
+
+void Server::stateRequest(Conn *conn) {
+    while (tryFillRbuf(conn)) {}
+    // one write for every response produced since the last flush
+    if (conn->state == STATE_REQ) {
+        stateResponse(conn);
+    }
+}
+
+bool Server::tryFlushWbuf(Conn *conn) {
+    Output &wbuf = conn->wbuf;
+    if (!wbuf.pending()) {
+        return false;
+    }
+    ssize_t rv = 0;
+    if (!wbuf.hasRefs()) {
+        // only small responses queued: a plain write
+        do {
+            rv = write(conn->fd, &wbuf.buf.data[wbuf.buf.head], wbuf.buf.pending());
+        } while (rv < 0 && errno == EINTR);
+    } else {
+        struct iovec iov[64];
+        int n = wbuf.iov(iov, 64);
+        do {
+            rv = writev(conn->fd, iov, n);
+        } while (rv < 0 && errno == EINTR);
+    }
+    if (rv < 0 && errno == EAGAIN) {
+        // got EAGAIN, stop.
+        return false;
+    }
+    if (rv < 0) {
+        msg("write() error");
+        conn->state = STATE_DONE;
+        return false;
+    }
+    conn->wbuf.consume((size_t)rv);
+    Stats::bump(Stats::local().bytesOut, (uint64_t)rv);
+    // still got some data in wbuf, could try to write again
+    return conn->wbuf.pending() > 0;
+}
+
+void Server::stateResponse(Conn *conn) {
+    if (aofHold(conn)) {
+        return;
+    }
+    while (tryFlushWbuf(conn)) {}
+}
+
+void Server::connectionIO(Conn *conn) {
+    assert(conn->state == STATE_REQ || conn->state == STATE_RESP);
+    // responses left over from the last turn go first
+    stateResponse(conn);
+    if (conn->state == STATE_RESP && conn->wbuf.pending() < wbufHighWater) {
+        // below the high-water mark again: resume reading, starting
+        // with the requests that were left buffered
+        conn->state = STATE_REQ;
+        while (tryOneRequest(conn)) {}
+    }
+    if (conn->state == STATE_REQ) {
+        // also right after a flush: edge-triggered, so drain the socket now
+        stateRequest(conn);
+    }
+}
+
+uint32_t Server::connInterest(const Conn *conn) {
+    if (conn->state == STATE_RESP) {
+        // reading is paused until the output queue drains
+        return LOOP_WRITE;
+    }
+    // readable always, writable while a flush hit EAGAIN
+    return LOOP_READ | (conn->wbuf.pending() ? LOOP_WRITE : 0);
+}
+
+#ifdef REDICPP_IO_URING
+
+// what a completion belongs to, kept in the low byte of user_data
+enum {
+    URING_ACCEPT = 1,
+    URING_RECV = 2,
+    URING_SEND = 3,
+    URING_WAKE = 4,
+    URING_CANCEL = 5,
+};
+
+static uint64_t uringTag(int fd, uint32_t op) {
+    return ((uint64_t)(uint32_t)fd << 8) | op;
+}
+
+void Server::uringNewConn(std::vector<Conn*> &fd2conn, Uring *ring, DList *idle, int connfd) {
+    fd_set_nodelay(connfd);
+    struct Conn *conn = connNew();
+    conn->fd = connfd;
+    conn->state = STATE_REQ;
+    connPut(fd2conn, conn);
+    connTouch(idle, conn, get_monotonic_msec());
+    if (!uringArmRecv(ring, conn)) {
+        fd2conn[connfd] = NULL;
+        close(connfd);
+        conn->detach();
+        connFree(conn);
+    }
+}
+
+bool Server::uringArmRecv(Uring *ring, Conn *conn) {
+    struct io_uring_sqe *sqe = ring->getSqe();
+    if (!sqe) {
+        return false;
+    }
+    // multishot: one submission keeps delivering data until it fails
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = Uring::k_buf_group;
+    sqe->user_data = uringTag(conn->fd, URING_RECV);
+    conn->recv_armed = true;
+    conn->uring_pending++;
+    return true;
+}
+
+void Server::uringFlush(Uring *ring, Conn *conn) {
+    if (conn->send_busy || aofHold(conn)) {
+        return;
+    }
+    if (!conn->sending.pending()) {
+        if (!conn->wbuf.pending()) {
+            return;
+        }
+        // hand over everything queued so far, wbuf keeps growing meanwhile
+        conn->sending.swap(conn->wbuf);
+    }
+    struct io_uring_sqe *sqe = ring->getSqe();
+    if (!sqe) {
+        conn->state = STATE_DONE;
+        return;
+    }
+    Output &out = conn->sending;
+    sqe->fd = conn->fd;
+    if (!out.hasRefs()) {
+        sqe->opcode = IORING_OP_SEND;
+        sqe->addr = (uint64_t)(uintptr_t)&out.buf.data[out.buf.head];
+        sqe->len = (uint32_t)out.buf.pending();
+    } else {
+        // large values go out from the keyspace, the iovecs live in conn
+        // until the completion
+        if (!conn->send_msg) {
+            conn->send_msg.reset(new UringSendMsg());
+        }
+        UringSendMsg *sm = conn->send_msg.get();
+        int n = out.iov(sm->iov, sizeof(sm->iov) / sizeof(sm->iov[0]));
+        memset(&sm->msg, 0, sizeof(sm->msg));
+        sm->msg.msg_iov = sm->iov;
+        sm->msg.msg_iovlen = (size_t)n;
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->addr = (uint64_t)(uintptr_t)&sm->msg;
+        sqe->len = 1;
+    }
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = uringTag(conn->fd, URING_SEND);
+    conn->send_busy = true;
+    conn->uring_pending++;
+}
+
+void Server::uringPump(Conn *conn) {
+    while (handleOneRequest(conn)) {}
+}
+
+bool Server::uringStalled(const Conn *conn) {
+    // the client does not read its responses and keeps sending
+    size_t out = conn->wbuf.pending() + conn->sending.pending();
+    return out >= wbufHighWater && conn->rbuf.pending() > k_uring_rbuf_max;
+}
+
+void Server::uringOnRecv(Uring *ring, Conn *conn, int res, uint32_t flags) {
+    if (!(flags & IORING_CQE_F_MORE)) {
+        conn->recv_armed = false;
+        conn->uring_pending--;
+    }
+    if (flags & IORING_CQE_F_BUFFER) {
+        uint16_t bid = (uint16_t)(flags >> IORING_CQE_BUFFER_SHIFT);
+        if (res > 0 && conn->state != STATE_DONE) {
+            compactRbuf(conn);
+            conn->rbuf.append(ring->bufAt(bid), (size_t)res);
+            Stats::bump(Stats::local().bytesIn, (uint64_t)res);
+        }
+        ring->recycleBuf(bid);
+    }
+    if (conn->state == STATE_DONE) {
+        return;
+    }
+    if (res == 0) {
+        msg(conn->rbuf.pending() ? "unexpected EOF" : "EOF");
+        conn->state = STATE_DONE;
+        return;
+    }
+    if (res < 0 && res != -ENOBUFS && res != -ECANCELED) {
+        msg("recv() error");
+        conn->state = STATE_DONE;
+        return;
+    }
+
+    uringPump(conn);
+    uringFlush(ring, conn);
+    if (uringStalled(conn)) {
+        // stop receiving until the responses drain
+        if (conn->recv_armed) {
+            struct io_uring_sqe *sqe = ring->getSqe();
+            if (sqe) {
+                sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                sqe->addr = uringTag(conn->fd, URING_RECV);
+                sqe->user_data = uringTag(conn->fd, URING_CANCEL);
+            }
+        }
+    } else if (!conn->recv_armed && conn->state != STATE_DONE) {
+        if (!uringArmRecv(ring, conn)) {
+            conn->state = STATE_DONE;
+        }
+    }
+}
+
+void Server::uringOnSend(Uring *ring, Conn *conn, int res) {
+    conn->send_busy = false;
+    conn->uring_pending--;
+    if (conn->state == STATE_DONE) {
+        return;
+    }
+    if (res < 0) {
+        msg("send() error");
+        conn->state = STATE_DONE;
+        return;
+    }
+    conn->sending.consume((size_t)res);
+    Stats::bump(Stats::local().bytesOut, (uint64_t)res);
+    // serve the requests that were waiting for the output queue to drain
+    uringPump(conn);
+    uringFlush(ring, conn);
+    if (!conn->recv_armed && conn->state != STATE_DONE && !uringStalled(conn)) {
+        if (!uringArmRecv(ring, conn)) {
+            conn->state = STATE_DONE;
+        }
+    }
+}
+
+bool Server::uringConnDone(std::vector<Conn*> &fd2conn, Conn *conn) {
+    // a closing connection can't time out
+    conn->detach();
+    if (conn->uring_pending) {
+        // operations still reference the connection: make them complete
+        // and free it when the last one is reaped
+        (void)shutdown(conn->fd, SHUT_RDWR);
+        return false;
+    }
+    fd2conn[conn->fd] = NULL;
+    (void)close(conn->fd);
+    connFree(conn);
+    return true;
+}
+
+int Server::runUringReactor(int fd, Uring *ring) {
+    std::vector<Conn *> fd2conn;
+    DList idle;     // connections by last activity, oldest first
+    size_t nconns = 0;
+    const int lfds[2] = {fd, unixfd};
+    bool acceptArmed[2] = {false, false};
+    bool stopping = false;
+    std::vector<int> held;
+
+    // one-shot poll on the wakeup pipe, stop() never drains it
+    struct io_uring_sqe *sqe = ring->getSqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = wakefd[0];
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = uringTag(wakefd[0], URING_WAKE);
+
+    while (true) {
+        if (!running && !stopping) {
+            // close every connection, then leave once they are all reaped
+            stopping = true;
+            for (Conn *conn : fd2conn) {
+                if (conn) {
+                    conn->state = STATE_DONE;
+                    nconns -= uringConnDone(fd2conn, conn);
+                }
+            }
+        }
+        if (stopping && nconns == 0) {
+            break;
+        }
+        for (int l = 0; l < 2 && !stopping; l++) {
+            if (lfds[l] < 0 || acceptArmed[l] || !(sqe = ring->getSqe())) {
+                continue;
+            }
+            sqe->opcode = IORING_OP_ACCEPT;
+            sqe->fd = lfds[l];
+            sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+            sqe->accept_flags = SOCK_CLOEXEC;
+            sqe->user_data = uringTag(lfds[l], URING_ACCEPT);
+            acceptArmed[l] = true;
+        }
+
+        // submissions of the whole previous turn and the wait: one syscall
+        int timeout = min_timeout(keyspaceCron(), idleWait(&idle, get_monotonic_msec()));
+        if (stopping) {
+            timeout = min_timeout(timeout, 100);
+        }
+        if (ring->submitAndWait(timeout) < 0) {
+            die("io_uring_enter()");
+        }
+        uint64_t now = get_monotonic_msec();
+
+        struct io_uring_cqe *cqe;
+        while ((cqe = ring->peekCqe()) != NULL) {
+            uint64_t tag = cqe->user_data;
+            int res = cqe->res;
+            uint32_t flags = cqe->flags;
+            ring->seenCqe();
+
+            uint32_t op = (uint32_t)(tag & 0xff);
+            int cfd = (int)(tag >> 8);
+            if (op == URING_ACCEPT) {
+                if (!(flags & IORING_CQE_F_MORE)) {
+                    acceptArmed[cfd == lfds[1]] = false;
+                }
+                if (res >= 0 && stopping) {
+                    close(res);
+                } else if (res >= 0) {
+                    uringNewConn(fd2conn, ring, &idle, res);
+                    nconns += (size_t)res < fd2conn.size() && fd2conn[res];
+                }
+                continue;
+            }
+            if (op != URING_RECV && op != URING_SEND) {
+                continue;
+            }
+            Conn *conn = (size_t)cfd < fd2conn.size() ? fd2conn[cfd] : NULL;
+            if (!conn) {
+                if (flags & IORING_CQE_F_BUFFER) {
+                    ring->recycleBuf((uint16_t)(flags >> IORING_CQE_BUFFER_SHIFT));
+                }
+                continue;
+            }
+            if (op == URING_RECV) {
+                uringOnRecv(ring, conn, res, flags);
+            } else {
+                uringOnSend(ring, conn, res);
+            }
+            if (conn->state == STATE_DONE) {
+                nconns -= uringConnDone(fd2conn, conn);
+            } else {
+                connTouch(&idle, conn, now);
+                connRelease(conn);
+            }
+        }
+        // the log before the sends of the turn: they only reach the
+        // kernel with the next submitAndWait()
+        aofFlush(held);
+        for (int hfd : held) {
+            Conn *conn = (size_t)hfd < fd2conn.size() ? fd2conn[hfd] : NULL;
+            if (conn && conn->aof_held) {
+                conn->aof_held = false;
+                uringFlush(ring, conn);
+                if (conn->state == STATE_DONE) {
+                    nconns -= uringConnDone(fd2conn, conn);
+                }
+            }
+        }
+
+        // closed connections leave the list, so this ends at the first live one
+        while (idleWait(&idle, now) == 0) {
+            Conn *conn = static_cast<Conn *>(idle.next);
+            conn->state = STATE_DONE;
+            nconns -= uringConnDone(fd2conn, conn);
+        }
+    }
+    return 0;
+}
+
+#endif
@@ -2,6 +2,22 @@
 #define SERVER_H
 
 #include "Dependencies.h"
+#include "EventLoop.h"
+#include "Uring.h"
+#include "HashTable.h"
+#include "Heap.h"
+#include "ZSet.h"
+#include "LazyFree.h"
+#include "Slab.h"
+#include "Snapshot.h"
+#include "Epoch.h"
+#include "Stats.h"
+#include "Cycles.h"
+#include "Log.h"
+#include "SlowLog.h"
+#include "AppendLog.h"
+#include "Output.h"
+#include "DList.h"
 
 enum {
     STATE_REQ = 0,
@@ -15,49 +31,147 @@ enum {
     RES_NX = 2,
 };
 
-struct Conn {
+#ifdef REDICPP_IO_URING
+// sendmsg() arguments, kept until the completion
+struct UringSendMsg {
+    struct msghdr msg;
+    struct iovec iov[16];
+};
+#endif
+
+// linked into its reactor's idle list through the DList base. Buffers
+// hold memory only while they have pending bytes, an idle connection is
+// just this header.
+struct Conn : public DList {
     int fd = -1;
     uint32_t state = 0;
-    size_t rbuf_size = 0;
-    uint8_t rbuf[4 + 4096];
-    size_t wbuf_size = 0;
-    size_t wbuf_sent = 0;
-    uint8_t wbuf[4 + 4096];
+    uint64_t idle_start = 0;     // last activity, monotonic ms
+    Buffer rbuf;                 // rbuf.head is the parse cursor, grows up to
+                                 // one request of the protocol limit
+    Output wbuf;                 // queued responses
+    uint32_t interest = 0;       // LOOP_* bits registered with the event loop
+    uint64_t aof_seq = 0;        // appendfsync always: log bytes the queued
+                                 // responses wait for
+    bool aof_held = false;       // responses held until the log is synced
+#ifdef REDICPP_IO_URING
+    uint32_t uring_pending = 0;  // recv / send operations in flight
+    bool recv_armed = false;
+    bool send_busy = false;
+    Output sending;              // responses handed to the kernel, left alone
+                                 // until the send completes
+    std::unique_ptr<UringSendMsg> send_msg;  // when sending has refs
+#endif
 };
 
 class Server {
 public:
-    Server(uint16_t port);
+    // port 0 leaves TCP off, unixPath adds a unix domain socket listener
+    Server(uint16_t port, unsigned nthreads = 1, const char *unixPath = NULL);
     ~Server();
     int run();
+    int startReactor(int fd);
+    int runReactor(int fd);
+    void useIoUring(bool on);
+    static void setWbufHighWater(size_t bytes);
+    static void setMaxMsg(size_t bytes);
+    static void setIdleTimeout(uint64_t ms);
+    static void setSnapshotPath(const char *path);
+    // commands slower than this many us go to the slow log, keeping the
+    // newest maxLen; negative turns it off
+    static void setSlowlog(int64_t slowerThanUs, size_t maxLen);
+    // split the keyspace into n lock-striped shards, rounded up to a power
+    // of two; only while it is empty
+    static void setShards(size_t n);
+    static size_t shardCount();
+    // fill the keyspace from the snapshot file if there is one, false if
+    // it can't be read
+    static bool loadSnapshot();
+    // replay the append-only log at path, then keep appending every change
+    // to it; false if it can't be read or opened
+    static bool openAppendLog(const char *path, AppendLog::Fsync fsync);
+    // end of a loop turn: the changes of the turn go to the log, held gets
+    // the connections whose responses were waiting for that
+    static void aofFlush(std::vector<int> &held);
+    static bool aofHold(Conn *conn);
     void stop();
+    static Conn *connNew();
+    static void connFree(Conn *conn);
+    static void connRelease(Conn *conn);
     static void connPut(std::vector<Conn*> &fd2conn, struct Conn *conn);
-    static int32_t acceptNewConn(std::vector<Conn*> &fd2conn, int fd);
+    static int32_t acceptNewConn(std::vector<Conn*> &fd2conn, EventLoop *loop, DList *idle, int fd);
+    static void connDone(std::vector<Conn*> &fd2conn, EventLoop *loop, Conn *conn);
+    static void connTouch(DList *idle, Conn *conn, uint64_t now);
+    static void connSettle(std::vector<Conn*> &fd2conn, EventLoop *loop, Conn *conn);
+    static int idleWait(const DList *idle, uint64_t now);
+    static void reapIdle(std::vector<Conn*> &fd2conn, EventLoop *loop, DList *idle, uint64_t now);
     static void stateRequest(Conn *conn);
     static void stateResponse(Conn *conn);
+    static void compactRbuf(Conn *conn);
+    static void rbufReserve(Conn *conn);
+    static bool handleOneRequest(Conn *conn);
     static bool tryOneRequest(Conn *conn);
     static bool tryFillRbuf(Conn *conn);
     static bool tryFlushWbuf(Conn *conn);
     static void connectionIO(Conn *conn);
-    void logRequest(const Conn *conn, const std::string &clientMsg);
+    static uint32_t connInterest(const Conn *conn);
     static void die(const char *msg);
     static void msg(const char *msg);
     static int32_t read_full(int fd, char *buf, size_t n);
     static int32_t write_all(int fd, const char *buf, size_t n);
     static void fd_set_nb(int fd);
-    static int32_t parseReq(const uint8_t *data, size_t len, std::vector<std::string> &out);
-    static uint32_t do_get(const std::vector<std::string> &cmd, uint8_t *res, uint32_t *reslen);
-    static uint32_t do_set(const std::vector<std::string> &cmd, uint8_t *res, uint32_t *reslen);
-    static uint32_t do_del(const std::vector<std::string> &cmd, uint8_t *res, uint32_t *reslen);
-    static bool cmd_is(const std::string &word, const char *cmd);
-    static int32_t do_request(const uint8_t *req, uint32_t reqlen,uint32_t *rescode, uint8_t *res, uint32_t *reslen);
+    static void fd_set_nodelay(int fd);
+    static int listenOn(uint16_t port, bool reuseport);
+    static int listenUnix(const char *path);
+    static int32_t parseReq(const uint8_t *data, size_t len, std::vector<std::string_view> &out);
+    static uint32_t do_get(const std::vector<std::string_view> &cmd, Output &out);
+    static uint32_t do_set(const std::vector<std::string_view> &cmd, Output &out);
+    static uint32_t do_del(const std::vector<std::string_view> &cmd, Output &out);
+    static uint32_t do_expire(const std::vector<std::string_view> &cmd, Output &out);
+    static uint32_t do_ttl(const std::vector<std::string_view> &cmd, Output &out);
+    static uint32_t do_persist(const std::vector<std::string_view> &cmd, Output &out);
+    static uint32_t do_zadd(const std::vector<std::string_view> &cmd, Output &out);
+    static uint32_t do_zrem(const std::vector<std::string_view> &cmd, Output &out);
+    static uint32_t do_zscore(const std::vector<std::string_view> &cmd, Output &out);
+    static uint32_t do_zrangebyscore(const std::vector<std::string_view> &cmd, Output &out);
+    static uint32_t do_zquery(const std::vector<std::string_view> &cmd, Output &out);
+    static uint32_t do_save(const std::vector<std::string_view> &cmd, Output &out);
+    static uint32_t do_bgrewriteaof(const std::vector<std::string_view> &cmd, Output &out);
+    static uint32_t do_info(const std::vector<std::string_view> &cmd, Output &out);
+    static uint32_t do_slowlog(const std::vector<std::string_view> &cmd, Output &out);
+    static int keyspaceCron();
+    static bool cmd_is(std::string_view word, const char *cmd);
+    static int32_t do_request(const uint8_t *req, uint32_t reqlen, Output &out);
 
 private:
-    int fd;
-    bool running;
-    static std::mutex accept_mutex;
-    static std::mutex log_mutex;
-    static std::ofstream logfile;
+    // client requests are timed for INFO and the slow log, replayed ones not
+    static int32_t exec_request(const uint8_t *req, uint32_t reqlen, Output &out, bool client);
+#ifdef REDICPP_IO_URING
+    int runUringReactor(int fd, Uring *ring);
+    static void uringNewConn(std::vector<Conn*> &fd2conn, Uring *ring, DList *idle, int connfd);
+    static bool uringArmRecv(Uring *ring, Conn *conn);
+    static void uringFlush(Uring *ring, Conn *conn);
+    static void uringPump(Conn *conn);
+    static bool uringStalled(const Conn *conn);
+    static void uringOnRecv(Uring *ring, Conn *conn, int res, uint32_t flags);
+    static void uringOnSend(Uring *ring, Conn *conn, int res);
+    static bool uringConnDone(std::vector<Conn*> &fd2conn, Conn *conn);
+#endif
+    std::vector<int> listeners;  // one per reactor, -1 without TCP
+    int unixfd = -1;             // shared by all reactors
+    std::string unixPath;
+    int wakefd[2];
+    std::atomic<bool> running;
+    bool ioUring = false;
+    // queued output above which a connection stops reading requests
+    static size_t wbufHighWater;
+    // protocol limit on the size of one request
+    static size_t maxMsg;
+    // connections without activity for this long are closed, 0 never
+    static uint64_t idleTimeoutMs;
+    // written by SAVE / BGSAVE, loaded at startup
+    static std::string snapshotPath;
+    // slow log threshold, UINT64_MAX when off
+    static uint64_t slowlogNs;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,79 @@
+#include "Slab.h"
+
+// classes: 32 to 256 bytes in steps of 16, then eight per power of two up
+// to k_max_block, so a block wastes at most ~12% past 256 bytes
+uint8_t Slab::classOf(size_t n) {
+    if (n <= 256) {
+        return (uint8_t)((std::max(n, (size_t)32) + 15) / 16 - 2);
+    }
+    assert(n <= k_max_block);
+    size_t p = 63 - __builtin_clzll((unsigned long long)(n - 1));
+    size_t step = (size_t)1 << (p - 3);
+    size_t idx = (n - ((size_t)1 << p) + step - 1) / step - 1;
+    return (uint8_t)(15 + (p - 8) * 8 + idx);
+}
+
+size_t Slab::classSize(uint8_t sclass) {
+    if (sclass == k_large) {
+        return 0;
+    }
+    if (sclass < 15) {
+        return 32 + 16 * (size_t)sclass;
+    }
+    size_t k = sclass - 15;
+    size_t p = 8 + k / 8;
+    return ((size_t)1 << p) + (k % 8 + 1) * ((size_t)1 << (p - 3));
+}
+
+Slab::~Slab() {
+    for (void *page : pages) {
+        ::free(page);
+    }
+}
+
+void *Slab::alloc(size_t n, uint8_t &sclass) {
+    if (n > k_max_block) {
+        sclass = k_large;
+        void *p = malloc(n);
+        if (!p) {
+            abort();
+        }
+        used += n;
+        largeBytes += n;
+        return p;
+    }
+    sclass = classOf(n);
+    size_t size = classSize(sclass);
+    used += size;
+    if (FreeBlock *block = freelist[sclass]) {
+        freelist[sclass] = block->next;
+        return block;
+    }
+    if (carveLeft[sclass] < size) {
+        // the tail of the old page is too small to matter, start a new one
+        void *page = aligned_alloc(16, k_page_size);
+        if (!page) {
+            abort();
+        }
+        pages.push_back(page);
+        carve[sclass] = (uint8_t *)page;
+        carveLeft[sclass] = k_page_size;
+    }
+    void *p = carve[sclass];
+    carve[sclass] += size;
+    carveLeft[sclass] -= size;
+    return p;
+}
+
+void Slab::free(void *p, size_t n, uint8_t sclass) {
+    if (sclass == k_large) {
+        ::free(p);
+        used -= n;
+        largeBytes -= n;
+        return;
+    }
+    used -= classSize(sclass);
+    FreeBlock *block = (FreeBlock *)p;
+    block->next = freelist[sclass];
+    freelist[sclass] = block;
+}
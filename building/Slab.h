@@ -0,0 +1,51 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include "Dependencies.h"
+
+// Size-classed slab allocator for small objects. Each class carves its
+// blocks out of 64 KiB pages and recycles them through a free list, so an
+// allocation is a pointer pop and carries no malloc header. Pages are kept
+// until the allocator goes away. Blocks above the largest class come from
+// malloc. Not thread safe.
+class Slab {
+public:
+    static const size_t k_page_size = 64 << 10;
+    static const size_t k_max_block = 8 << 10;
+    static const uint8_t k_large = 255;  // class of malloc'd blocks
+
+    Slab() {}
+    ~Slab();
+    Slab(const Slab &) = delete;
+    Slab &operator=(const Slab &) = delete;
+
+    // A block of at least n bytes, 16-byte aligned; n and sclass are
+    // needed to free it
+    void *alloc(size_t n, uint8_t &sclass);
+    void free(void *p, size_t n, uint8_t sclass);
+    // Usable bytes of a block of this class, 0 for k_large
+    static size_t classSize(uint8_t sclass);
+    static uint8_t classOf(size_t n);
+    // bytes in live blocks, malloc'd ones included
+    size_t usedBytes() const {
+        return used;
+    }
+    // bytes taken from the system: pages plus malloc'd blocks
+    size_t reservedBytes() const {
+        return pages.size() * k_page_size + largeBytes;
+    }
+
+private:
+    static const size_t k_nclass = 55;
+    struct FreeBlock {
+        FreeBlock *next;
+    };
+    FreeBlock *freelist[k_nclass] = {};
+    uint8_t *carve[k_nclass] = {};  // unused tail of the class's last page
+    size_t carveLeft[k_nclass] = {};
+    std::vector<void *> pages;
+    size_t used = 0;
+    size_t largeBytes = 0;
+};
+
+#endif
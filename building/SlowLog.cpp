@@ -0,0 +1,81 @@
+#include "SlowLog.h"
+
+SlowLog::SlowLog(size_t maxLen) : maxLen(maxLen) {}
+
+void SlowLog::setMaxLen(size_t n) {
+    std::lock_guard<std::mutex> lk(mu);
+    maxLen = n;
+    ring.clear();
+    ring.shrink_to_fit();
+    head = 0;
+}
+
+// the way Redis cuts them: a note of what was left out in place of the rest
+static std::vector<std::string> cut_args(const std::vector<std::string_view> &cmd) {
+    std::vector<std::string> args;
+    size_t n = std::min(cmd.size(), SlowLog::k_max_args);
+    for (size_t i = 0; i < n; i++) {
+        if (i == n - 1 && cmd.size() > n) {
+            args.push_back("... (" + std::to_string(cmd.size() - n + 1) + " more arguments)");
+            break;
+        }
+        std::string_view arg = cmd[i];
+        if (arg.size() > SlowLog::k_max_arg_len) {
+            std::string s(arg.substr(0, SlowLog::k_max_arg_len));
+            s += "... (" + std::to_string(arg.size() - SlowLog::k_max_arg_len) + " more bytes)";
+            args.push_back(std::move(s));
+        } else {
+            args.emplace_back(arg);
+        }
+    }
+    return args;
+}
+
+void SlowLog::add(const std::vector<std::string_view> &cmd, uint64_t durationUs, uint64_t unixMs,
+                  std::string client) {
+    SlowLogEntry ent;
+    ent.unixMs = unixMs;
+    ent.durationUs = durationUs;
+    ent.args = cut_args(cmd);
+    ent.client = std::move(client);
+    // the old entry is freed outside the lock
+    SlowLogEntry old;
+    {
+        std::lock_guard<std::mutex> lk(mu);
+        if (!maxLen) {
+            return;
+        }
+        ent.id = nextId++;
+        if (ring.size() < maxLen) {
+            ring.push_back(std::move(ent));
+        } else {
+            old = std::move(ring[head]);
+            ring[head] = std::move(ent);
+            head = (head + 1) % maxLen;
+        }
+    }
+}
+
+std::vector<SlowLogEntry> SlowLog::get(size_t n) const {
+    std::lock_guard<std::mutex> lk(mu);
+    std::vector<SlowLogEntry> out;
+    n = std::min(n, ring.size());
+    out.reserve(n);
+    // the newest is just before head
+    for (size_t i = 0; i < n; i++) {
+        out.push_back(ring[(head + ring.size() - 1 - i) % ring.size()]);
+    }
+    return out;
+}
+
+size_t SlowLog::len() const {
+    std::lock_guard<std::mutex> lk(mu);
+    return ring.size();
+}
+
+void SlowLog::reset() {
+    std::vector<SlowLogEntry> old;
+    std::lock_guard<std::mutex> lk(mu);
+    old.swap(ring);
+    head = 0;
+}
@@ -0,0 +1,42 @@
+#ifndef SLOWLOG_H
+#define SLOWLOG_H
+
+#include "Dependencies.h"
+
+struct SlowLogEntry {
+    uint64_t id = 0;
+    uint64_t unixMs = 0;
+    uint64_t durationUs = 0;
+    std::vector<std::string> args;  // cut, see SlowLog::k_max_args
+    std::string client;             // "ip:port", "unix", or empty
+};
+
+// Commands that ran longer than a threshold, in a ring of fixed size where
+// a new entry replaces the oldest. Only slow commands come here, so the
+// mutex and the copies are off the common path; do_request() pays one
+// compare for everything else, and nothing extra when the log is off.
+class SlowLog {
+public:
+    // at most this many arguments are kept, each cut to k_max_arg_len
+    static constexpr size_t k_max_args = 32;
+    static constexpr size_t k_max_arg_len = 128;
+
+    explicit SlowLog(size_t maxLen = 128);
+    // drops the entries
+    void setMaxLen(size_t n);
+    void add(const std::vector<std::string_view> &cmd, uint64_t durationUs, uint64_t unixMs,
+             std::string client);
+    // the newest n entries, newest first
+    std::vector<SlowLogEntry> get(size_t n) const;
+    size_t len() const;
+    void reset();
+
+private:
+    mutable std::mutex mu;
+    std::vector<SlowLogEntry> ring;  // maxLen slots once full
+    size_t head = 0;                 // the oldest entry once full
+    size_t maxLen;
+    uint64_t nextId = 0;
+};
+
+#endif
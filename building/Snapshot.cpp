@@ -0,0 +1,217 @@
+#include "Snapshot.h"
+
+static const uint64_t k_p1 = 11400714785074694791ULL;
+static const uint64_t k_p2 = 14029467366897019727ULL;
+static const uint64_t k_p3 = 1609587929392839161ULL;
+static const uint64_t k_p4 = 9650029242287828579ULL;
+static const uint64_t k_p5 = 2870177450012600261ULL;
+
+static uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t read64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static uint64_t xxh_round(uint64_t acc, uint64_t input) {
+    acc += input * k_p2;
+    return rotl(acc, 31) * k_p1;
+}
+
+static uint64_t xxh_merge(uint64_t acc, uint64_t v) {
+    acc ^= xxh_round(0, v);
+    return acc * k_p1 + k_p4;
+}
+
+Checksum::Checksum() {
+    v[0] = k_p1 + k_p2;
+    v[1] = k_p2;
+    v[2] = 0;
+    v[3] = -k_p1;
+}
+
+void Checksum::update(const uint8_t *data, size_t n) {
+    total += n;
+    if (ntail + n < 32) {
+        memcpy(tail + ntail, data, n);
+        ntail += n;
+        return;
+    }
+    if (ntail) {
+        size_t fill = 32 - ntail;
+        memcpy(tail + ntail, data, fill);
+        for (int i = 0; i < 4; i++) {
+            v[i] = xxh_round(v[i], read64(tail + 8 * i));
+        }
+        data += fill;
+        n -= fill;
+        ntail = 0;
+    }
+    // four independent lanes, 32 bytes per step
+    for (; n >= 32; data += 32, n -= 32) {
+        v[0] = xxh_round(v[0], read64(data));
+        v[1] = xxh_round(v[1], read64(data + 8));
+        v[2] = xxh_round(v[2], read64(data + 16));
+        v[3] = xxh_round(v[3], read64(data + 24));
+    }
+    memcpy(tail, data, n);
+    ntail = n;
+}
+
+uint64_t Checksum::digest() const {
+    uint64_t h;
+    if (total >= 32) {
+        h = rotl(v[0], 1) + rotl(v[1], 7) + rotl(v[2], 12) + rotl(v[3], 18);
+        for (int i = 0; i < 4; i++) {
+            h = xxh_merge(h, v[i]);
+        }
+    } else {
+        h = k_p5;
+    }
+    h += total;
+    const uint8_t *p = tail;
+    size_t n = ntail;
+    for (; n >= 8; p += 8, n -= 8) {
+        h ^= xxh_round(0, read64(p));
+        h = rotl(h, 27) * k_p1 + k_p4;
+    }
+    if (n >= 4) {
+        uint32_t w;
+        memcpy(&w, p, 4);
+        h ^= (uint64_t)w * k_p1;
+        h = rotl(h, 23) * k_p2 + k_p3;
+        p += 4;
+        n -= 4;
+    }
+    for (; n > 0; p++, n--) {
+        h ^= (uint64_t)*p * k_p5;
+        h = rotl(h, 11) * k_p1;
+    }
+    h ^= h >> 33;
+    h *= k_p2;
+    h ^= h >> 29;
+    h *= k_p3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t Checksum::of(const uint8_t *data, size_t n) {
+    Checksum sum;
+    sum.update(data, n);
+    return sum.digest();
+}
+
+// large enough that a write is one syscall per MiB
+const size_t k_snap_buf = 1 << 20;
+
+SnapshotWriter::SnapshotWriter(int fd) : fd(fd), buf(k_snap_buf) {
+    put(k_snap_magic, sizeof(k_snap_magic));
+    putU32(k_snap_version);
+    putU32(0);
+}
+
+void SnapshotWriter::flush() {
+    sum.update(buf.data(), used);
+    size_t done = 0;
+    while (ok && done < used) {
+        ssize_t rv = write(fd, buf.data() + done, used - done);
+        if (rv < 0 && errno == EINTR) {
+            continue;
+        }
+        if (rv <= 0) {
+            ok = false;
+            break;
+        }
+        done += (size_t)rv;
+    }
+    used = 0;
+}
+
+void SnapshotWriter::put(const void *data, size_t n) {
+    const uint8_t *p = (const uint8_t *)data;
+    while (n > 0) {
+        size_t chunk = std::min(n, buf.size() - used);
+        memcpy(buf.data() + used, p, chunk);
+        used += chunk;
+        p += chunk;
+        n -= chunk;
+        if (used == buf.size()) {
+            flush();
+        }
+    }
+}
+
+bool SnapshotWriter::finish(uint64_t nkeys) {
+    putU8(k_snap_eof);
+    putU64(nkeys);
+    flush();
+    uint64_t digest = sum.digest();
+    put(&digest, 8);
+    flush();
+    return ok && fsync(fd) == 0;
+}
+
+SnapshotFile::~SnapshotFile() {
+    if (map) {
+        munmap(map, size);
+    }
+}
+
+int SnapshotFile::open(const char *path) {
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            return 0;
+        }
+        err = "cannot open";
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) || (size_t)st.st_size < k_snap_header + k_snap_trailer) {
+        close(fd);
+        err = "truncated";
+        return -1;
+    }
+    size = (size_t)st.st_size;
+    map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        map = NULL;
+        err = "mmap() failed";
+        return -1;
+    }
+    // one front to back pass for the checksum, one for the records
+    (void)madvise(map, size, MADV_SEQUENTIAL);
+    const uint8_t *data = (const uint8_t *)map;
+    uint32_t version;
+    memcpy(&version, data + 8, 4);
+    if (memcmp(data, k_snap_magic, 8) != 0 || version != k_snap_version) {
+        err = "not a snapshot of this version";
+        return -1;
+    }
+    uint64_t digest;
+    memcpy(&digest, data + size - 8, 8);
+    if (data[size - k_snap_trailer] != k_snap_eof || Checksum::of(data, size - 8) != digest) {
+        err = "checksum mismatch";
+        return -1;
+    }
+    memcpy(&nkeys, data + size - 16, 8);
+    records.pos = data + k_snap_header;
+    records.end = data + size - k_snap_trailer;
+    return 1;
+}
+
+bool fsync_dir_of(const char *path) {
+    const char *slash = strrchr(path, '/');
+    std::string dir = !slash ? "." : (slash == path ? "/" : std::string(path, (size_t)(slash - path)));
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+}
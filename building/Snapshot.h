@@ -0,0 +1,131 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "Dependencies.h"
+
+// Snapshot file layout, integers in host byte order like the protocol:
+//
+//   header   "RDCPSNAP" u32 version u32 0
+//   record   u8 type  u8 flags  [u64 expire_at]  u32 klen key  value
+//            flags bit 0: expire_at (unix ms) follows
+//            T_STR value:  u32 len bytes
+//            T_ZSET value: u32 n, then n x (f64 score, u32 len, name)
+//   trailer  u8 0xff  u64 nkeys  u64 checksum
+//
+// The checksum is XXH64 (seed 0) of every byte before it.
+const char k_snap_magic[8] = {'R', 'D', 'C', 'P', 'S', 'N', 'A', 'P'};
+const uint32_t k_snap_version = 1;
+const uint8_t k_snap_eof = 0xff;
+const uint8_t k_snap_expire = 1;
+const size_t k_snap_header = 16;
+const size_t k_snap_trailer = 1 + 8 + 8;
+
+// Streaming XXH64
+class Checksum {
+public:
+    Checksum();
+    void update(const uint8_t *data, size_t n);
+    uint64_t digest() const;
+    static uint64_t of(const uint8_t *data, size_t n);
+
+private:
+    uint64_t v[4];
+    uint8_t tail[32];
+    size_t ntail = 0;
+    uint64_t total = 0;
+};
+
+// Buffered, checksummed writes of a snapshot to fd. Errors stick: once a
+// write fails the rest are skipped and finish() returns false.
+class SnapshotWriter {
+public:
+    explicit SnapshotWriter(int fd);
+    SnapshotWriter(const SnapshotWriter &) = delete;
+    SnapshotWriter &operator=(const SnapshotWriter &) = delete;
+
+    void put(const void *data, size_t n);
+    void putU8(uint8_t v) {
+        put(&v, 1);
+    }
+    void putU32(uint32_t v) {
+        put(&v, 4);
+    }
+    void putU64(uint64_t v) {
+        put(&v, 8);
+    }
+    void putF64(double v) {
+        put(&v, 8);
+    }
+    void putStr(std::string_view s) {
+        putU32((uint32_t)s.size());
+        put(s.data(), s.size());
+    }
+    // the trailer, then everything flushed and fsync'ed
+    bool finish(uint64_t nkeys);
+
+private:
+    void flush();
+
+    int fd;
+    bool ok = true;
+    std::vector<uint8_t> buf;
+    size_t used = 0;
+    Checksum sum;
+};
+
+// Bounds-checked cursor over a mapped snapshot. A read past the end
+// returns zeroes and clears ok.
+struct SnapshotReader {
+    const uint8_t *pos = NULL;
+    const uint8_t *end = NULL;
+    bool ok = true;
+
+    const uint8_t *take(size_t n) {
+        if (!ok || (size_t)(end - pos) < n) {
+            ok = false;
+            return NULL;
+        }
+        const uint8_t *p = pos;
+        pos += n;
+        return p;
+    }
+    template <class T>
+    T get() {
+        T v = T();
+        if (const uint8_t *p = take(sizeof(T))) {
+            memcpy(&v, p, sizeof(T));
+        }
+        return v;
+    }
+    std::string_view getStr() {
+        uint32_t n = get<uint32_t>();
+        const uint8_t *p = take(n);
+        return p ? std::string_view((const char *)p, n) : std::string_view();
+    }
+};
+
+// A snapshot file mapped read-only, with its trailer checked. records
+// covers the bytes between the header and the trailer.
+class SnapshotFile {
+public:
+    SnapshotFile() {}
+    ~SnapshotFile();
+    SnapshotFile(const SnapshotFile &) = delete;
+    SnapshotFile &operator=(const SnapshotFile &) = delete;
+
+    // 1 when loaded, 0 when there is no file, -1 with err set otherwise
+    int open(const char *path);
+    const char *err = NULL;
+    uint64_t nkeys = 0;
+    SnapshotReader records;
+
+private:
+    void *map = NULL;
+    size_t size = 0;
+};
+
+// fsync() of the directory holding path, so that a rename() into it
+// survives a crash; the file's own fsync() doesn't cover its name
+bool fsync_dir_of(const char *path);
+
+#endif
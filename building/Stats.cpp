@@ -0,0 +1,15 @@
+#include "Stats.h"
+
+std::mutex Stats::registryMu;
+std::vector<Stats *> Stats::registry;
+
+Stats &Stats::attach() {
+    // never freed: the counts of a finished thread stay in the totals
+    Stats *s = new Stats();
+    {
+        std::lock_guard<std::mutex> lk(registryMu);
+        registry.push_back(s);
+    }
+    t_local = s;
+    return *s;
+}
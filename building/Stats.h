@@ -0,0 +1,68 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "Dependencies.h"
+
+// latency buckets of a command: bucket i counts calls that took less than
+// 2^i ns and at least half that, the last one everything slower
+const size_t k_lat_buckets = 40;
+// command slots, see the command table in Server.cpp
+const size_t k_max_commands = 32;
+
+struct CmdStats {
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> errors{0};
+    std::atomic<uint64_t> nsec{0};
+    std::atomic<uint64_t> lat[k_lat_buckets] = {};
+};
+
+// Server counters, one block per thread. A thread only ever writes its own
+// block, with plain relaxed stores instead of atomic adds, so counting
+// costs no more than on a private variable and no cache line bounces
+// between reactors. Readers (INFO) sum the blocks of every thread that
+// counted anything; a block outlives its thread so that totals never drop.
+class Stats {
+public:
+    CmdStats cmds[k_max_commands];
+    std::atomic<uint64_t> connsOpened{0};
+    std::atomic<uint64_t> connsClosed{0};
+    std::atomic<uint64_t> bytesIn{0};
+    std::atomic<uint64_t> bytesOut{0};
+
+    // this thread's block
+    static Stats &local() {
+        Stats *s = t_local;
+        return s ? *s : attach();
+    }
+    // f(const Stats &) over every block
+    template <class F>
+    static void forEach(F f) {
+        std::lock_guard<std::mutex> lk(registryMu);
+        for (const Stats *s : registry) {
+            f(*s);
+        }
+    }
+
+    static void bump(std::atomic<uint64_t> &c, uint64_t n = 1) {
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    void command(size_t idx, uint64_t ns, bool err) {
+        CmdStats &c = cmds[idx];
+        bump(c.calls);
+        bump(c.nsec, ns);
+        if (err) {
+            bump(c.errors);
+        }
+        size_t b = ns ? (size_t)(64 - __builtin_clzll(ns)) : 0;
+        bump(c.lat[std::min(b, k_lat_buckets - 1)]);
+    }
+
+private:
+    static Stats &attach();
+
+    static inline thread_local Stats *t_local = NULL;
+    static std::mutex registryMu;
+    static std::vector<Stats *> registry;
+};
+
+#endif
@@ -0,0 +1,198 @@
+#include "Uring.h"
+
+#if defined(__linux__) && defined(REDICPP_IO_URING)
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+
+// multishot recv with provided buffers landed in Linux 6.0
+static bool kernelAtLeast(int major, int minor) {
+    struct utsname u;
+    if (uname(&u)) {
+        return false;
+    }
+    int ma = 0, mi = 0;
+    if (sscanf(u.release, "%d.%d", &ma, &mi) != 2) {
+        return false;
+    }
+    return ma > major || (ma == major && mi >= minor);
+}
+
+Uring *Uring::create(unsigned entries, unsigned nbufs, unsigned bufsize) {
+    if (!kernelAtLeast(6, 0)) {
+        return NULL;
+    }
+    // nbufs must be a power of two for the buffer ring
+    assert(nbufs && (nbufs & (nbufs - 1)) == 0 && nbufs <= 32768);
+
+    struct io_uring_params p = {};
+    int fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (fd < 0) {
+        return NULL;
+    }
+    uint32_t need = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+    if ((p.features & need) != need) {
+        close(fd);
+        return NULL;
+    }
+
+    Uring *ring = new Uring();
+    ring->ringfd = fd;
+
+    // SQ and CQ rings share one mapping with IORING_FEAT_SINGLE_MMAP
+    size_t sqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cqSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ring->ringMemSize = sqSize > cqSize ? sqSize : cqSize;
+    ring->ringMem = mmap(NULL, ring->ringMemSize, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring->ringMem == MAP_FAILED) {
+        ring->ringMem = NULL;
+        delete ring;
+        return NULL;
+    }
+    ring->sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        delete ring;
+        return NULL;
+    }
+    ring->sqes = (struct io_uring_sqe *)sqes;
+
+    uint8_t *base = (uint8_t *)ring->ringMem;
+    ring->sqHead = (unsigned *)(base + p.sq_off.head);
+    ring->sqTail = (unsigned *)(base + p.sq_off.tail);
+    ring->sqMask = *(unsigned *)(base + p.sq_off.ring_mask);
+    ring->sqEntries = p.sq_entries;
+    ring->sqLocalTail = ring->sqPublished = *ring->sqTail;
+    // identity mapping: SQE slot i is always array entry i
+    unsigned *array = (unsigned *)(base + p.sq_off.array);
+    for (unsigned i = 0; i < p.sq_entries; i++) {
+        array[i] = i;
+    }
+    ring->cqHead = (unsigned *)(base + p.cq_off.head);
+    ring->cqTail = (unsigned *)(base + p.cq_off.tail);
+    ring->cqMask = *(unsigned *)(base + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(base + p.cq_off.cqes);
+
+    // provided buffer ring for multishot recv
+    ring->bufRingSize = nbufs * sizeof(struct io_uring_buf);
+    void *br = mmap(NULL, ring->bufRingSize, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (br == MAP_FAILED) {
+        delete ring;
+        return NULL;
+    }
+    ring->bufRing = (struct io_uring_buf_ring *)br;
+    ring->bufMask = nbufs - 1;
+    ring->bufsize = bufsize;
+    ring->bufs = (uint8_t *)malloc((size_t)nbufs * bufsize);
+    if (!ring->bufs) {
+        delete ring;
+        return NULL;
+    }
+    struct io_uring_buf_reg reg = {};
+    reg.ring_addr = (uint64_t)(uintptr_t)br;
+    reg.ring_entries = nbufs;
+    reg.bgid = k_buf_group;
+    if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        delete ring;
+        return NULL;
+    }
+    for (unsigned i = 0; i < nbufs; i++) {
+        ring->recycleBuf((uint16_t)i);
+    }
+    return ring;
+}
+
+Uring::~Uring() {
+    // closing the ring cancels whatever is still in flight
+    if (ringfd >= 0) {
+        close(ringfd);
+    }
+    if (sqes) {
+        munmap(sqes, sqesSize);
+    }
+    if (ringMem) {
+        munmap(ringMem, ringMemSize);
+    }
+    if (bufRing) {
+        munmap(bufRing, bufRingSize);
+    }
+    free(bufs);
+}
+
+void Uring::recycleBuf(uint16_t bid) {
+    // Index the ring memory directly: in C++ the flexible bufs[] member of
+    // io_uring_buf_ring is not laid out at offset 0 as the kernel expects
+    struct io_uring_buf *buf = (struct io_uring_buf *)bufRing + (bufTail & bufMask);
+    buf->addr = (uint64_t)(uintptr_t)bufAt(bid);
+    buf->len = (uint32_t)bufsize;
+    buf->bid = bid;
+    bufTail++;
+    __atomic_store_n(&bufRing->tail, bufTail, __ATOMIC_RELEASE);
+}
+
+int Uring::enter(unsigned toSubmit, unsigned minComplete, unsigned flags, int timeout_ms) {
+    struct __kernel_timespec ts = {};
+    struct io_uring_getevents_arg arg = {};
+    if (timeout_ms >= 0) {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+    }
+    flags |= IORING_ENTER_EXT_ARG;
+    int rv = (int)syscall(__NR_io_uring_enter, ringfd, toSubmit, minComplete,
+                          flags, &arg, sizeof(arg));
+    if (rv < 0 && (errno == EINTR || errno == ETIME || errno == EBUSY)) {
+        return 0;
+    }
+    if (rv > 0) {
+        sqPublished += (unsigned)rv;
+    }
+    return rv;
+}
+
+struct io_uring_sqe *Uring::getSqe() {
+    unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    if (sqLocalTail - head >= sqEntries) {
+        // queue full: push what we have to the kernel without waiting
+        __atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+        (void)enter(sqLocalTail - sqPublished, 0, 0, 0);
+        head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+        if (sqLocalTail - head >= sqEntries) {
+            return NULL;
+        }
+    }
+    struct io_uring_sqe *sqe = &sqes[sqLocalTail & sqMask];
+    memset(sqe, 0, sizeof(*sqe));
+    sqLocalTail++;
+    return sqe;
+}
+
+int Uring::submitAndWait(int timeout_ms) {
+    __atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+    unsigned toSubmit = sqLocalTail - sqPublished;
+    // completions already waiting: do not block
+    bool ready = peekCqe() != NULL;
+    unsigned flags = ready ? 0 : IORING_ENTER_GETEVENTS;
+    if (ready && toSubmit == 0) {
+        return 0;
+    }
+    return enter(toSubmit, ready ? 0 : 1, flags, timeout_ms);
+}
+
+struct io_uring_cqe *Uring::peekCqe() {
+    unsigned head = *cqHead;
+    if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return &cqes[head & cqMask];
+}
+
+void Uring::seenCqe() {
+    __atomic_store_n(cqHead, *cqHead + 1, __ATOMIC_RELEASE);
+}
+
+#endif
@@ -0,0 +1,104 @@
+#include "ZSet.h"
+
+static ZNode *znode_of(AVLNode *node) {
+    return static_cast<ZNode *>(node);
+}
+
+// sort order: by score, then by name
+static bool zless(const ZNode *node, double score, std::string_view name) {
+    if (node->score != score) {
+        return node->score < score;
+    }
+    return std::string_view(node->name) < name;
+}
+
+static bool zless(const ZNode *lhs, const ZNode *rhs) {
+    return zless(lhs, rhs->score, rhs->name);
+}
+
+static void tree_dispose(AVLNode *node) {
+    // depth is O(log n), recursion is fine
+    if (!node) {
+        return;
+    }
+    tree_dispose(node->left);
+    tree_dispose(node->right);
+    delete znode_of(node);
+}
+
+ZSet::~ZSet() {
+    tree_dispose(root);
+}
+
+void ZSet::treeInsert(ZNode *node) {
+    // walk down to a leaf position, then rebalance up
+    AVLNode *parent = NULL;
+    AVLNode **from = &root;
+    while (*from) {
+        parent = *from;
+        from = zless(node, znode_of(parent)) ? &parent->left : &parent->right;
+    }
+    *from = node;
+    node->parent = parent;
+    root = avl_fix(node);
+}
+
+bool ZSet::insert(std::string_view name, double score) {
+    ZNode *node = lookup(name);
+    if (node) {
+        if (node->score != score) {
+            // detach, change the sort key, link back in
+            root = avl_del(node);
+            *static_cast<AVLNode *>(node) = AVLNode();
+            node->score = score;
+            treeInsert(node);
+        }
+        return false;
+    }
+    node = new ZNode();
+    node->name.assign(name);
+    node->score = score;
+    node->hcode = str_hash((const uint8_t *)name.data(), name.size());
+    hmap.insert(node);
+    treeInsert(node);
+    return true;
+}
+
+ZNode *ZSet::lookup(std::string_view name) const {
+    HNode *found = hmap.lookup(str_hash((const uint8_t *)name.data(), name.size()), [&](HNode *node) {
+        return static_cast<ZNode *>(node)->name == name;
+    });
+    return static_cast<ZNode *>(found);
+}
+
+bool ZSet::remove(std::string_view name) {
+    HNode *found = hmap.remove(str_hash((const uint8_t *)name.data(), name.size()), [&](HNode *node) {
+        return static_cast<ZNode *>(node)->name == name;
+    });
+    if (!found) {
+        return false;
+    }
+    ZNode *node = static_cast<ZNode *>(found);
+    root = avl_del(node);
+    delete node;
+    return true;
+}
+
+ZNode *ZSet::seekge(double score, std::string_view name) const {
+    AVLNode *found = NULL;
+    for (AVLNode *node = root; node; ) {
+        if (zless(znode_of(node), score, name)) {
+            node = node->right;
+        } else {
+            // candidate, look for a smaller one on the left
+            found = node;
+            node = node->left;
+        }
+    }
+    return found ? znode_of(found) : NULL;
+}
+
+ZNode *ZSet::offset(ZNode *node, int64_t offset) {
+    AVLNode *found = node ? avl_offset(node, offset) : NULL;
+    return found ? znode_of(found) : NULL;
+}
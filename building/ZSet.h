@@ -0,0 +1,49 @@
+#ifndef ZSET_H
+#define ZSET_H
+
+#include "AVL.h"
+#include "HashTable.h"
+
+// Sorted set member, in the tree by (score, name) and in the hash by name
+struct ZNode : public AVLNode, public HNode {
+    double score = 0;
+    std::string name;
+};
+
+// Sorted set: an order-statistic AVL tree for range and offset queries,
+// plus a hash table for member -> score lookups. Not thread safe.
+class ZSet {
+public:
+    ZSet() {}
+    ~ZSet();
+    ZSet(const ZSet &) = delete;
+    ZSet &operator=(const ZSet &) = delete;
+
+    // Add a member or update its score, true if it was added
+    bool insert(std::string_view name, double score);
+    ZNode *lookup(std::string_view name) const;
+    // true if the member was there
+    bool remove(std::string_view name);
+    // The first member >= (score, name), NULL if none
+    ZNode *seekge(double score, std::string_view name) const;
+    // The member offset positions away in sort order, NULL if out of range
+    static ZNode *offset(ZNode *node, int64_t offset);
+    size_t size() const {
+        return hmap.size();
+    }
+    // Every member, in no particular order
+    template <class F>
+    void forEach(F f) const {
+        hmap.forEach([&](HNode *node) {
+            f(static_cast<const ZNode *>(node));
+        });
+    }
+
+private:
+    void treeInsert(ZNode *node);
+
+    AVLNode *root = NULL;
+    HMap hmap;
+};
+
+#endif
@@ -0,0 +1,85 @@
+#include "Dependencies.h"
+#include <chrono>
+
+// Connection storm against a running server: nconns clients connect at
+// once, then each sends one GET; the time until every one is answered is
+// the admission rate. Per-client latency counts from its connect().
+// usage: bench_connect [nconns] [port]
+
+using Clock = std::chrono::steady_clock;
+
+static void die(const char *msg) {
+    fprintf(stderr, "bench_connect: [%d] %s\n", errno, msg);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    size_t nconns = (argc > 1) ? (size_t)atoll(argv[1]) : 2000;
+    uint16_t port = (argc > 2) ? (uint16_t)atoi(argv[2]) : 1234;
+
+    // GET of a missing key, answered with an 8-byte header
+    std::string req;
+    uint32_t n = 2;
+    uint32_t len = 4 + 4 + 3 + 4 + 1;
+    req.append((const char *)&len, 4);
+    req.append((const char *)&n, 4);
+    for (std::string_view arg : {std::string_view("get"), std::string_view("k")}) {
+        uint32_t sz = (uint32_t)arg.size();
+        req.append((const char *)&sz, 4);
+        req.append(arg);
+    }
+
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    std::vector<struct pollfd> pfds(nconns);
+    std::vector<Clock::time_point> start(nconns);
+    std::vector<uint32_t> lat;
+    lat.reserve(nconns);
+    auto t0 = Clock::now();
+    for (size_t i = 0; i < nconns; i++) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) {
+            die("socket()");
+        }
+        start[i] = Clock::now();
+        // the handshake completes in the kernel, the server accepts later
+        if (connect(fd, (const struct sockaddr *)&addr, sizeof(addr))) {
+            die("connect()");
+        }
+        pfds[i].fd = fd;
+        pfds[i].events = POLLIN;
+    }
+    // the whole storm is queued, now every client asks at once
+    for (size_t i = 0; i < nconns; i++) {
+        if (write(pfds[i].fd, req.data(), req.size()) != (ssize_t)req.size()) {
+            die("write()");
+        }
+    }
+    size_t left = nconns;
+    while (left) {
+        if (poll(pfds.data(), pfds.size(), 5000) <= 0) {
+            die("poll(), server stopped answering");
+        }
+        auto now = Clock::now();
+        for (size_t i = 0; i < nconns; i++) {
+            if (pfds[i].fd < 0 || !pfds[i].revents) {
+                continue;
+            }
+            char buf[64];
+            (void)read(pfds[i].fd, buf, sizeof(buf));
+            lat.push_back((uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(now - start[i]).count());
+            close(pfds[i].fd);
+            pfds[i].fd = -1;
+            left--;
+        }
+    }
+    auto t1 = Clock::now();
+    double secs = (double)std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count() / 1e6;
+    std::sort(lat.begin(), lat.end());
+    printf("%zu connections in %.3f s: %.0f conns/s  first reply p50 %u us  p99 %u us  max %u us\n",
+           nconns, secs, nconns / secs, lat[nconns / 2], lat[nconns * 99 / 100], lat[nconns - 1]);
+    return 0;
+}
@@ -0,0 +1,82 @@
+#include "HashTable.h"
+#include <chrono>
+#include <algorithm>
+
+// Insert latency while the keyspace grows: std::unordered_map (stop-the-world
+// rehash) against HMap (progressive rehash).
+// usage: bench_hashtable [nkeys]
+
+using Clock = std::chrono::steady_clock;
+
+struct Entry : public HNode {
+    std::string key;
+    std::string val;
+};
+
+static void report(const char *name, std::vector<uint32_t> &lat) {
+    uint64_t total = 0;
+    for (uint32_t ns : lat) {
+        total += ns;
+    }
+    std::sort(lat.begin(), lat.end());
+    size_t n = lat.size();
+    printf("%-20s avg %6.0f ns  p99 %6u ns  p99.9 %7u ns  p99.99 %8u ns  max %10u ns\n",
+           name, (double)total / n, lat[n * 99 / 100], lat[n * 999 / 1000],
+           lat[n * 9999 / 10000], lat[n - 1]);
+}
+
+static std::string key_of(size_t i) {
+    return "key:" + std::to_string(i);
+}
+
+int main(int argc, char **argv) {
+    size_t nkeys = (argc > 1) ? (size_t)atoll(argv[1]) : 2000000;
+    std::vector<uint32_t> lat(nkeys);
+
+    {
+        std::unordered_map<std::string, std::string> map;
+        for (size_t i = 0; i < nkeys; i++) {
+            std::string key = key_of(i);
+            auto t0 = Clock::now();
+            map[key] = "value";
+            auto t1 = Clock::now();
+            lat[i] = (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+        }
+        report("std::unordered_map", lat);
+    }
+
+    {
+        HMap map;
+        std::vector<Entry *> entries;
+        entries.reserve(nkeys);
+        for (size_t i = 0; i < nkeys; i++) {
+            std::string key = key_of(i);
+            auto t0 = Clock::now();
+            Entry *ent = new Entry();
+            ent->key = std::move(key);
+            ent->val = "value";
+            ent->hcode = str_hash((const uint8_t *)ent->key.data(), ent->key.size());
+            map.insert(ent);
+            auto t1 = Clock::now();
+            lat[i] = (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+            entries.push_back(ent);
+        }
+        report("HMap", lat);
+
+        // every key must still be reachable
+        for (size_t i = 0; i < nkeys; i += 997) {
+            std::string key = key_of(i);
+            HNode *node = map.lookup(str_hash((const uint8_t *)key.data(), key.size()), [&](HNode *n) {
+                return static_cast<Entry *>(n)->key == key;
+            });
+            if (!node) {
+                fprintf(stderr, "missing %s\n", key.c_str());
+                return 1;
+            }
+        }
+        for (Entry *ent : entries) {
+            delete ent;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,103 @@
+#include "Server.h"
+#include <chrono>
+#include <random>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+// Memory per key and GET latency of the keyspace against a plain
+// std::unordered_map<std::string, std::string> holding the same data.
+// usage: bench_memory [nkeys] [value bytes]
+
+using Clock = std::chrono::steady_clock;
+
+// heap bytes in use, glibc only
+static size_t heap_used() {
+#if defined(__GLIBC__)
+    struct mallinfo2 mi = mallinfo2();
+    return mi.uordblks + mi.hblkhd;
+#else
+    return 0;
+#endif
+}
+
+static std::string key_of(size_t i) {
+    return "user:" + std::to_string(i);
+}
+
+static void append_req(std::string &out, const std::vector<std::string_view> &args) {
+    uint32_t n = (uint32_t)args.size();
+    out.append((const char *)&n, 4);
+    for (std::string_view a : args) {
+        uint32_t sz = (uint32_t)a.size();
+        out.append((const char *)&sz, 4);
+        out.append(a);
+    }
+}
+
+static void report(const char *name, size_t nkeys, size_t bytes, double lookup_ns) {
+    printf("%-24s %8.1f bytes/key  %8.1f ns/lookup\n", name, (double)bytes / nkeys, lookup_ns);
+}
+
+int main(int argc, char **argv) {
+    size_t nkeys = (argc > 1) ? (size_t)atoll(argv[1]) : 1000000;
+    size_t vsize = (argc > 2) ? (size_t)atoll(argv[2]) : 32;
+    std::string val(vsize, 'v');
+    const size_t nlookups = 1000000;
+    std::mt19937_64 rng(42);
+    std::vector<std::string> probes(nlookups);
+    for (std::string &key : probes) {
+        key = key_of(rng() % nkeys);
+    }
+    printf("%zu keys like \"%s\", %zu byte values\n", nkeys, key_of(nkeys - 1).c_str(), vsize);
+    size_t sum = 0;
+
+    {
+        size_t before = heap_used();
+        auto *map = new std::unordered_map<std::string, std::string>();
+        for (size_t i = 0; i < nkeys; i++) {
+            map->emplace(key_of(i), val);
+        }
+        size_t bytes = heap_used() - before;
+        auto t0 = Clock::now();
+        for (const std::string &key : probes) {
+            sum += map->find(key)->second.size();
+        }
+        auto t1 = Clock::now();
+        double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+        report("std::unordered_map", nkeys, bytes, ns / nlookups);
+        delete map;
+    }
+
+    {
+        size_t before = heap_used();
+        Output out;
+        std::string req;
+        for (size_t i = 0; i < nkeys; i++) {
+            std::string key = key_of(i);
+            req.clear();
+            append_req(req, {"set", key, val});
+            (void)Server::do_request((const uint8_t *)req.data(), (uint32_t)req.size(), out);
+            out.consume(out.pending());
+        }
+        // finish the last resize so both sides count a settled table
+        while (Server::keyspaceCron() == 0) {
+        }
+        size_t bytes = heap_used() - before;
+        std::vector<std::string> gets(nlookups);
+        for (size_t i = 0; i < nlookups; i++) {
+            append_req(gets[i], {"get", probes[i]});
+        }
+        auto t0 = Clock::now();
+        for (const std::string &get : gets) {
+            (void)Server::do_request((const uint8_t *)get.data(), (uint32_t)get.size(), out);
+            sum += out.pending();
+            out.consume(out.pending());
+        }
+        auto t1 = Clock::now();
+        double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+        report("keyspace (GET request)", nkeys, bytes, ns / nlookups);
+    }
+    printf("checksum %zu\n", sum);
+    return 0;
+}
@@ -0,0 +1,172 @@
+#include "Server.h"
+#include <chrono>
+#include <random>
+
+// GET scaling under writes: 1, 2, 4 ... reader threads run do_get() while
+// writer threads keep replacing, deleting and adding keys in the same
+// shards, and one of them runs keyspaceCron() the way a reactor would.
+// Every value read is checked against its key, so a reader that saw a
+// freed or half-written entry fails the run.
+// usage: bench_reads [max readers] [writers] [seconds per run] [nkeys]
+
+using Clock = std::chrono::steady_clock;
+
+static std::string key_of(size_t i) {
+    return "key:" + std::to_string(i);
+}
+
+// "<key>#<gen>" padded with the key's last byte, every 16th key past the
+// inline limit so that large values are read by reference
+static std::string value_of(const std::string &key, size_t i, uint64_t gen) {
+    std::string val = key + "#" + std::to_string(gen);
+    val.resize((i % 16 == 0) ? 5000 : 16 + i % 48, key.back());
+    return val;
+}
+
+static bool value_ok(std::string_view key, std::string_view val) {
+    if (val.size() <= key.size() + 1 || val.substr(0, key.size()) != key || val[key.size()] != '#') {
+        return false;
+    }
+    size_t pos = key.size() + 1;
+    while (pos < val.size() && val[pos] >= '0' && val[pos] <= '9') {
+        pos++;
+    }
+    for (; pos < val.size(); pos++) {
+        if (val[pos] != key.back()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// the value do_get() left in out, by copy or by reference
+static std::string_view got_value(const Output &out) {
+    if (!out.refs.empty()) {
+        return *out.refs.back().val;
+    }
+    return std::string_view((const char *)&out.buf.data[out.buf.head], out.buf.pending());
+}
+
+static void reset(Output &out) {
+    out.consume(out.pending());
+    out.refs.clear();
+    out.refHead = 0;
+}
+
+struct Run {
+    double reads = 0;
+    double writes = 0;
+    uint64_t bad = 0;
+};
+
+static Run run(unsigned nreaders, unsigned nwriters, double secs, size_t nkeys) {
+    std::atomic<bool> go(false);
+    std::atomic<bool> stop(false);
+    std::atomic<uint64_t> bad(0);
+    std::vector<uint64_t> reads(nreaders);
+    std::vector<uint64_t> writes(nwriters);
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < nreaders; t++) {
+        threads.emplace_back([&, t]() {
+            std::mt19937_64 rng(t + 1);
+            std::vector<std::string> keys;
+            for (size_t i = 0; i < 4096; i++) {
+                keys.push_back(key_of(rng() % nkeys));
+            }
+            std::vector<std::string_view> cmd = {"get", ""};
+            Output out;
+            while (!go) {}
+            uint64_t n = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                for (size_t i = 0; i < 256; i++) {
+                    cmd[1] = keys[(n + i) & 4095];
+                    uint32_t rescode = Server::do_get(cmd, out);
+                    if (rescode == RES_OK && !value_ok(cmd[1], got_value(out))) {
+                        bad++;
+                    }
+                    reset(out);
+                }
+                n += 256;
+            }
+            reads[t] = n;
+        });
+    }
+    for (unsigned t = 0; t < nwriters; t++) {
+        threads.emplace_back([&, t]() {
+            std::mt19937_64 rng(1000 + t);
+            Output out;
+            uint64_t gen = 0;
+            size_t grown = 0;
+            while (!go) {}
+            uint64_t n = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                for (size_t i = 0; i < 256; i++) {
+                    size_t k = rng() % nkeys;
+                    std::string key = key_of(k);
+                    std::string val = value_of(key, k, ++gen);
+                    if (rng() % 8 == 0) {
+                        // a miss for the readers until the next SET
+                        Server::do_del({"del", key}, out);
+                    } else {
+                        Server::do_set({"set", key, val}, out);
+                    }
+                    if (rng() % 4 == 0) {
+                        // keys no reader asks for, to keep the tables resizing
+                        key = "grow:" + std::to_string(t) + ":" + std::to_string(grown++);
+                        Server::do_set({"set", key, "x"}, out);
+                    }
+                    reset(out);
+                }
+                n += 256;
+                if (t == 0) {
+                    (void)Server::keyspaceCron();
+                }
+            }
+            writes[t] = n;
+        });
+    }
+    auto t0 = Clock::now();
+    go = true;
+    std::this_thread::sleep_for(std::chrono::duration<double>(secs));
+    stop = true;
+    for (std::thread &th : threads) {
+        th.join();
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - t0).count();
+    Run r;
+    for (uint64_t n : reads) {
+        r.reads += (double)n / elapsed;
+    }
+    for (uint64_t n : writes) {
+        r.writes += (double)n / elapsed;
+    }
+    r.bad = bad;
+    return r;
+}
+
+int main(int argc, char **argv) {
+    unsigned maxReaders = (argc > 1) ? (unsigned)atoi(argv[1]) : std::max(std::thread::hardware_concurrency(), 4u);
+    unsigned nwriters = (argc > 2) ? (unsigned)atoi(argv[2]) : 2;
+    double secs = (argc > 3) ? atof(argv[3]) : 2.0;
+    size_t nkeys = (argc > 4) ? (size_t)atoll(argv[4]) : 100000;
+
+    Output out;
+    for (size_t i = 0; i < nkeys; i++) {
+        std::string key = key_of(i);
+        Server::do_set({"set", key, value_of(key, i, 0)}, out);
+        reset(out);
+    }
+    printf("%u writers, %zu keys, %.1f s per run, %u CPUs\n", nwriters, nkeys, secs,
+           std::thread::hardware_concurrency());
+    printf("%7s %12s %14s %12s %8s\n", "readers", "GET/s", "GET/s/reader", "SET/s", "bad");
+    fflush(stdout);
+    uint64_t bad = 0;
+    for (unsigned nreaders = 1; nreaders <= maxReaders; nreaders *= 2) {
+        Run r = run(nreaders, nwriters, secs, nkeys);
+        printf("%7u %12.0f %14.0f %12.0f %8llu\n", nreaders, r.reads, r.reads / nreaders, r.writes,
+               (unsigned long long)r.bad);
+        fflush(stdout);
+        bad += r.bad;
+    }
+    return bad ? 1 : 0;
+}
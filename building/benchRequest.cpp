@@ -0,0 +1,147 @@
+#include "Server.h"
+#include <chrono>
+#include <new>
+
+// Heap allocations and time per request on the command path: the old
+// std::vector<std::string> parser against the string_view one, then
+// do_request() for GET / SET / DEL, and how long DEL / UNLINK of large
+// values hold up the loop.
+// usage: bench_request [iterations] [zset members]
+
+using Clock = std::chrono::steady_clock;
+
+// every operator new in the process goes through here
+static uint64_t g_allocs = 0;
+
+void *operator new(size_t n) {
+    g_allocs++;
+    void *p = malloc(n ? n : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+static std::string make_req(const std::vector<std::string> &args) {
+    std::string out;
+    uint32_t n = (uint32_t)args.size();
+    out.append((const char *)&n, 4);
+    for (const std::string &a : args) {
+        uint32_t sz = (uint32_t)a.size();
+        out.append((const char *)&sz, 4);
+        out.append(a);
+    }
+    return out;
+}
+
+// the parser as it was: one std::string per argument
+static int32_t parse_copy(const uint8_t *data, size_t len, std::vector<std::string> &out) {
+    if (len < 4) {
+        return -1;
+    }
+    uint32_t n = 0;
+    memcpy(&n, &data[0], 4);
+    size_t pos = 4;
+    while (n--) {
+        if (pos + 4 > len) {
+            return -1;
+        }
+        uint32_t sz = 0;
+        memcpy(&sz, &data[pos], 4);
+        if (pos + 4 + sz > len) {
+            return -1;
+        }
+        out.push_back(std::string((char *)&data[pos + 4], sz));
+        pos += 4 + sz;
+    }
+    return pos == len ? 0 : -1;
+}
+
+template <class F>
+static void run(const char *name, size_t iters, F f) {
+    f();    // warm up reused buffers
+    uint64_t allocs0 = g_allocs;
+    auto t0 = Clock::now();
+    for (size_t i = 0; i < iters; i++) {
+        f();
+    }
+    auto t1 = Clock::now();
+    uint64_t allocs = g_allocs - allocs0;
+    double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+    printf("%-28s %8.1f ns/op  %6.2f allocs/op\n", name, ns / iters, (double)allocs / iters);
+}
+
+int main(int argc, char **argv) {
+    size_t iters = (argc > 1) ? (size_t)atoll(argv[1]) : 1000000;
+
+    // keys and values past the small string buffer, like real ones
+    std::string key = "user:session:000000000042";
+    std::string val(100, 'v');
+    std::string get = make_req({"get", key});
+    std::string set = make_req({"set", key, val});
+    std::string del = make_req({"del", "user:session:missing00000"});
+    std::string miss = make_req({"get", "user:session:missing00000"});
+
+    run("parse vector<string>", iters, [&] {
+        std::vector<std::string> cmd;
+        (void)parse_copy((const uint8_t *)get.data(), get.size(), cmd);
+    });
+    std::vector<std::string_view> views;
+    run("parse vector<string_view>", iters, [&] {
+        views.clear();
+        (void)Server::parseReq((const uint8_t *)get.data(), get.size(), views);
+    });
+
+    // responses are dropped right away, like a connection that flushed
+    Output out;
+    auto request = [&](const std::string &req) {
+        if (Server::do_request((const uint8_t *)req.data(), (uint32_t)req.size(), out)) {
+            abort();
+        }
+        out.consume(out.pending());
+    };
+    run("SET (new key, then update)", iters, [&] { request(set); });
+    run("GET hit", iters, [&] { request(get); });
+    (void)Server::do_request((const uint8_t *)get.data(), (uint32_t)get.size(), out);
+    uint32_t rescode = 0;
+    memcpy(&rescode, &out.buf.data[4], 4);
+    if (rescode != RES_OK || out.pending() != 4 + 4 + val.size()) {
+        fprintf(stderr, "GET returned the wrong value\n");
+        return 1;
+    }
+    out.consume(out.pending());
+    run("GET miss", iters, [&] { request(miss); });
+    run("DEL miss", iters, [&] { request(del); });
+
+    // large values: only the unlink is timed, the lazy free thread frees them
+    size_t members = (argc > 2) ? (size_t)atoll(argv[2]) : 1000000;
+    auto timed = [&](const char *name, const std::string &req) {
+        // let the previous value finish freeing first
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        auto t0 = Clock::now();
+        request(req);
+        auto t1 = Clock::now();
+        double us = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count() / 1000;
+        printf("%-28s %8.1f us\n", name, us);
+    };
+    for (const char *cmd : {"del", "unlink"}) {
+        for (size_t i = 0; i < members; i++) {
+            request(make_req({"zadd", "bigzset", std::to_string(i), "member:" + std::to_string(i)}));
+        }
+        char name[64];
+        snprintf(name, sizeof(name), "%s %zu-member zset", cmd, members);
+        timed(name, make_req({cmd, "bigzset"}));
+        request(make_req({"set", "bigval", std::string(64 << 20, 'v')}));
+        snprintf(name, sizeof(name), "%s 64 MB value", cmd);
+        timed(name, make_req({cmd, "bigval"}));
+    }
+    return 0;
+}
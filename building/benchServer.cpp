@@ -0,0 +1,167 @@
+#include "Server.h"
+#include <benchmark/benchmark.h>
+
+// Google Benchmark suite for the request hot path, no sockets involved:
+// parseReq(), command dispatch in do_request(), GET / SET against keyspaces
+// of different sizes, and whole pipelined batches pushed through
+// tryOneRequest() on a Conn whose rbuf is filled in memory.
+// usage: bench_server [--benchmark_filter=regex] [other benchmark flags]
+
+static std::string make_req(const std::vector<std::string> &args) {
+    std::string out;
+    uint32_t n = (uint32_t)args.size();
+    out.append((const char *)&n, 4);
+    for (const std::string &a : args) {
+        uint32_t sz = (uint32_t)a.size();
+        out.append((const char *)&sz, 4);
+        out.append(a);
+    }
+    return out;
+}
+
+// with the length prefix, the way requests arrive on a connection
+static std::string make_frame(const std::vector<std::string> &args) {
+    std::string req = make_req(args);
+    uint32_t len = (uint32_t)req.size();
+    return std::string((const char *)&len, 4) + req;
+}
+
+static std::string key_of(uint64_t i) {
+    return "key:" + std::to_string(i);
+}
+
+static void request(const std::string &req, Output &out) {
+    if (Server::do_request((const uint8_t *)req.data(), (uint32_t)req.size(), out)) {
+        abort();
+    }
+}
+
+// The keyspace holds key:0 .. key:<n-1> with 16-byte values. Switching
+// sizes deletes the old keys first, so each size is measured on its own.
+static void use_keyspace(uint64_t n) {
+    static uint64_t current = 0;
+    if (n == current) {
+        return;
+    }
+    Output out;
+    for (uint64_t i = 0; i < current; i++) {
+        request(make_req({"del", key_of(i)}), out);
+        out.consume(out.pending());
+    }
+    std::string val(16, 'v');
+    for (uint64_t i = 0; i < n; i++) {
+        request(make_req({"set", key_of(i), val}), out);
+        out.consume(out.pending());
+    }
+    current = n;
+}
+
+// requests over uniformly random keys, cycled through by the benchmarks
+static std::vector<std::string> random_reqs(uint64_t n, const std::vector<std::string> &tail,
+                                            const char *cmd) {
+    std::vector<std::string> reqs;
+    uint64_t x = 88172645463325252ull;
+    for (size_t i = 0; i < 4096; i++) {
+        // xorshift64
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        std::vector<std::string> args = {cmd, key_of(x % n)};
+        args.insert(args.end(), tail.begin(), tail.end());
+        reqs.push_back(make_req(args));
+    }
+    return reqs;
+}
+
+static void BM_ParseReq(benchmark::State &state) {
+    std::vector<std::string> args = {"set"};
+    for (int64_t i = 1; i < state.range(0); i++) {
+        args.push_back(std::string(16, 'a'));
+    }
+    std::string req = make_req(args);
+    std::vector<std::string_view> cmd;
+    for (auto _ : state) {
+        cmd.clear();
+        benchmark::DoNotOptimize(Server::parseReq((const uint8_t *)req.data(), req.size(), cmd));
+        benchmark::DoNotOptimize(cmd.data());
+    }
+    state.SetBytesProcessed((int64_t)state.iterations() * (int64_t)req.size());
+}
+BENCHMARK(BM_ParseReq)->Arg(2)->Arg(3)->Arg(16);
+
+// a miss in an empty keyspace: parsing, the command chain and the reply
+static void BM_Dispatch(benchmark::State &state, const char *name) {
+    use_keyspace(0);
+    std::string cmd = name;
+    std::string req = cmd == "zscore" ? make_req({cmd, "missing", "m"}) : make_req({cmd, "missing"});
+    Output out;
+    for (auto _ : state) {
+        request(req, out);
+        out.consume(out.pending());
+    }
+}
+BENCHMARK_CAPTURE(BM_Dispatch, get, "get");
+BENCHMARK_CAPTURE(BM_Dispatch, ttl, "ttl");
+BENCHMARK_CAPTURE(BM_Dispatch, zscore, "zscore");
+BENCHMARK_CAPTURE(BM_Dispatch, unknown, "nosuchcmd");
+
+static void BM_Get(benchmark::State &state) {
+    uint64_t n = (uint64_t)state.range(0);
+    use_keyspace(n);
+    std::vector<std::string> reqs = random_reqs(n, {}, "get");
+    Output out;
+    size_t i = 0;
+    for (auto _ : state) {
+        request(reqs[i++ & 4095], out);
+        out.consume(out.pending());
+    }
+}
+BENCHMARK(BM_Get)->Arg(1 << 10)->Arg(1 << 16)->Arg(1 << 20);
+
+// overwrites of existing keys with a value of the same size
+static void BM_Set(benchmark::State &state) {
+    uint64_t n = (uint64_t)state.range(0);
+    use_keyspace(n);
+    std::vector<std::string> reqs = random_reqs(n, {std::string(16, 'w')}, "set");
+    Output out;
+    size_t i = 0;
+    for (auto _ : state) {
+        request(reqs[i++ & 4095], out);
+        out.consume(out.pending());
+    }
+}
+BENCHMARK(BM_Set)->Arg(1 << 10)->Arg(1 << 16)->Arg(1 << 20);
+
+// one read's worth of pipelined GET / SET requests (4:1) through
+// tryOneRequest(), then every response dropped like a finished write
+static void BM_ConnPipeline(benchmark::State &state) {
+    size_t depth = (size_t)state.range(0);
+    use_keyspace(1 << 16);
+    std::string batch;
+    std::vector<std::string> gets = random_reqs(1 << 16, {}, "get");
+    for (size_t i = 0; i < depth; i++) {
+        if (i % 5 == 4) {
+            batch += make_frame({"set", key_of(i), std::string(16, 'w')});
+        } else {
+            uint32_t len = (uint32_t)gets[i].size();
+            batch += std::string((const char *)&len, 4) + gets[i];
+        }
+    }
+    Conn *conn = Server::connNew();
+    conn->state = STATE_REQ;
+    for (auto _ : state) {
+        conn->rbuf.append(batch.data(), batch.size());
+        while (Server::tryOneRequest(conn)) {}
+        if (conn->state != STATE_REQ || conn->rbuf.pending()) {
+            state.SkipWithError("request not processed");
+            break;
+        }
+        conn->wbuf.consume(conn->wbuf.pending());
+    }
+    Server::connRelease(conn);
+    Server::connFree(conn);
+    state.SetItemsProcessed((int64_t)state.iterations() * (int64_t)depth);
+}
+BENCHMARK(BM_ConnPipeline)->Arg(1)->Arg(16)->Arg(128);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,118 @@
+#include "Server.h"
+#include <chrono>
+#include <random>
+
+// Lock contention in the keyspace: threads run a GET / SET mix through
+// do_request() against one keyspace split into 1, 4, 16 and 64 shards.
+// Each shard count runs in a child process of its own, the count can only
+// be set while the keyspace is empty.
+// usage: bench_shards [threads] [seconds per run] [set percent] [nkeys]
+
+using Clock = std::chrono::steady_clock;
+
+static std::string key_of(size_t i) {
+    return "key:" + std::to_string(i);
+}
+
+static std::string make_req(const std::vector<std::string_view> &args) {
+    std::string out;
+    uint32_t n = (uint32_t)args.size();
+    out.append((const char *)&n, 4);
+    for (std::string_view a : args) {
+        uint32_t sz = (uint32_t)a.size();
+        out.append((const char *)&sz, 4);
+        out.append(a);
+    }
+    return out;
+}
+
+static void request(const std::string &req, Output &out) {
+    if (Server::do_request((const uint8_t *)req.data(), (uint32_t)req.size(), out)) {
+        abort();
+    }
+    out.consume(out.pending());
+}
+
+static void run(size_t nshards, unsigned nthreads, double secs, unsigned set_pct, size_t nkeys) {
+    Server::setShards(nshards);
+    Output out;
+    std::string val(16, 'v');
+    for (size_t i = 0; i < nkeys; i++) {
+        request(make_req({"set", key_of(i), val}), out);
+    }
+
+    std::atomic<bool> go(false);
+    std::atomic<bool> stop(false);
+    std::vector<uint64_t> done(nthreads);
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < nthreads; t++) {
+        threads.emplace_back([&, t]() {
+            // requests built up front, the loop only cycles through them
+            std::mt19937_64 rng(t + 1);
+            std::vector<std::string> reqs;
+            for (size_t i = 0; i < 4096; i++) {
+                std::string key = key_of(rng() % nkeys);
+                bool set = rng() % 100 < set_pct;
+                reqs.push_back(set ? make_req({"set", key, val}) : make_req({"get", key}));
+            }
+            Output tout;
+            while (!go) {}
+            uint64_t n = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                for (size_t i = 0; i < 256; i++) {
+                    request(reqs[(n + i) & 4095], tout);
+                }
+                n += 256;
+            }
+            done[t] = n;
+        });
+    }
+    auto t0 = Clock::now();
+    go = true;
+    std::this_thread::sleep_for(std::chrono::duration<double>(secs));
+    stop = true;
+    for (std::thread &th : threads) {
+        th.join();
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - t0).count();
+    uint64_t total = 0;
+    uint64_t lo = UINT64_MAX;
+    uint64_t hi = 0;
+    for (uint64_t n : done) {
+        total += n;
+        lo = std::min(lo, n);
+        hi = std::max(hi, n);
+    }
+    printf("%6zu %12.0f %12.0f %10.2f\n", Server::shardCount(), (double)total / elapsed,
+           (double)total / elapsed / nthreads, (double)hi / std::max(lo, (uint64_t)1));
+}
+
+int main(int argc, char **argv) {
+    unsigned nthreads = (argc > 1) ? (unsigned)atoi(argv[1]) : std::max(std::thread::hardware_concurrency(), 4u);
+    double secs = (argc > 2) ? atof(argv[2]) : 2.0;
+    unsigned set_pct = (argc > 3) ? (unsigned)atoi(argv[3]) : 20;
+    size_t nkeys = (argc > 4) ? (size_t)atoll(argv[4]) : 100000;
+    printf("%u threads, %u%% SET, %zu keys, %.1f s per run, %u CPUs\n", nthreads, set_pct, nkeys, secs,
+           std::thread::hardware_concurrency());
+    printf("%6s %12s %12s %10s\n", "shards", "ops/s", "ops/s/thread", "max/min");
+    fflush(stdout);
+    for (size_t nshards : {1, 4, 16, 64}) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork()");
+            return 1;
+        }
+        if (pid == 0) {
+            run(nshards, nthreads, secs, set_pct, nkeys);
+            fflush(stdout);
+            _exit(0);
+        }
+        int status = 0;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "run with %zu shards failed\n", nshards);
+            return 1;
+        }
+    }
+    return 0;
+}
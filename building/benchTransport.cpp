@@ -0,0 +1,129 @@
+#include "Dependencies.h"
+#include <chrono>
+
+// TCP loopback against the unix domain socket, on a server started with
+// both listeners (server --unix path). Round trip: one GET at a time on a
+// single connection. Throughput: the same GETs pipelined depth at a time.
+// usage: bench_transport [requests] [port] [unix path] [depth]
+
+using Clock = std::chrono::steady_clock;
+
+static void die(const char *msg) {
+    fprintf(stderr, "bench_transport: [%d] %s\n", errno, msg);
+    exit(1);
+}
+
+static void read_full(int fd, char *buf, size_t n) {
+    while (n > 0) {
+        ssize_t rv = read(fd, buf, n);
+        if (rv <= 0) {
+            die("read()");
+        }
+        n -= (size_t)rv;
+        buf += rv;
+    }
+}
+
+static void write_all(int fd, const char *buf, size_t n) {
+    while (n > 0) {
+        ssize_t rv = write(fd, buf, n);
+        if (rv <= 0) {
+            die("write()");
+        }
+        n -= (size_t)rv;
+        buf += rv;
+    }
+}
+
+static void read_reply(int fd) {
+    char buf[64];
+    uint32_t len;
+    read_full(fd, (char *)&len, 4);
+    if (len > sizeof(buf)) {
+        die("unexpected reply");
+    }
+    read_full(fd, buf, len);
+}
+
+static int dial_tcp(uint16_t port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (fd < 0 || connect(fd, (const struct sockaddr *)&addr, sizeof(addr))) {
+        die("connect(tcp)");
+    }
+    int val = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val));
+    return fd;
+}
+
+static int dial_unix(const char *path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if (fd < 0 || connect(fd, (const struct sockaddr *)&addr, sizeof(addr))) {
+        die("connect(unix)");
+    }
+    return fd;
+}
+
+static void run(const char *name, int fd, const std::string &req, size_t nreq, size_t depth) {
+    std::vector<uint32_t> lat;
+    lat.reserve(nreq);
+    for (size_t i = 0; i < nreq; i++) {
+        auto t0 = Clock::now();
+        write_all(fd, req.data(), req.size());
+        read_reply(fd);
+        lat.push_back((uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - t0).count());
+    }
+    std::sort(lat.begin(), lat.end());
+
+    std::string batch;
+    for (size_t i = 0; i < depth; i++) {
+        batch += req;
+    }
+    auto t0 = Clock::now();
+    for (size_t done = 0; done < nreq; done += depth) {
+        write_all(fd, batch.data(), batch.size());
+        for (size_t i = 0; i < depth; i++) {
+            read_reply(fd);
+        }
+    }
+    double secs = std::chrono::duration<double>(Clock::now() - t0).count();
+    size_t sent = (nreq + depth - 1) / depth * depth;
+    printf("%-5s round trip p50 %5.1f us  p99 %5.1f us  |  pipelined x%zu %9.0f req/s\n",
+           name, lat[nreq / 2] / 1e3, lat[nreq * 99 / 100] / 1e3, depth, sent / secs);
+}
+
+int main(int argc, char **argv) {
+    size_t nreq = (argc > 1) ? (size_t)atoll(argv[1]) : 100000;
+    uint16_t port = (argc > 2) ? (uint16_t)atoi(argv[2]) : 1234;
+    const char *path = (argc > 3) ? argv[3] : "/tmp/redicpp.sock";
+    size_t depth = (argc > 4) ? (size_t)atoll(argv[4]) : 32;
+    if (nreq == 0 || depth == 0) {
+        die("usage: bench_transport [requests] [port] [unix path] [depth]");
+    }
+
+    // GET of a missing key, answered with an 8-byte header
+    std::string req;
+    uint32_t n = 2;
+    uint32_t len = 4 + 4 + 3 + 4 + 1;
+    req.append((const char *)&len, 4);
+    req.append((const char *)&n, 4);
+    for (std::string_view arg : {std::string_view("get"), std::string_view("k")}) {
+        uint32_t sz = (uint32_t)arg.size();
+        req.append((const char *)&sz, 4);
+        req.append(arg);
+    }
+
+    int tcp = dial_tcp(port);
+    int unx = dial_unix(path);
+    run("tcp", tcp, req, nreq, depth);
+    run("unix", unx, req, nreq, depth);
+    close(tcp);
+    close(unx);
+    return 0;
+}
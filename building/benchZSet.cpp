@@ -0,0 +1,102 @@
+#include "ZSet.h"
+#include <chrono>
+#include <random>
+
+// Sorted set queries on a large set: range by score, offset paging deep
+// into the set, and score lookups, all expected in microseconds.
+// usage: bench_zset [nmembers]
+
+using Clock = std::chrono::steady_clock;
+
+static void report(const char *name, std::vector<uint32_t> &lat) {
+    uint64_t total = 0;
+    for (uint32_t ns : lat) {
+        total += ns;
+    }
+    std::sort(lat.begin(), lat.end());
+    size_t n = lat.size();
+    printf("%-28s avg %8.2f us  p99 %8.2f us  max %8.2f us\n", name,
+           (double)total / n / 1000, lat[n * 99 / 100] / 1000.0, lat[n - 1] / 1000.0);
+}
+
+template <class F>
+static void run(const char *name, size_t iters, F f) {
+    std::vector<uint32_t> lat(iters);
+    for (size_t i = 0; i < iters; i++) {
+        auto t0 = Clock::now();
+        f(i);
+        auto t1 = Clock::now();
+        lat[i] = (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+    }
+    report(name, lat);
+}
+
+int main(int argc, char **argv) {
+    size_t n = (argc > 1) ? (size_t)atoll(argv[1]) : 1000000;
+    const size_t iters = 100000;
+    std::mt19937_64 rng(42);
+    std::uniform_real_distribution<double> dist(0, 1e6);
+
+    ZSet zset;
+    auto t0 = Clock::now();
+    for (size_t i = 0; i < n; i++) {
+        zset.insert("member:" + std::to_string(i), dist(rng));
+    }
+    auto t1 = Clock::now();
+    double ms = (double)std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count();
+    printf("ZADD %zu members            %8.0f ms\n", n, ms);
+
+    // the checksum keeps the loops from being optimized away
+    double sum = 0;
+    std::vector<double> from(iters);
+    std::vector<std::string> names(iters);
+    for (size_t i = 0; i < iters; i++) {
+        from[i] = dist(rng);
+        names[i] = "member:" + std::to_string(rng() % n);
+    }
+    for (size_t count : {10, 100}) {
+        char name[64];
+        snprintf(name, sizeof(name), "ZRANGEBYSCORE %zu members", count);
+        run(name, iters, [&](size_t i) {
+            ZNode *node = zset.seekge(from[i], "");
+            for (size_t k = 0; node && k < count; k++) {
+                sum += node->score;
+                node = ZSet::offset(node, +1);
+            }
+        });
+    }
+    run("ZQUERY offset n/2, limit 10", iters, [&](size_t i) {
+        ZNode *node = ZSet::offset(zset.seekge(0, ""), (int64_t)(n / 2 + i % 1000));
+        for (size_t k = 0; node && k < 10; k++) {
+            sum += node->score;
+            node = ZSet::offset(node, +1);
+        }
+    });
+    run("ZQUERY random offset", iters, [&](size_t i) {
+        ZNode *node = ZSet::offset(zset.seekge(from[i], ""), (int64_t)(rng() % (n / 4)));
+        if (node) {
+            sum += node->score;
+        }
+    });
+    run("ZSCORE", iters, [&](size_t i) {
+        ZNode *node = zset.lookup(names[i]);
+        sum += node ? node->score : 0;
+    });
+    run("ZREM + ZADD", iters, [&](size_t i) {
+        zset.remove(names[i]);
+        zset.insert(names[i], from[i]);
+    });
+    printf("checksum %g, %zu members\n", sum, zset.size());
+
+    // what a DEL would cost the loop without the lazy free thread
+    auto *doomed = new ZSet();
+    for (size_t i = 0; i < n; i++) {
+        doomed->insert("member:" + std::to_string(i), dist(rng));
+    }
+    t0 = Clock::now();
+    delete doomed;
+    t1 = Clock::now();
+    ms = (double)std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count();
+    printf("free %zu members inline     %8.0f ms\n", n, ms);
+    return 0;
+}
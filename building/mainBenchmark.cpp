@@ -0,0 +1,420 @@
+#include "Dependencies.h"
+#include "Histogram.h"
+#include <chrono>
+
+// Load generator for the server. Opens --clients connections spread over
+// --threads threads; every connection sends --pipeline requests at once and
+// waits for all the replies before sending the next batch. A request's
+// latency runs from its batch being sent to its reply arriving. Commands are
+// a GET/SET/DEL mix over keys "key:0" .. "key:<keyspace-1>" picked uniformly.
+
+using Clock = std::chrono::steady_clock;
+
+static const char *k_usage =
+    "usage: redicpp-benchmark [options]\n"
+    "  --host ip            server address (127.0.0.1)\n"
+    "  -p, --port n         server port (1234)\n"
+    "  -s, --unix path      connect to a unix domain socket instead\n"
+    "  -c, --clients n      connections (50)\n"
+    "  -t, --threads n      client threads (1)\n"
+    "  -P, --pipeline n     requests in flight per connection (1)\n"
+    "  -n, --requests n     total requests (100000)\n"
+    "  -r, --keyspace n     distinct keys (10000)\n"
+    "  -d, --value-size n   bytes per SET value (16)\n"
+    "  --mix get:set:del    command weights (80:20:0)\n"
+    "  --prefill            SET every key before the run\n"
+    "  --json               one JSON object on stdout\n";
+
+struct Options {
+    const char *host = "127.0.0.1";
+    uint16_t port = 1234;
+    const char *unixPath = NULL;
+    size_t clients = 50;
+    size_t threads = 1;
+    size_t pipeline = 1;
+    uint64_t requests = 100000;
+    uint64_t keyspace = 10000;
+    size_t valueSize = 16;
+    uint32_t mix[3] = {80, 20, 0};
+    bool prefill = false;
+    bool json = false;
+};
+
+struct Result {
+    Histogram latency;  // ns
+    uint64_t errors = 0;
+};
+
+struct BConn {
+    int fd = -1;
+    std::string out;
+    size_t outPos = 0;
+    std::string in;
+    size_t waiting = 0;  // replies owed for the current batch
+    Clock::time_point sent;
+};
+
+static void die(const char *msg) {
+    fprintf(stderr, "redicpp-benchmark: [%d] %s\n", errno, msg);
+    exit(1);
+}
+
+static void usage(const char *msg) {
+    fprintf(stderr, "redicpp-benchmark: %s\n%s", msg, k_usage);
+    exit(2);
+}
+
+// splitmix64, one generator per thread
+static uint64_t next_rand(uint64_t &state) {
+    uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static void append_cmd(std::string &out, std::initializer_list<std::string_view> args) {
+    uint32_t len = 4;
+    for (std::string_view a : args) {
+        len += 4 + (uint32_t)a.size();
+    }
+    uint32_t n = (uint32_t)args.size();
+    out.append((const char *)&len, 4);
+    out.append((const char *)&n, 4);
+    for (std::string_view a : args) {
+        uint32_t sz = (uint32_t)a.size();
+        out.append((const char *)&sz, 4);
+        out.append(a);
+    }
+}
+
+static void fd_set_nb(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK)) {
+        die("fcntl()");
+    }
+}
+
+static int dial(const Options &opt) {
+    int fd;
+    if (opt.unixPath) {
+        struct sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, opt.unixPath, sizeof(addr.sun_path) - 1);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, (const struct sockaddr *)&addr, sizeof(addr))) {
+            die("connect()");
+        }
+    } else {
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(opt.port);
+        addr.sin_addr.s_addr = inet_addr(opt.host);
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, (const struct sockaddr *)&addr, sizeof(addr))) {
+            die("connect()");
+        }
+        int val = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val));
+    }
+    return fd;
+}
+
+// pops complete replies off c.in, false on a malformed one
+static bool take_replies(BConn &c, Result &res, Clock::time_point now) {
+    size_t pos = 0;
+    uint64_t ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(now - c.sent).count();
+    while (c.in.size() - pos >= 4) {
+        uint32_t len;
+        memcpy(&len, c.in.data() + pos, 4);
+        if (len < 4 || c.waiting == 0) {
+            return false;
+        }
+        if (c.in.size() - pos - 4 < len) {
+            break;
+        }
+        uint32_t code;
+        memcpy(&code, c.in.data() + pos + 4, 4);
+        res.errors += (code == 1);  // RES_ERR
+        res.latency.record(ns);
+        c.waiting--;
+        pos += 4 + len;
+    }
+    c.in.erase(0, pos);
+    return true;
+}
+
+class Worker {
+public:
+    Worker(const Options &opt, size_t nconns, uint64_t nreq, uint64_t seed)
+        : opt(opt), conns(nconns), remaining(nreq), rng(seed) {
+        value.assign(opt.valueSize, 'x');
+    }
+
+    void connectAll() {
+        for (BConn &c : conns) {
+            c.fd = dial(opt);
+            fd_set_nb(c.fd);
+        }
+    }
+
+    void run() {
+        std::vector<struct pollfd> pfds(conns.size());
+        for (BConn &c : conns) {
+            startBatch(c);
+        }
+        char buf[64 * 1024];
+        while (true) {
+            size_t active = 0;
+            for (size_t i = 0; i < conns.size(); i++) {
+                BConn &c = conns[i];
+                pfds[i].fd = c.waiting ? c.fd : -1;
+                pfds[i].events = c.outPos < c.out.size() ? POLLOUT : POLLIN;
+                pfds[i].revents = 0;
+                active += c.waiting > 0;
+            }
+            if (active == 0) {
+                break;
+            }
+            if (poll(pfds.data(), pfds.size(), 5000) <= 0) {
+                die("poll(), server stopped answering");
+            }
+            for (size_t i = 0; i < conns.size(); i++) {
+                BConn &c = conns[i];
+                if (!pfds[i].revents) {
+                    continue;
+                }
+                if (c.outPos < c.out.size()) {
+                    flush(c);
+                    continue;
+                }
+                ssize_t rv = read(c.fd, buf, sizeof(buf));
+                if (rv < 0 && errno == EAGAIN) {
+                    continue;
+                }
+                if (rv <= 0) {
+                    die("read(), connection closed");
+                }
+                c.in.append(buf, (size_t)rv);
+                if (!take_replies(c, res, Clock::now())) {
+                    die("malformed reply");
+                }
+                if (c.waiting == 0) {
+                    startBatch(c);
+                }
+            }
+        }
+        for (BConn &c : conns) {
+            close(c.fd);
+        }
+    }
+
+    Result res;
+
+private:
+    void nextCommand(std::string &out) {
+        char kbuf[32];
+        uint64_t r = next_rand(rng);
+        int klen = snprintf(kbuf, sizeof(kbuf), "key:%llu", (unsigned long long)(r % opt.keyspace));
+        std::string_view k(kbuf, (size_t)klen);
+        uint32_t pick = (uint32_t)(next_rand(rng) % (opt.mix[0] + opt.mix[1] + opt.mix[2]));
+        if (pick < opt.mix[0]) {
+            append_cmd(out, {"get", k});
+        } else if (pick < opt.mix[0] + opt.mix[1]) {
+            append_cmd(out, {"set", k, value});
+        } else {
+            append_cmd(out, {"del", k});
+        }
+    }
+
+    void startBatch(BConn &c) {
+        size_t k = (size_t)std::min<uint64_t>(opt.pipeline, remaining);
+        if (k == 0) {
+            return;
+        }
+        remaining -= k;
+        c.out.clear();
+        c.outPos = 0;
+        for (size_t i = 0; i < k; i++) {
+            nextCommand(c.out);
+        }
+        c.waiting = k;
+        c.sent = Clock::now();
+        flush(c);
+    }
+
+    static void flush(BConn &c) {
+        while (c.outPos < c.out.size()) {
+            ssize_t rv = write(c.fd, c.out.data() + c.outPos, c.out.size() - c.outPos);
+            if (rv < 0 && errno == EAGAIN) {
+                return;
+            }
+            if (rv <= 0) {
+                die("write()");
+            }
+            c.outPos += (size_t)rv;
+        }
+    }
+
+    const Options &opt;
+    std::vector<BConn> conns;
+    uint64_t remaining;
+    uint64_t rng;
+    std::string value;
+};
+
+// SET every key over one blocking connection, 256 requests per batch
+static void prefill(const Options &opt) {
+    int fd = dial(opt);
+    std::string value(opt.valueSize, 'x');
+    std::string out;
+    char buf[64 * 1024];
+    for (uint64_t k = 0; k < opt.keyspace;) {
+        out.clear();
+        size_t batch = 0;
+        for (; batch < 256 && k < opt.keyspace; batch++, k++) {
+            std::string key = "key:" + std::to_string(k);
+            append_cmd(out, {"set", key, value});
+        }
+        if (write(fd, out.data(), out.size()) != (ssize_t)out.size()) {
+            die("write()");
+        }
+        BConn c;
+        c.waiting = batch;
+        Result ignored;
+        while (c.waiting) {
+            ssize_t rv = read(fd, buf, sizeof(buf));
+            if (rv <= 0) {
+                die("read(), connection closed");
+            }
+            c.in.append(buf, (size_t)rv);
+            if (!take_replies(c, ignored, Clock::now())) {
+                die("malformed reply");
+            }
+        }
+    }
+    close(fd);
+}
+
+static uint64_t parse_num(const char *s, const char *what) {
+    char *end = NULL;
+    errno = 0;
+    unsigned long long v = strtoull(s, &end, 10);
+    if (errno || end == s || *end) {
+        usage(what);
+    }
+    return (uint64_t)v;
+}
+
+static Options parse_args(int argc, char **argv) {
+    Options opt;
+    for (int i = 1; i < argc; i++) {
+        std::string_view a = argv[i];
+        bool hasArg = i + 1 < argc;
+        auto is = [&](const char *s, const char *l) {
+            return (s && a == s) || a == l;
+        };
+        if (is(NULL, "--prefill")) {
+            opt.prefill = true;
+        } else if (is(NULL, "--json")) {
+            opt.json = true;
+        } else if (is("-h", "--help")) {
+            fputs(k_usage, stdout);
+            exit(0);
+        } else if (!hasArg) {
+            usage("missing or unknown option");
+        } else if (is(NULL, "--host")) {
+            opt.host = argv[++i];
+        } else if (is("-p", "--port")) {
+            opt.port = (uint16_t)parse_num(argv[++i], "bad port");
+        } else if (is("-s", "--unix")) {
+            opt.unixPath = argv[++i];
+        } else if (is("-c", "--clients")) {
+            opt.clients = (size_t)parse_num(argv[++i], "bad client count");
+        } else if (is("-t", "--threads")) {
+            opt.threads = (size_t)parse_num(argv[++i], "bad thread count");
+        } else if (is("-P", "--pipeline")) {
+            opt.pipeline = (size_t)parse_num(argv[++i], "bad pipeline depth");
+        } else if (is("-n", "--requests")) {
+            opt.requests = parse_num(argv[++i], "bad request count");
+        } else if (is("-r", "--keyspace")) {
+            opt.keyspace = parse_num(argv[++i], "bad keyspace size");
+        } else if (is("-d", "--value-size")) {
+            opt.valueSize = (size_t)parse_num(argv[++i], "bad value size");
+        } else if (is(NULL, "--mix")) {
+            if (sscanf(argv[++i], "%u:%u:%u", &opt.mix[0], &opt.mix[1], &opt.mix[2]) != 3) {
+                usage("bad mix");
+            }
+        } else {
+            usage("unknown option");
+        }
+    }
+    if (!opt.clients || !opt.threads || !opt.pipeline || !opt.keyspace || !opt.requests) {
+        usage("counts must be positive");
+    }
+    if (opt.mix[0] + opt.mix[1] + opt.mix[2] == 0) {
+        usage("bad mix");
+    }
+    opt.threads = std::min(opt.threads, opt.clients);
+    return opt;
+}
+
+int main(int argc, char **argv) {
+    Options opt = parse_args(argc, argv);
+    if (opt.prefill) {
+        prefill(opt);
+    }
+
+    // connections and requests split evenly over the threads
+    std::vector<std::unique_ptr<Worker>> workers;
+    uint64_t reqLeft = opt.requests;
+    for (size_t t = 0; t < opt.threads; t++) {
+        size_t nconns = opt.clients / opt.threads + (t < opt.clients % opt.threads);
+        uint64_t nreq = (t + 1 == opt.threads) ? reqLeft : opt.requests * nconns / opt.clients;
+        reqLeft -= nreq;
+        workers.emplace_back(new Worker(opt, nconns, nreq, 0x5eed + t));
+        workers.back()->connectAll();
+    }
+
+    auto t0 = Clock::now();
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < workers.size(); t++) {
+        threads.emplace_back([&workers, t] { workers[t]->run(); });
+    }
+    workers[0]->run();
+    for (std::thread &th : threads) {
+        th.join();
+    }
+    double secs = std::chrono::duration<double>(Clock::now() - t0).count();
+
+    Result total;
+    for (auto &w : workers) {
+        total.latency.merge(w->res.latency);
+        total.errors += w->res.errors;
+    }
+    const Histogram &h = total.latency;
+    double ops = (double)h.count() / secs;
+    auto us = [](uint64_t ns) { return (double)ns / 1e3; };
+
+    if (opt.json) {
+        printf("{\"requests\":%llu,\"clients\":%zu,\"threads\":%zu,\"pipeline\":%zu,"
+               "\"keyspace\":%llu,\"value_size\":%zu,\"mix\":[%u,%u,%u],"
+               "\"seconds\":%.6f,\"ops_per_sec\":%.1f,\"errors\":%llu,"
+               "\"latency_us\":{\"min\":%.3f,\"mean\":%.3f,\"p50\":%.3f,\"p99\":%.3f,"
+               "\"p99.9\":%.3f,\"max\":%.3f}}\n",
+               (unsigned long long)h.count(), opt.clients, opt.threads, opt.pipeline,
+               (unsigned long long)opt.keyspace, opt.valueSize, opt.mix[0], opt.mix[1], opt.mix[2],
+               secs, ops, (unsigned long long)total.errors,
+               us(h.min()), h.mean() / 1e3, us(h.percentile(50)), us(h.percentile(99)),
+               us(h.percentile(99.9)), us(h.max()));
+        return 0;
+    }
+    printf("%llu requests, %zu connections, %zu threads, pipeline %zu\n",
+           (unsigned long long)h.count(), opt.clients, opt.threads, opt.pipeline);
+    printf("mix get:set:del %u:%u:%u, %llu keys, %zu byte values\n",
+           opt.mix[0], opt.mix[1], opt.mix[2], (unsigned long long)opt.keyspace, opt.valueSize);
+    printf("%.0f ops/s in %.3f s, %llu errors\n", ops, secs, (unsigned long long)total.errors);
+    printf("latency us: p50 %.1f  p99 %.1f  p99.9 %.1f  max %.1f  (mean %.1f)\n",
+           us(h.percentile(50)), us(h.percentile(99)), us(h.percentile(99.9)), us(h.max()),
+           h.mean() / 1e3);
+    return 0;
+}
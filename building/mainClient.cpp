@@ -1,9 +1,18 @@
 #include "Client.h"
 
+// usage: client [--unix path] cmd...
 int main(int argc, char **argv) {
-    Client client(1234, "127.0.0.1");
+    int i = 1;
+    std::unique_ptr<Client> conn;
+    if (argc > 2 && strcmp(argv[1], "--unix") == 0) {
+        conn.reset(new Client(argv[2]));
+        i = 3;
+    } else {
+        conn.reset(new Client(1234, "127.0.0.1"));
+    }
+    Client &client = *conn;
     std::vector<std::string> cmd;
-    for (int i = 1; i < argc; ++i) {
+    for (; i < argc; ++i) {
         cmd.push_back(argv[i]);
     }
     int32_t err = client.sendRequest(client.getFd(), cmd);
@@ -1,7 +1,75 @@
 #include "Server.h"
 
-int main() {
-    Server server(1234);
+// usage: server [nthreads] [--io-uring] [--wbuf-high-water bytes] [--max-msg bytes] [--idle-timeout ms]
+//               [--unix path] [--no-tcp] [--snapshot path]
+//               [--appendonly path] [--appendfsync always|everysec|no] [--shards n]
+//               [--log path|-] [--log-level debug|info|warn|error]
+//               [--slowlog-slower-than us] [--slowlog-max-len n]
+int main(int argc, char **argv) {
+    unsigned nthreads = 1;
+    bool ioUring = false;
+    const char *unixPath = NULL;
+    uint16_t port = 1234;
+    const char *aofPath = NULL;
+    AppendLog::Fsync aofFsync = AppendLog::FSYNC_EVERYSEC;
+    const char *logPath = NULL;
+    LogLevel logLevel = LOG_INFO;
+    int64_t slowlogUs = 10000;
+    size_t slowlogLen = 128;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--io-uring") == 0) {
+            ioUring = true;
+        } else if (strcmp(argv[i], "--wbuf-high-water") == 0 && i + 1 < argc) {
+            Server::setWbufHighWater((size_t)atoll(argv[++i]));
+        } else if (strcmp(argv[i], "--max-msg") == 0 && i + 1 < argc) {
+            Server::setMaxMsg((size_t)atoll(argv[++i]));
+        } else if (strcmp(argv[i], "--idle-timeout") == 0 && i + 1 < argc) {
+            Server::setIdleTimeout((uint64_t)atoll(argv[++i]));
+        } else if (strcmp(argv[i], "--unix") == 0 && i + 1 < argc) {
+            unixPath = argv[++i];
+        } else if (strcmp(argv[i], "--no-tcp") == 0) {
+            port = 0;
+        } else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) {
+            Server::setSnapshotPath(argv[++i]);
+        } else if (strcmp(argv[i], "--shards") == 0 && i + 1 < argc) {
+            Server::setShards((size_t)std::max(atoi(argv[++i]), 1));
+        } else if (strcmp(argv[i], "--appendonly") == 0 && i + 1 < argc) {
+            aofPath = argv[++i];
+        } else if (strcmp(argv[i], "--appendfsync") == 0 && i + 1 < argc) {
+            if (!AppendLog::parseFsync(argv[++i], aofFsync)) {
+                fprintf(stderr, "--appendfsync: always, everysec or no\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--slowlog-slower-than") == 0 && i + 1 < argc) {
+            slowlogUs = atoll(argv[++i]);
+        } else if (strcmp(argv[i], "--slowlog-max-len") == 0 && i + 1 < argc) {
+            slowlogLen = (size_t)std::max(atoll(argv[++i]), 0LL);
+        } else if (strcmp(argv[i], "--log") == 0 && i + 1 < argc) {
+            logPath = argv[++i];
+        } else if (strcmp(argv[i], "--log-level") == 0 && i + 1 < argc) {
+            if (!Log::parseLevel(argv[++i], logLevel)) {
+                fprintf(stderr, "--log-level: debug, info, warn or error\n");
+                return 1;
+            }
+        } else {
+            nthreads = (unsigned)atoi(argv[i]);
+        }
+    }
+    Server::setSlowlog(slowlogUs, slowlogLen);
+    if (logPath && !Log::open(logPath, logLevel)) {
+        perror(logPath);
+        return 1;
+    }
+    // before listening: clients only ever see the whole keyspace. The log
+    // has every change, so with it on the snapshot is not read.
+    if (aofPath ? !Server::openAppendLog(aofPath, aofFsync) : !Server::loadSnapshot()) {
+        // the reason is in the log, written out by close()
+        Log::close();
+        return 1;
+    }
+    Server server(port, nthreads, unixPath);
+    server.useIoUring(ioUring);
     server.run();
+    Log::close();
     return 0;
 }
\ No newline at end of file
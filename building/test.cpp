@@ -0,0 +1,972 @@
+#include "Server.h"
+#include <gtest/gtest.h>
+#include <random>
+
+// A request through Server::do_request(): the status and the payload
+static std::pair<uint32_t, std::string> request(const std::vector<std::string_view> &args) {
+    std::string req;
+    uint32_t n = (uint32_t)args.size();
+    req.append((const char *)&n, 4);
+    for (std::string_view a : args) {
+        uint32_t sz = (uint32_t)a.size();
+        req.append((const char *)&sz, 4);
+        req.append(a);
+    }
+    Output out;
+    EXPECT_EQ(Server::do_request((const uint8_t *)req.data(), (uint32_t)req.size(), out), 0);
+    // large values are queued by reference, collect them in order
+    std::string res;
+    struct iovec iov[64];
+    int niov = out.iov(iov, 64);
+    for (int i = 0; i < niov; i++) {
+        res.append((const char *)iov[i].iov_base, iov[i].iov_len);
+    }
+    uint32_t code = 0;
+    memcpy(&code, &res[4], 4);
+    return {code, res.substr(8)};
+}
+
+// the path this binary was run by, to run it again
+static const char *g_argv0 = "./tests";
+
+// Tests that load files into the keyspace need it empty, and the other
+// tests leave keys behind. Outside a fresh process this reruns the
+// current test in a new process of this binary, which prints its results
+// as usual, and returns false; in that new process it returns true.
+static bool fresh_process() {
+    if (getenv("REDICPP_TEST_FRESH")) {
+        return true;
+    }
+    const ::testing::TestInfo *test = ::testing::UnitTest::GetInstance()->current_test_info();
+    std::string filter = std::string("--gtest_filter=") + test->test_suite_name() + "." + test->name();
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid == 0) {
+        setenv("REDICPP_TEST_FRESH", "1", 1);
+        execlp(g_argv0, g_argv0, filter.c_str(), (char *)NULL);
+        _exit(127);
+    }
+    int status = 0;
+    EXPECT_GT(pid, 0);
+    EXPECT_EQ(waitpid(pid, &status, 0), pid);
+    EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0) << "failed in its own process, see above";
+    return false;
+}
+
+// A directory of its own for files a test writes, removed with them
+struct TempDir {
+    std::string path;
+    TempDir() {
+        char tmpl[] = "/tmp/redicpp-test-XXXXXX";
+        path = mkdtemp(tmpl) ? tmpl : "";
+    }
+    ~TempDir() {
+        if (!path.empty()) {
+            (void)system(("rm -rf " + path).c_str());
+        }
+    }
+};
+
+static std::string read_file(const std::string &path) {
+    std::string data;
+    FILE *f = fopen(path.c_str(), "rb");
+    if (f) {
+        char buf[65536];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+            data.append(buf, n);
+        }
+        fclose(f);
+    }
+    return data;
+}
+
+static void write_file(const std::string &path, std::string_view data) {
+    FILE *f = fopen(path.c_str(), "wb");
+    ASSERT_NE(f, nullptr) << path;
+    ASSERT_EQ(fwrite(data.data(), 1, data.size(), f), data.size());
+    fclose(f);
+}
+
+// Tests of the files the keyspace is saved to and loaded from. The body
+// runs in a fresh process (see fresh_process()); here it is reported as
+// skipped once that process is done. Files go in a directory of their own.
+class FileTest : public ::testing::Test {
+protected:
+    TempDir dir;
+
+    void SetUp() override {
+        if (!fresh_process()) {
+            GTEST_SKIP() << "ran in a process of its own, see above";
+        }
+    }
+};
+
+// An array payload: a count, then length-prefixed strings
+static std::vector<std::string> array_of(const std::string &data) {
+    std::vector<std::string> items;
+    uint32_t n = 0;
+    memcpy(&n, data.data(), 4);
+    size_t pos = 4;
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t len = 0;
+        memcpy(&len, &data[pos], 4);
+        items.push_back(data.substr(pos + 4, len));
+        pos += 4 + len;
+    }
+    EXPECT_EQ(pos, data.size());
+    return items;
+}
+
+// HMap: keys are ints, hcodes mixed from them so that they spread
+struct IntNode : public HNode {
+    uint64_t key = 0;
+};
+
+static uint64_t int_hash(uint64_t key) {
+    return str_hash((const uint8_t *)&key, sizeof(key));
+}
+
+static IntNode *int_lookup(const HMap &map, uint64_t key) {
+    return static_cast<IntNode *>(map.lookup(int_hash(key), [&](HNode *node) {
+        return static_cast<IntNode *>(node)->key == key;
+    }));
+}
+
+static IntNode *int_remove(HMap &map, uint64_t key) {
+    return static_cast<IntNode *>(map.remove(int_hash(key), [&](HNode *node) {
+        return static_cast<IntNode *>(node)->key == key;
+    }));
+}
+
+static std::vector<std::unique_ptr<IntNode>> int_nodes(size_t n) {
+    std::vector<std::unique_ptr<IntNode>> nodes;
+    for (size_t i = 0; i < n; i++) {
+        nodes.emplace_back(new IntNode());
+        nodes.back()->key = i;
+        nodes.back()->hcode = int_hash(i);
+    }
+    return nodes;
+}
+
+TEST(HMapTest, InsertRemoveLookupWhileRehashing) {
+    const size_t n = 20000;
+    auto nodes = int_nodes(n);
+    HMap map;
+    std::vector<bool> present(n, false);
+    size_t checkedMidRehash = 0;
+    std::mt19937_64 rng(1);
+    for (size_t i = 0; i < n; i++) {
+        map.insert(nodes[i].get());
+        present[i] = true;
+        // remove some of the keys inserted so far, often mid-resize
+        if (i % 3 == 0) {
+            uint64_t victim = rng() % (i + 1);
+            IntNode *node = int_remove(map, victim);
+            EXPECT_EQ(node != NULL, (bool)present[victim]) << victim;
+            EXPECT_TRUE(!node || node->key == victim);
+            present[victim] = false;
+        }
+        if (map.rehashing() && i % 97 == 0) {
+            // both tables hold keys now, every one of them still found
+            for (size_t k = 0; k <= i; k++) {
+                ASSERT_EQ(int_lookup(map, k) != NULL, (bool)present[k]) << k;
+            }
+            checkedMidRehash++;
+        }
+    }
+    EXPECT_GT(checkedMidRehash, 0u);
+    size_t expected = (size_t)std::count(present.begin(), present.end(), true);
+    EXPECT_EQ(map.size(), expected);
+
+    // no writes left: rehashStep() alone finishes the resize
+    while (map.rehashing()) {
+        map.rehashStep();
+    }
+    EXPECT_EQ(map.size(), expected);
+    size_t seen = 0;
+    map.forEach([&](HNode *node) {
+        EXPECT_TRUE(present[static_cast<IntNode *>(node)->key]);
+        seen++;
+    });
+    EXPECT_EQ(seen, expected);
+    for (size_t k = 0; k < n; k++) {
+        EXPECT_EQ(int_lookup(map, k) != NULL, (bool)present[k]) << k;
+    }
+}
+
+TEST(HMapTest, ReplaceKeepsTheChain) {
+    auto nodes = int_nodes(1000);
+    HMap map;
+    for (auto &node : nodes) {
+        map.insert(node.get());
+    }
+    IntNode with;
+    with.key = 500;
+    with.hcode = int_hash(500);
+    map.replace(nodes[500].get(), &with);
+    EXPECT_EQ(int_lookup(map, 500), &with);
+    EXPECT_EQ(map.size(), 1000u);
+    for (size_t k = 0; k < 1000; k++) {
+        EXPECT_NE(int_lookup(map, k), nullptr) << k;
+    }
+}
+
+TEST(HMapTest, ReserveAvoidsResizing) {
+    const size_t n = 50000;
+    auto nodes = int_nodes(n);
+    HMap map;
+    map.reserve(n);
+    size_t buckets = map.buckets();
+    EXPECT_GE(buckets * HMap::k_max_load_factor, n);
+    for (auto &node : nodes) {
+        map.insert(node.get());
+        ASSERT_FALSE(map.rehashing());
+    }
+    EXPECT_EQ(map.buckets(), buckets);
+    EXPECT_EQ(map.size(), n);
+
+    // a table that holds nodes is not resized by reserve()
+    map.reserve(4 * n);
+    EXPECT_EQ(map.buckets(), buckets);
+    for (size_t k = 0; k < n; k += 101) {
+        EXPECT_NE(int_lookup(map, k), nullptr) << k;
+    }
+}
+
+// A node moves from the old table to the new one behind a reader: the
+// reader is past it in the new table's bucket when the resize completes,
+// and the old table is gone by the time it looks there. That lookup must
+// not claim a miss. Driven from eq() on a node sharing the hcode, so the
+// interleaving is exact and needs no threads.
+TEST(HMapTest, LookupSharedDoesNotTrustAMissDuringAMove) {
+    size_t unsure = 0;
+    for (uint64_t target = 0; target < 64; target++) {
+        auto nodes = int_nodes(4096);
+        HMap map;
+        // a resize large enough that one step does not finish it
+        size_t n = 0;
+        while (!(map.rehashing() && map.size() >= 1000)) {
+            map.insert(nodes[n++].get());
+        }
+        IntNode decoy;
+        decoy.key = UINT64_MAX;
+        decoy.hcode = nodes[target]->hcode;
+        map.insert(&decoy);
+        ASSERT_TRUE(map.rehashing());
+        HNode *out = NULL;
+        bool sure = map.lookupShared(decoy.hcode, [&](HNode *node) {
+            if (node == &decoy) {
+                while (map.rehashing()) {
+                    map.rehashStep();
+                }
+                return false;
+            }
+            return node == nodes[target].get();
+        }, out);
+        if (sure) {
+            EXPECT_EQ(out, nodes[target].get()) << target;
+        } else {
+            unsure++;
+        }
+    }
+    // most targets were still in the old table
+    EXPECT_GT(unsure, 0u);
+}
+
+// Readers with no lock look up keys that are in the map all along while
+// the writer's inserts keep moving them between tables. A lookup may give
+// up (false), but one that claims a result must have found the key.
+TEST(HMapTest, LookupSharedNeverMissesAMovingKey) {
+    const size_t nstable = 2000;
+    const size_t nadded = 400000;
+    auto nodes = int_nodes(nstable + nadded);
+    // bucket arrays freed at the end only, readers may still be on them
+    // (the writer is the only thread that retires)
+    std::vector<void *> retired;
+    HMap map;
+    map.setTableRetire([](void *ctx, void *mem) { ((std::vector<void *> *)ctx)->push_back(mem); },
+                       &retired);
+    for (size_t i = 0; i < nstable; i++) {
+        map.insert(nodes[i].get());
+    }
+
+    std::atomic<bool> stop(false);
+    std::atomic<uint64_t> wrongMisses(0), found(0), retries(0);
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 2; t++) {
+        readers.emplace_back([&, t]() {
+            std::mt19937_64 rng(t + 1);
+            while (!stop.load(std::memory_order_relaxed)) {
+                uint64_t key = rng() % nstable;
+                HNode *out = NULL;
+                bool sure = map.lookupShared(int_hash(key), [&](HNode *node) {
+                    return static_cast<IntNode *>(node)->key == key;
+                }, out);
+                if (!sure) {
+                    retries++;
+                } else if (!out || static_cast<IntNode *>(out)->key != key) {
+                    wrongMisses++;
+                } else {
+                    found++;
+                }
+            }
+        });
+    }
+    size_t resizes = 0;
+    for (size_t i = nstable; i < nstable + nadded; i++) {
+        bool was = map.rehashing();
+        map.insert(nodes[i].get());
+        resizes += !was && map.rehashing();
+    }
+    stop = true;
+    for (std::thread &th : readers) {
+        th.join();
+    }
+    EXPECT_GT(resizes, 5u);
+    EXPECT_GT(found.load(), 0u);
+    EXPECT_EQ(wrongMisses.load(), 0u);
+
+    // an absent key is a sure miss once nothing moves
+    while (map.rehashing()) {
+        map.rehashStep();
+    }
+    HNode *out = nodes[0].get();
+    uint64_t absent = nstable + nadded + 1;
+    EXPECT_TRUE(map.lookupShared(int_hash(absent), [&](HNode *node) {
+        return static_cast<IntNode *>(node)->key == absent;
+    }, out));
+    EXPECT_EQ(out, nullptr);
+    for (void *mem : retired) {
+        free(mem);
+    }
+}
+
+// AVL: nodes hold ints, linked the way ZSet links them (ties to the right)
+struct IntAVL : public AVLNode {
+    uint32_t val = 0;
+};
+
+static AVLNode *avl_insert(AVLNode *root, IntAVL *node) {
+    AVLNode *parent = NULL;
+    AVLNode **from = &root;
+    while (*from) {
+        parent = *from;
+        from = node->val < static_cast<IntAVL *>(parent)->val ? &parent->left : &parent->right;
+    }
+    *from = node;
+    node->parent = parent;
+    return avl_fix(node);
+}
+
+// Every invariant of the subtree: parent links, heights, balance and
+// counts. Appends the nodes in order, returns the count.
+static uint32_t avl_verify(const AVLNode *node, const AVLNode *parent, std::vector<const IntAVL *> &inorder) {
+    if (!node) {
+        return 0;
+    }
+    EXPECT_EQ(node->parent, parent);
+    uint32_t l = avl_verify(node->left, node, inorder);
+    inorder.push_back(static_cast<const IntAVL *>(node));
+    uint32_t r = avl_verify(node->right, node, inorder);
+    uint32_t hl = avl_height(node->left);
+    uint32_t hr = avl_height(node->right);
+    EXPECT_EQ(node->height, 1 + std::max(hl, hr));
+    EXPECT_LE(std::max(hl, hr) - std::min(hl, hr), 1u);
+    EXPECT_EQ(node->cnt, 1 + l + r);
+    return 1 + l + r;
+}
+
+// position in sort order, from the subtree counts
+static uint32_t avl_rank(const AVLNode *node) {
+    uint32_t rank = avl_cnt(node->left);
+    for (; node->parent; node = node->parent) {
+        if (node->parent->right == node) {
+            rank += avl_cnt(node->parent->left) + 1;
+        }
+    }
+    return rank;
+}
+
+static void avl_check(const AVLNode *root, std::multiset<uint32_t> &model) {
+    std::vector<const IntAVL *> inorder;
+    EXPECT_EQ(avl_verify(root, NULL, inorder), model.size());
+    ASSERT_EQ(inorder.size(), model.size());
+    size_t i = 0;
+    for (uint32_t val : model) {
+        EXPECT_EQ(inorder[i]->val, val) << i;
+        EXPECT_EQ(avl_rank(inorder[i]), i);
+        i++;
+    }
+    // a height of at most 1.44 log2(n + 2) is what AVL balance allows
+    if (root) {
+        EXPECT_LE(root->height, 1.45 * std::log2(model.size() + 2));
+    }
+}
+
+TEST(AVLTest, InvariantsUnderRandomInsertAndDelete) {
+    std::mt19937 rng(7);
+    std::vector<std::unique_ptr<IntAVL>> live;
+    std::multiset<uint32_t> model;
+    AVLNode *root = NULL;
+    for (int op = 0; op < 4000; op++) {
+        // grows on the whole, with runs of deletes; values repeat
+        if (live.empty() || rng() % 3 != 0) {
+            live.emplace_back(new IntAVL());
+            live.back()->val = rng() % 500;
+            model.insert(live.back()->val);
+            root = avl_insert(root, live.back().get());
+        } else {
+            size_t i = rng() % live.size();
+            model.erase(model.find(live[i]->val));
+            root = avl_del(live[i].get());
+            std::swap(live[i], live.back());
+            live.pop_back();
+        }
+        if (op % 50 == 0) {
+            avl_check(root, model);
+        }
+    }
+    avl_check(root, model);
+    while (!live.empty()) {
+        model.erase(model.find(live.back()->val));
+        root = avl_del(live.back().get());
+        live.pop_back();
+        if (live.size() % 100 == 0) {
+            avl_check(root, model);
+        }
+    }
+    EXPECT_EQ(root, nullptr);
+}
+
+TEST(AVLTest, SortedInsertsStayBalanced) {
+    // the worst case for an unbalanced tree, every insert rotates
+    std::vector<std::unique_ptr<IntAVL>> nodes;
+    std::multiset<uint32_t> model;
+    AVLNode *root = NULL;
+    for (uint32_t i = 0; i < 1000; i++) {
+        nodes.emplace_back(new IntAVL());
+        nodes.back()->val = i;
+        model.insert(i);
+        root = avl_insert(root, nodes.back().get());
+    }
+    avl_check(root, model);
+    for (uint32_t i = 2000; i-- > 1000;) {
+        nodes.emplace_back(new IntAVL());
+        nodes.back()->val = i;
+        model.insert(i);
+        root = avl_insert(root, nodes.back().get());
+    }
+    avl_check(root, model);
+}
+
+TEST(AVLTest, OffsetFromAnyNode) {
+    std::mt19937 rng(11);
+    std::vector<std::unique_ptr<IntAVL>> nodes;
+    AVLNode *root = NULL;
+    for (uint32_t i = 0; i < 300; i++) {
+        nodes.emplace_back(new IntAVL());
+        nodes.back()->val = rng() % 1000;
+        root = avl_insert(root, nodes.back().get());
+    }
+    std::vector<const IntAVL *> inorder;
+    avl_verify(root, NULL, inorder);
+    int64_t n = (int64_t)inorder.size();
+    for (int64_t from = 0; from < n; from++) {
+        AVLNode *start = (AVLNode *)inorder[from];
+        for (int64_t to = -3; to < n + 3; to++) {
+            AVLNode *got = avl_offset(start, to - from);
+            if (to < 0 || to >= n) {
+                EXPECT_EQ(got, nullptr) << from << " " << to;
+            } else {
+                EXPECT_EQ(got, (AVLNode *)inorder[to]) << from << " " << to;
+            }
+        }
+    }
+}
+
+// members in sort order, walked with offset +1
+static std::vector<std::pair<double, std::string>> zset_items(const ZSet &zset) {
+    std::vector<std::pair<double, std::string>> items;
+    for (ZNode *node = zset.seekge(-INFINITY, ""); node; node = ZSet::offset(node, +1)) {
+        items.emplace_back(node->score, node->name);
+    }
+    return items;
+}
+
+TEST(ZSetTest, OrderRankAndOffset) {
+    std::mt19937 rng(3);
+    ZSet zset;
+    std::map<std::string, double> model;
+    for (int i = 0; i < 2000; i++) {
+        std::string name = "m" + std::to_string(rng() % 700);
+        // few distinct scores, so names break most ties
+        double score = (double)(rng() % 50) / 4;
+        int op = rng() % 4;
+        if (op == 0) {
+            EXPECT_EQ(zset.remove(name), model.erase(name) == 1) << name;
+        } else {
+            EXPECT_EQ(zset.insert(name, score), model.count(name) == 0) << name;
+            model[name] = score;
+        }
+    }
+    std::vector<std::pair<double, std::string>> sorted;
+    for (auto &kv : model) {
+        sorted.emplace_back(kv.second, kv.first);
+    }
+    std::sort(sorted.begin(), sorted.end());
+    ASSERT_EQ(zset.size(), sorted.size());
+    ASSERT_EQ(zset_items(zset), sorted);
+
+    // seekge() lands on the first member >= (score, name), offset() moves
+    // from there in both directions, NULL past either end
+    int64_t n = (int64_t)sorted.size();
+    for (int64_t i = 0; i < n; i += 7) {
+        auto &[score, name] = sorted[i];
+        ZNode *node = zset.seekge(score, name);
+        ASSERT_NE(node, nullptr);
+        EXPECT_EQ(node->name, name);
+        ZNode *lookedUp = zset.lookup(name);
+        EXPECT_EQ(lookedUp, node);
+        EXPECT_EQ(zset.seekge(score, name + "\x01"), ZSet::offset(node, +1));
+        for (int64_t off : {-n, -i - 1, -i, -1L, 0L, 1L, 5L, n - i - 1, n - i}) {
+            ZNode *got = ZSet::offset(node, off);
+            if (i + off < 0 || i + off >= n) {
+                EXPECT_EQ(got, nullptr) << i << " " << off;
+            } else {
+                ASSERT_NE(got, nullptr) << i << " " << off;
+                EXPECT_EQ(got->name, sorted[i + off].second) << i << " " << off;
+            }
+        }
+    }
+    EXPECT_EQ(zset.seekge(INFINITY, ""), nullptr);
+    EXPECT_EQ(ZSet::offset(NULL, 1), nullptr);
+}
+
+TEST(ZSetTest, ScoreUpdateMovesTheMember) {
+    ZSet zset;
+    EXPECT_TRUE(zset.insert("a", 1));
+    EXPECT_TRUE(zset.insert("b", 2));
+    EXPECT_TRUE(zset.insert("c", 3));
+    EXPECT_FALSE(zset.insert("a", 4));
+    EXPECT_FALSE(zset.insert("c", 3));
+    std::vector<std::pair<double, std::string>> want = {{2, "b"}, {3, "c"}, {4, "a"}};
+    EXPECT_EQ(zset_items(zset), want);
+    EXPECT_EQ(zset.size(), 3u);
+}
+
+// ZRANGEBYSCORE and ZQUERY: seek, offset and limit at the command level
+TEST(ZSetCommandTest, RangeByScoreAndQueryOffsets) {
+    for (auto [name, score] : std::vector<std::pair<const char *, const char *>>{
+             {"a", "1"}, {"b", "2"}, {"c", "2"}, {"d", "3"}, {"e", "5"}}) {
+        EXPECT_EQ(request({"zadd", "zq:z", score, name}).first, RES_OK);
+    }
+    auto arr = [](std::initializer_list<std::string_view> args) {
+        auto [code, data] = request(args);
+        EXPECT_EQ(code, RES_OK);
+        return code == RES_OK ? array_of(data) : std::vector<std::string>();
+    };
+    using V = std::vector<std::string>;
+    EXPECT_EQ(arr({"zrangebyscore", "zq:z", "2", "3"}), (V{"b", "2", "c", "2", "d", "3"}));
+    EXPECT_EQ(arr({"zrangebyscore", "zq:z", "4", "4"}), V{});
+    EXPECT_EQ(arr({"zrangebyscore", "zq:z", "-inf", "1"}), (V{"a", "1"}));
+    EXPECT_EQ(arr({"zrangebyscore", "zq:missing", "0", "9"}), V{});
+
+    // from (2, ""): b, moved 1 to c, 2 of them
+    EXPECT_EQ(arr({"zquery", "zq:z", "2", "", "1", "2"}), (V{"c", "2", "d", "3"}));
+    // the name breaks the tie: (2, "c") then one back is b
+    EXPECT_EQ(arr({"zquery", "zq:z", "2", "c", "-1", "10"}), (V{"b", "2", "c", "2", "d", "3", "e", "5"}));
+    EXPECT_EQ(arr({"zquery", "zq:z", "0", "", "-1", "10"}), V{});
+    EXPECT_EQ(arr({"zquery", "zq:z", "0", "", "4", "10"}), (V{"e", "5"}));
+    EXPECT_EQ(arr({"zquery", "zq:z", "0", "", "5", "10"}), V{});
+    // past the last member nothing is found to move from
+    EXPECT_EQ(arr({"zquery", "zq:z", "6", "", "-1", "10"}), V{});
+    // a limit past any count is every member, not an overflow
+    EXPECT_EQ(arr({"zquery", "zq:z", "0", "", "0", "9223372036854775807"}),
+              (V{"a", "1", "b", "2", "c", "2", "d", "3", "e", "5"}));
+    EXPECT_EQ(arr({"zquery", "zq:z", "2", "c", "1", "4611686018427387904"}), (V{"d", "3", "e", "5"}));
+    EXPECT_EQ(arr({"zquery", "zq:z", "0", "", "0", "0"}), V{});
+    EXPECT_EQ(arr({"zquery", "zq:z", "0", "", "0", "-5"}), V{});
+    EXPECT_EQ(request({"zquery", "zq:z", "0", "", "x", "1"}).first, RES_ERR);
+    EXPECT_EQ(request({"zquery", "zq:z", "nan", "", "0", "1"}).first, RES_ERR);
+}
+
+// Snapshots: keys of every kind, saved and loaded back
+class SnapshotTest : public FileTest {
+protected:
+    std::string path = dir.path + "/dump.snap";
+
+    void SetUp() override {
+        FileTest::SetUp();
+        if (!IsSkipped()) {
+            Server::setSnapshotPath(path.c_str());
+        }
+    }
+};
+
+static std::string snap_key(int i) {
+    return "snap:" + std::to_string(i);
+}
+
+static std::string snap_val(int i) {
+    return std::string(8 + i % 40, (char)('a' + i % 26)) + std::to_string(i);
+}
+
+TEST_F(SnapshotTest, SaveLoadRoundTrip) {
+    const int n = 3000;
+    for (int i = 0; i < n; i++) {
+        ASSERT_EQ(request({"set", snap_key(i), snap_val(i)}).first, RES_OK);
+    }
+    // a value stored outside the slab, a sorted set, timers
+    std::string big(200000, 'B');
+    big[12345] = '!';
+    ASSERT_EQ(request({"set", "snap:big", big}).first, RES_OK);
+    for (int i = 0; i < 1000; i++) {
+        std::string score = std::to_string(i * 0.25);
+        ASSERT_EQ(request({"zadd", "snap:z", score, "m" + std::to_string(i)}).first, RES_OK);
+    }
+    ASSERT_EQ(request({"set", "snap:ttl", "x", "px", "100000"}).first, RES_OK);
+    ASSERT_EQ(request({"set", "snap:gone", "x", "px", "1"}).first, RES_OK);
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+    // the expired key is not saved
+    auto [code, count] = request({"save"});
+    ASSERT_EQ(code, RES_OK) << count;
+    EXPECT_EQ(count, std::to_string(n + 3));
+
+    // empty the keyspace, then load it back from the file
+    for (int i = 0; i < n; i++) {
+        ASSERT_EQ(request({"del", snap_key(i)}).first, RES_OK);
+    }
+    for (const char *key : {"snap:big", "snap:z", "snap:ttl", "snap:gone"}) {
+        request({"del", key});
+    }
+    ASSERT_EQ(request({"get", snap_key(0)}).first, RES_NX);
+    ASSERT_TRUE(Server::loadSnapshot());
+
+    for (int i = 0; i < n; i++) {
+        auto [code, val] = request({"get", snap_key(i)});
+        ASSERT_EQ(code, RES_OK) << i;
+        ASSERT_EQ(val, snap_val(i)) << i;
+    }
+    EXPECT_EQ(request({"get", "snap:big"}), std::make_pair((uint32_t)RES_OK, big));
+    for (int i = 0; i < 1000; i += 37) {
+        auto [code, score] = request({"zscore", "snap:z", "m" + std::to_string(i)});
+        EXPECT_EQ(code, RES_OK);
+        EXPECT_EQ(atof(score.c_str()), i * 0.25);
+    }
+    auto [zcode, zitems] = request({"zquery", "snap:z", "0", "", "0", "2000"});
+    EXPECT_EQ(zcode, RES_OK);
+    EXPECT_EQ(array_of(zitems).size(), 2000u);
+    int64_t ttl = atoll(request({"pttl", "snap:ttl"}).second.c_str());
+    EXPECT_GT(ttl, 90000);
+    EXPECT_LE(ttl, 100000);
+    EXPECT_EQ(request({"get", "snap:gone"}).first, RES_NX);
+}
+
+// Any damage to a snapshot fails the checksum or the format checks, and
+// the server refuses to load it
+TEST_F(SnapshotTest, CorruptOrTruncatedFileIsRejected) {
+    for (int i = 0; i < 500; i++) {
+        ASSERT_EQ(request({"set", snap_key(i), snap_val(i)}).first, RES_OK);
+    }
+    ASSERT_EQ(request({"save"}).first, RES_OK);
+    std::string good = read_file(path);
+    ASSERT_GT(good.size(), k_snap_header + k_snap_trailer);
+    {
+        SnapshotFile file;
+        ASSERT_EQ(file.open(path.c_str()), 1) << file.err;
+        EXPECT_EQ(file.nkeys, 500u);
+    }
+
+    auto rejected = [&](std::string_view data, const char *what) {
+        write_file(path, data);
+        SnapshotFile file;
+        EXPECT_EQ(file.open(path.c_str()), -1) << what;
+        EXPECT_FALSE(Server::loadSnapshot()) << what;
+    };
+    // one bit flipped anywhere: header, records, trailer, checksum
+    for (size_t pos : {(size_t)0, (size_t)9, k_snap_header, good.size() / 3, good.size() / 2,
+                       good.size() - k_snap_trailer, good.size() - 12, good.size() - 1}) {
+        std::string bad = good;
+        bad[pos] ^= 0x10;
+        rejected(bad, ("flipped byte at " + std::to_string(pos)).c_str());
+    }
+    // cut short at any point, down to less than a header and trailer
+    for (size_t len : {good.size() - 1, good.size() - 8, good.size() / 2, k_snap_header + k_snap_trailer,
+                       (size_t)10, (size_t)0}) {
+        rejected(std::string_view(good).substr(0, len), ("cut to " + std::to_string(len)).c_str());
+    }
+    // garbage appended after the trailer
+    rejected(good + "xx", "trailing bytes");
+
+    // no file at all is an empty keyspace, not an error
+    unlink(path.c_str());
+    SnapshotFile none;
+    EXPECT_EQ(none.open(path.c_str()), 0);
+}
+
+// Append-only log: replayed into an empty keyspace, then appended to
+class AppendLogTest : public FileTest {
+protected:
+    std::string path = dir.path + "/appendonly.log";
+};
+
+// a record in the request encoding, as the server writes them
+static std::string aof_record(std::initializer_list<std::string_view> args) {
+    std::string body;
+    uint32_t n = (uint32_t)args.size();
+    body.append((const char *)&n, 4);
+    for (std::string_view a : args) {
+        uint32_t sz = (uint32_t)a.size();
+        body.append((const char *)&sz, 4);
+        body.append(a);
+    }
+    uint32_t len = (uint32_t)body.size();
+    return std::string((const char *)&len, 4) + body;
+}
+
+static std::vector<std::vector<std::string>> aof_records(const std::string &data) {
+    std::vector<std::vector<std::string>> records;
+    size_t pos = 0;
+    auto u32 = [&](size_t at) {
+        uint32_t v = 0;
+        memcpy(&v, data.data() + at, 4);
+        return v;
+    };
+    while (pos + 8 <= data.size()) {
+        size_t end = pos + 4 + u32(pos);
+        uint32_t n = u32(pos + 4);
+        pos += 8;
+        std::vector<std::string> args;
+        for (uint32_t i = 0; i < n && pos + 4 <= end; i++) {
+            uint32_t sz = u32(pos);
+            args.push_back(data.substr(pos + 4, sz));
+            pos += 4 + sz;
+        }
+        EXPECT_EQ(pos, end);
+        records.push_back(std::move(args));
+        pos = end;
+    }
+    EXPECT_EQ(pos, data.size());
+    return records;
+}
+
+static std::string unix_ms_from_now(int64_t ms) {
+    auto now = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch());
+    return std::to_string(now.count() + ms);
+}
+
+TEST_F(AppendLogTest, ReplayRebuildsTheKeyspace) {
+    std::string big(100000, 'L');
+    std::string log;
+    for (int i = 0; i < 1000; i++) {
+        log += aof_record({"set", "aof:" + std::to_string(i), "old"});
+        log += aof_record({"set", "aof:" + std::to_string(i), snap_val(i)});
+    }
+    for (int i = 0; i < 1000; i += 2) {
+        log += aof_record({"del", "aof:" + std::to_string(i)});
+    }
+    log += aof_record({"set", "aof:big", big});
+    log += aof_record({"zadd", "aof:z", "1.5", "a"});
+    log += aof_record({"zadd", "aof:z", "2.5", "b"});
+    log += aof_record({"zrem", "aof:z", "a"});
+    log += aof_record({"set", "aof:ttl", "x"});
+    log += aof_record({"pexpireat", "aof:ttl", unix_ms_from_now(100000)});
+    log += aof_record({"set", "aof:persist", "x"});
+    log += aof_record({"pexpireat", "aof:persist", unix_ms_from_now(100000)});
+    log += aof_record({"persist", "aof:persist"});
+    log += aof_record({"set", "aof:gone", "x"});
+    log += aof_record({"pexpireat", "aof:gone", unix_ms_from_now(-1000)});
+    write_file(path, log);
+
+    ASSERT_TRUE(Server::openAppendLog(path.c_str(), AppendLog::FSYNC_ALWAYS));
+    for (int i = 0; i < 1000; i++) {
+        auto [code, val] = request({"get", "aof:" + std::to_string(i)});
+        if (i % 2) {
+            ASSERT_EQ(code, RES_OK) << i;
+            ASSERT_EQ(val, snap_val(i)) << i;
+        } else {
+            ASSERT_EQ(code, RES_NX) << i;
+        }
+    }
+    EXPECT_EQ(request({"get", "aof:big"}), std::make_pair((uint32_t)RES_OK, big));
+    EXPECT_EQ(request({"zscore", "aof:z", "a"}).first, RES_NX);
+    EXPECT_EQ(atof(request({"zscore", "aof:z", "b"}).second.c_str()), 2.5);
+    int64_t ttl = atoll(request({"pttl", "aof:ttl"}).second.c_str());
+    EXPECT_GT(ttl, 90000);
+    EXPECT_LE(ttl, 100000);
+    EXPECT_EQ(request({"pttl", "aof:persist"}).second, "-1");
+    EXPECT_EQ(request({"get", "aof:gone"}).first, RES_NX);
+
+    // replay logs nothing again; new changes go after the old records
+    EXPECT_EQ(read_file(path), log);
+    ASSERT_EQ(request({"set", "aof:new", "v"}).first, RES_OK);
+    std::vector<int> held;
+    Server::aofFlush(held);
+    EXPECT_EQ(read_file(path), log + aof_record({"set", "aof:new", "v"}));
+}
+
+// A crash in the middle of a write leaves part of a record; replay keeps
+// what came before it and cuts the file back to there
+TEST_F(AppendLogTest, TornTailIsTruncated) {
+    std::string log;
+    for (int i = 0; i < 100; i++) {
+        log += aof_record({"set", "torn:" + std::to_string(i), snap_val(i)});
+    }
+    std::string last = aof_record({"set", "torn:last", std::string(5000, 'T')});
+    write_file(path, log + last.substr(0, last.size() / 2));
+
+    ASSERT_TRUE(Server::openAppendLog(path.c_str(), AppendLog::FSYNC_ALWAYS));
+    EXPECT_EQ(read_file(path), log);
+    for (int i = 0; i < 100; i++) {
+        ASSERT_EQ(request({"get", "torn:" + std::to_string(i)}).second, snap_val(i)) << i;
+    }
+    EXPECT_EQ(request({"get", "torn:last"}).first, RES_NX);
+
+    // the next record starts where the good ones end
+    ASSERT_EQ(request({"set", "torn:next", "v"}).first, RES_OK);
+    std::vector<int> held;
+    Server::aofFlush(held);
+    EXPECT_EQ(read_file(path), log + aof_record({"set", "torn:next", "v"}));
+}
+
+TEST_F(AppendLogTest, TornLengthPrefixIsTruncated) {
+    std::string log = aof_record({"set", "torn:k", "v"});
+    write_file(path, log + aof_record({"set", "torn:x", "y"}).substr(0, 3));
+
+    ASSERT_TRUE(Server::openAppendLog(path.c_str(), AppendLog::FSYNC_ALWAYS));
+    EXPECT_EQ(read_file(path), log);
+    EXPECT_EQ(request({"get", "torn:k"}).second, "v");
+}
+
+// a whole record that doesn't parse, or that is no change the server
+// would have logged, is damage, not a torn write: refuse to start rather
+// than serve a partial keyspace
+TEST_F(AppendLogTest, BadRecordIsRefused) {
+    std::string miscounted = aof_record({"set", "bad:k", "v"});
+    uint32_t n = 5;
+    memcpy(&miscounted[4], &n, 4);
+    // well framed, but an unknown command, a missing argument and an
+    // argument the command rejects
+    std::vector<std::string> bads = {miscounted, aof_record({"sett", "bad:k", "v"}), aof_record({"set", "bad:k"}),
+                                     aof_record({"zadd", "bad:z", "x", "m"})};
+    for (size_t i = 0; i < bads.size(); i++) {
+        std::string log = aof_record({"set", "bad:a", "1"}) + bads[i] + aof_record({"set", "bad:b", "2"});
+        write_file(path, log);
+        // a refused log is never opened, so the next case can try again
+        EXPECT_FALSE(Server::openAppendLog(path.c_str(), AppendLog::FSYNC_ALWAYS)) << "case " << i;
+        EXPECT_EQ(read_file(path), log);
+        EXPECT_EQ(request({"get", "bad:b"}).first, RES_NX);
+    }
+}
+
+// A damaged length prefix before the last record is not a torn write,
+// even when it points past the end of the file: cutting there would drop
+// every record after it
+TEST_F(AppendLogTest, CorruptLengthPrefixIsRefused) {
+    std::string good;
+    std::vector<size_t> offsets;
+    for (int i = 0; i < 100; i++) {
+        offsets.push_back(good.size());
+        good += aof_record({"set", "len:" + std::to_string(i), snap_val(i)});
+    }
+    std::vector<std::pair<size_t, int64_t>> cases = {
+        {offsets[10], 1 << 20},            // past the end, a plausible size
+        {offsets[10], (int64_t)1 << 31},   // past the end and the size limit
+        {offsets[10], 1},                  // into the next record
+        {offsets[10], -1},                 // short of the arguments
+        {offsets[99], 64},                 // the last record, past the end
+    };
+    for (size_t i = 0; i < cases.size(); i++) {
+        std::string log = good;
+        uint32_t len = 0;
+        memcpy(&len, &log[cases[i].first], 4);
+        len = (uint32_t)(len + cases[i].second);
+        memcpy(&log[cases[i].first], &len, 4);
+        write_file(path, log);
+        EXPECT_FALSE(Server::openAppendLog(path.c_str(), AppendLog::FSYNC_ALWAYS)) << "case " << i;
+        EXPECT_EQ(read_file(path), log) << "case " << i;
+    }
+}
+
+// Changes made while the rewrite child runs go to the old log and to the
+// rewrite buffer; the new log is the child's image plus that buffer, and
+// later changes go after it
+TEST_F(AppendLogTest, RewriteKeepsChangesMadeMeanwhile) {
+    ASSERT_TRUE(Server::openAppendLog(path.c_str(), AppendLog::FSYNC_ALWAYS));
+    std::vector<int> held;
+    const int n = 2000;
+    for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < n; i++) {
+            ASSERT_EQ(request({"set", "rw:" + std::to_string(i), std::to_string(round)}).first, RES_OK);
+        }
+    }
+    ASSERT_EQ(request({"zadd", "rw:z", "1", "a"}).first, RES_OK);
+    Server::aofFlush(held);
+    struct stat before;
+    ASSERT_EQ(stat(path.c_str(), &before), 0);
+
+    ASSERT_EQ(request({"bgrewriteaof"}).first, RES_OK);
+    // the child may be done or not; it isn't reaped until keyspaceCron()
+    for (int i = 0; i < n; i += 2) {
+        ASSERT_EQ(request({"set", "rw:" + std::to_string(i), "meanwhile"}).first, RES_OK);
+    }
+    ASSERT_EQ(request({"del", "rw:1"}).first, RES_OK);
+    ASSERT_EQ(request({"zadd", "rw:z", "2", "b"}).first, RES_OK);
+    // half of them written to the old log, half still pending
+    Server::aofFlush(held);
+    ASSERT_EQ(request({"set", "rw:pending", "p"}).first, RES_OK);
+
+    struct stat after;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    do {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        Server::keyspaceCron();
+        ASSERT_EQ(stat(path.c_str(), &after), 0);
+    } while (after.st_ino == before.st_ino && std::chrono::steady_clock::now() < deadline);
+    ASSERT_NE(after.st_ino, before.st_ino) << "the rewrite didn't finish";
+    EXPECT_NE(access((path + ".rewrite").c_str(), F_OK), 0);
+    ASSERT_EQ(request({"set", "rw:after", "a"}).first, RES_OK);
+    Server::aofFlush(held);
+
+    // what the new log rebuilds, record by record
+    std::map<std::string, std::string> strs;
+    std::map<std::string, std::map<std::string, std::string>> zsets;
+    auto records = aof_records(read_file(path));
+    for (const auto &rec : records) {
+        ASSERT_GE(rec.size(), 2u);
+        if (rec[0] == "set") {
+            strs[rec[1]] = rec.at(2);
+        } else if (rec[0] == "del") {
+            strs.erase(rec[1]);
+            zsets.erase(rec[1]);
+        } else if (rec[0] == "zadd") {
+            zsets[rec[1]][rec.at(3)] = rec.at(2);
+        } else {
+            ADD_FAILURE() << "unexpected record " << rec[0];
+        }
+    }
+    // one SET per key from the child, not three
+    EXPECT_LT(records.size(), (size_t)n * 2);
+    for (int i = 0; i < n; i++) {
+        std::string key = "rw:" + std::to_string(i);
+        if (i == 1) {
+            EXPECT_EQ(strs.count(key), 0u);
+        } else {
+            EXPECT_EQ(strs[key], i % 2 ? "2" : "meanwhile") << key;
+        }
+    }
+    EXPECT_EQ(strs["rw:pending"], "p");
+    EXPECT_EQ(strs["rw:after"], "a");
+    EXPECT_EQ(zsets["rw:z"].size(), 2u);
+    EXPECT_EQ(zsets["rw:z"]["b"], "2");
+}
+
+int main(int argc, char **argv) {
+    g_argv0 = argv[0];
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
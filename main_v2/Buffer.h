@@ -0,0 +1,99 @@
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include "Dependencies.h"
+
+// Buffers up to this size borrow a block from the buffer pool of their
+// thread instead of calling malloc
+const size_t k_pool_block = 8 << 10;
+
+// Per-thread free list of k_pool_block byte blocks
+uint8_t *bufpool_get();
+void bufpool_put(uint8_t *block);
+
+// Growable byte queue: data[head, size) is pending, bytes before head have
+// been consumed and are reused once everything is consumed. A buffer of
+// k_pool_block bytes is a pool block, larger ones are malloc'd.
+struct Buffer {
+    uint8_t *data = NULL;
+    size_t head = 0;
+    size_t size = 0;
+    size_t cap = 0;
+
+    Buffer() {}
+    ~Buffer() {
+        dispose();
+    }
+    Buffer(const Buffer &) = delete;
+    Buffer &operator=(const Buffer &) = delete;
+
+    size_t pending() const {
+        return size - head;
+    }
+    // Room for n more bytes at data + size, grows by doubling
+    uint8_t *reserve(size_t n) {
+        if (size + n > cap) {
+            if (!cap && n <= k_pool_block) {
+                data = bufpool_get();
+                cap = k_pool_block;
+                return data + size;
+            }
+            size_t ncap = cap ? cap : k_pool_block;
+            while (ncap < size + n) {
+                ncap *= 2;
+            }
+            uint8_t *p = NULL;
+            if (cap == k_pool_block) {
+                // Outgrew the pool block
+                p = (uint8_t *)malloc(ncap);
+                if (p) {
+                    memcpy(p, data, size);
+                    bufpool_put(data);
+                }
+            } else {
+                p = (uint8_t *)realloc(data, ncap);
+            }
+            if (!p) {
+                abort();
+            }
+            data = p;
+            cap = ncap;
+        }
+        return data + size;
+    }
+    void append(const void *p, size_t n) {
+        memcpy(reserve(n), p, n);
+        size += n;
+    }
+    void consume(size_t n) {
+        head += n;
+        assert(head <= size);
+        if (head == size) {
+            head = size = 0;
+        }
+    }
+    // Give the memory back, only when nothing is pending
+    void release() {
+        assert(head == size);
+        dispose();
+        data = NULL;
+        head = size = cap = 0;
+    }
+    void swap(Buffer &other) {
+        std::swap(data, other.data);
+        std::swap(head, other.head);
+        std::swap(size, other.size);
+        std::swap(cap, other.cap);
+    }
+
+private:
+    void dispose() {
+        if (cap == k_pool_block) {
+            bufpool_put(data);
+        } else {
+            free(data);
+        }
+    }
+};
+
+#endif
@@ -27,6 +27,27 @@ Client::Client(uint16_t port, const char* ip_address) {
     }
 }
 
+// Constructor for a client of the server's unix domain socket at unix_path
+Client::Client(const char *unix_path) {
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    // The path has to fit sun_path together with its terminating NUL
+    if (strlen(unix_path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        die("unix socket path");
+    }
+    strcpy(addr.sun_path, unix_path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        die("socket()");
+    }
+    int rv = connect(fd, (const struct sockaddr *)&addr, sizeof(addr));
+    if (rv) {
+        die("connect");
+    }
+}
+
 // Destructor for the Client class
 Client::~Client() {
     // Close the socket file descriptor to release system resources
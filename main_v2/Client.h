@@ -6,6 +6,7 @@
 class Client {
 public:
     Client(uint16_t port, const char* ip_address);
+    explicit Client(const char *unix_path);
     ~Client();
     int getFd() const;
     void closeConnection();
@@ -0,0 +1,32 @@
+#ifndef DLIST_H
+#define DLIST_H
+
+// Intrusive circular doubly linked list node: embed it (or derive from it)
+// in the element type. A detached node points at itself, so detaching
+// twice is harmless. A standalone node serves as the list head.
+struct DList {
+    DList *prev = this;
+    DList *next = this;
+
+    DList() {}
+    DList(const DList &) = delete;
+    DList &operator=(const DList &) = delete;
+
+    bool empty() const {
+        return next == this;
+    }
+    void detach() {
+        prev->next = next;
+        next->prev = prev;
+        prev = next = this;
+    }
+    // Link rookie right before this node, at the tail when this is the head
+    void insertBefore(DList *rookie) {
+        rookie->prev = prev;
+        rookie->next = this;
+        prev->next = rookie;
+        prev = rookie;
+    }
+};
+
+#endif
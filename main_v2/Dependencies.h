@@ -3,22 +3,34 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdarg.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <poll.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
 #include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <string>
 #include <vector>
+#include <algorithm>
 #include <iostream>
 #include <mutex>
+#include <atomic>
 #include <cstring>
 #include <cerrno>
+#if defined(__linux__)
+#include <sys/epoll.h>
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
 #include <sys/event.h>
+#endif
 #include <sys/time.h>
 #include <fstream>
 #include <chrono>
 #include <ctime>
 #include <thread>
+#include <condition_variable>
 #include <map>
\ No newline at end of file
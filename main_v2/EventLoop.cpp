@@ -0,0 +1,298 @@
+#include "EventLoop.h"
+
+// Portable backend. The pollfd array is kept between calls and only
+// patched on add/modify/remove, so nothing is rebuilt per wakeup.
+// poll() is level-triggered, LOOP_EDGE is ignored.
+class PollLoop : public EventLoop {
+public:
+    int add(int fd, uint32_t events) override {
+        if (fd < 0) {
+            return -1;
+        }
+        if (slot.size() <= (size_t)fd) {
+            slot.resize(fd + 1, -1);
+        }
+        if (slot[fd] >= 0) {
+            return -1; // already watched
+        }
+        struct pollfd pfd = {};
+        pfd.fd = fd;
+        pfd.events = toPoll(events);
+        slot[fd] = (int)pfds.size();
+        pfds.push_back(pfd);
+        return 0;
+    }
+
+    int modify(int fd, uint32_t events) override {
+        if (fd < 0 || (size_t)fd >= slot.size() || slot[fd] < 0) {
+            return -1;
+        }
+        pfds[slot[fd]].events = toPoll(events);
+        return 0;
+    }
+
+    int remove(int fd) override {
+        if (fd < 0 || (size_t)fd >= slot.size() || slot[fd] < 0) {
+            return -1;
+        }
+        // Swap the last entry into the freed slot to keep the array dense
+        int i = slot[fd];
+        pfds[i] = pfds.back();
+        slot[pfds[i].fd] = i;
+        pfds.pop_back();
+        slot[fd] = -1;
+        return 0;
+    }
+
+    int wait(std::vector<LoopEvent> &out, int timeout_ms) override {
+        out.clear();
+        int rv = poll(pfds.data(), (nfds_t)pfds.size(), timeout_ms);
+        if (rv <= 0) {
+            return (rv < 0 && errno == EINTR) ? 0 : rv;
+        }
+        for (const struct pollfd &pfd : pfds) {
+            if (!pfd.revents) {
+                continue;
+            }
+            LoopEvent ev;
+            ev.fd = pfd.fd;
+            if (pfd.revents & POLLIN) {
+                ev.events |= LOOP_READ;
+            }
+            if (pfd.revents & POLLOUT) {
+                ev.events |= LOOP_WRITE;
+            }
+            if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+                ev.events |= LOOP_ERR;
+            }
+            out.push_back(ev);
+            if ((int)out.size() == rv) {
+                break;
+            }
+        }
+        return (int)out.size();
+    }
+
+    const char *name() const override {
+        return "poll";
+    }
+
+private:
+    static short toPoll(uint32_t events) {
+        short ev = POLLERR;
+        if (events & LOOP_READ) {
+            ev |= POLLIN;
+        }
+        if (events & LOOP_WRITE) {
+            ev |= POLLOUT;
+        }
+        return ev;
+    }
+
+    std::vector<struct pollfd> pfds;
+    std::vector<int> slot; // fd -> index in pfds, -1 if not watched
+};
+
+#if defined(__linux__)
+
+// Linux backend. With LOOP_EDGE the caller must drain the fd until EAGAIN,
+// which Server::stateRequest / stateResponse already do.
+class EpollLoop : public EventLoop {
+public:
+    EpollLoop() {
+        epfd = epoll_create1(EPOLL_CLOEXEC);
+    }
+
+    ~EpollLoop() override {
+        if (epfd >= 0) {
+            close(epfd);
+        }
+    }
+
+    bool ok() const {
+        return epfd >= 0;
+    }
+
+    int add(int fd, uint32_t events) override {
+        return ctl(EPOLL_CTL_ADD, fd, events);
+    }
+
+    int modify(int fd, uint32_t events) override {
+        // EPOLL_CTL_MOD re-checks readiness, so switching to a direction
+        // that is already ready still reports an edge
+        return ctl(EPOLL_CTL_MOD, fd, events);
+    }
+
+    int remove(int fd) override {
+        struct epoll_event ev = {};
+        return epoll_ctl(epfd, EPOLL_CTL_DEL, fd, &ev);
+    }
+
+    int wait(std::vector<LoopEvent> &out, int timeout_ms) override {
+        out.clear();
+        int rv = epoll_wait(epfd, ready, k_max_events, timeout_ms);
+        if (rv <= 0) {
+            return (rv < 0 && errno == EINTR) ? 0 : rv;
+        }
+        for (int i = 0; i < rv; i++) {
+            LoopEvent ev;
+            ev.fd = ready[i].data.fd;
+            if (ready[i].events & EPOLLIN) {
+                ev.events |= LOOP_READ;
+            }
+            if (ready[i].events & EPOLLOUT) {
+                ev.events |= LOOP_WRITE;
+            }
+            if (ready[i].events & (EPOLLERR | EPOLLHUP)) {
+                ev.events |= LOOP_ERR;
+            }
+            out.push_back(ev);
+        }
+        return rv;
+    }
+
+    const char *name() const override {
+        return "epoll";
+    }
+
+private:
+    int ctl(int op, int fd, uint32_t events) {
+        struct epoll_event ev = {};
+        ev.data.fd = fd;
+        if (events & LOOP_READ) {
+            ev.events |= EPOLLIN;
+        }
+        if (events & LOOP_WRITE) {
+            ev.events |= EPOLLOUT;
+        }
+        if (events & LOOP_EDGE) {
+            ev.events |= EPOLLET;
+        }
+        return epoll_ctl(epfd, op, fd, &ev);
+    }
+
+    static const int k_max_events = 256;
+    int epfd = -1;
+    struct epoll_event ready[k_max_events];
+};
+
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
+
+// BSD / macOS backend. Both filters are registered up front and toggled
+// with EV_ENABLE / EV_DISABLE; LOOP_EDGE maps to EV_CLEAR.
+class KqueueLoop : public EventLoop {
+public:
+    KqueueLoop() {
+        kq = kqueue();
+    }
+
+    ~KqueueLoop() override {
+        if (kq >= 0) {
+            close(kq);
+        }
+    }
+
+    bool ok() const {
+        return kq >= 0;
+    }
+
+    int add(int fd, uint32_t events) override {
+        return apply(fd, events);
+    }
+
+    int modify(int fd, uint32_t events) override {
+        return apply(fd, events);
+    }
+
+    int remove(int fd) override {
+        struct kevent changes[2];
+        EV_SET(&changes[0], fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+        EV_SET(&changes[1], fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+        return kevent(kq, changes, 2, NULL, 0, NULL);
+    }
+
+    int wait(std::vector<LoopEvent> &out, int timeout_ms) override {
+        out.clear();
+        struct timespec ts = {};
+        struct timespec *tsp = NULL;
+        if (timeout_ms >= 0) {
+            ts.tv_sec = timeout_ms / 1000;
+            ts.tv_nsec = (long)(timeout_ms % 1000) * 1000000;
+            tsp = &ts;
+        }
+        int rv = kevent(kq, NULL, 0, ready, k_max_events, tsp);
+        if (rv <= 0) {
+            return (rv < 0 && errno == EINTR) ? 0 : rv;
+        }
+        // A fd can show up once per filter, report it once
+        for (int i = 0; i < rv; i++) {
+            uint32_t bits = 0;
+            if (ready[i].filter == EVFILT_READ) {
+                bits |= LOOP_READ;
+            } else if (ready[i].filter == EVFILT_WRITE) {
+                bits |= LOOP_WRITE;
+            }
+            if (ready[i].flags & (EV_EOF | EV_ERROR)) {
+                bits |= LOOP_ERR;
+            }
+            int fd = (int)ready[i].ident;
+            bool merged = false;
+            for (LoopEvent &ev : out) {
+                if (ev.fd == fd) {
+                    ev.events |= bits;
+                    merged = true;
+                    break;
+                }
+            }
+            if (!merged) {
+                LoopEvent ev;
+                ev.fd = fd;
+                ev.events = bits;
+                out.push_back(ev);
+            }
+        }
+        return (int)out.size();
+    }
+
+    const char *name() const override {
+        return "kqueue";
+    }
+
+private:
+    int apply(int fd, uint32_t events) {
+        unsigned short clear = (events & LOOP_EDGE) ? EV_CLEAR : 0;
+        unsigned short rd = (events & LOOP_READ) ? EV_ENABLE : EV_DISABLE;
+        unsigned short wr = (events & LOOP_WRITE) ? EV_ENABLE : EV_DISABLE;
+        struct kevent changes[2];
+        EV_SET(&changes[0], fd, EVFILT_READ, EV_ADD | rd | clear, 0, 0, NULL);
+        EV_SET(&changes[1], fd, EVFILT_WRITE, EV_ADD | wr | clear, 0, 0, NULL);
+        return kevent(kq, changes, 2, NULL, 0, NULL);
+    }
+
+    static const int k_max_events = 256;
+    int kq = -1;
+    struct kevent ready[k_max_events];
+};
+
+#endif
+
+EventLoop *EventLoop::createPoll() {
+    return new PollLoop();
+}
+
+EventLoop *EventLoop::create() {
+#if defined(__linux__)
+    EpollLoop *loop = new EpollLoop();
+    if (loop->ok()) {
+        return loop;
+    }
+    delete loop;
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
+    KqueueLoop *loop = new KqueueLoop();
+    if (loop->ok()) {
+        return loop;
+    }
+    delete loop;
+#endif
+    return createPoll();
+}
@@ -0,0 +1,56 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include "Dependencies.h"
+
+enum LogLevel {
+    LOG_DEBUG = 0,
+    LOG_INFO = 1,
+    LOG_WARN = 2,
+    LOG_ERROR = 3,
+    LOG_OFF = 4,
+};
+
+// Asynchronous logging, kept off the request path. Each thread formats its
+// records into a ring of its own, a single-producer single-consumer queue
+// with no lock; a background thread drains every ring every few ms and
+// writes the whole batch with one write(). A thread never waits for the
+// log: when its ring is full the record is dropped and counted, and the
+// drops are reported in the log itself. A record below the level costs a
+// load and a compare. Timestamps come from the coarse clock and are only
+// formatted by the background thread.
+class Log {
+public:
+    // Log to path ("-" for stderr) from level up, false if it can't be opened
+    static bool open(const char *path, LogLevel level);
+    // Write out what is queued and stop the background thread
+    static void close();
+    static bool enabled(LogLevel level) {
+        return level >= threshold.load(std::memory_order_relaxed);
+    }
+    static void setLevel(LogLevel level);
+    // "debug", "info", "warn" or "error", false for anything else
+    static bool parseLevel(const char *name, LogLevel &out);
+    // printf-style, cut at k_max_record bytes
+    static void write(LogLevel level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+    // "prefix: data" for the request path: data is only copied, the
+    // drainer does the formatting. prefix must be a string literal.
+    static void message(LogLevel level, const char *prefix, const void *data, size_t len);
+    // Records lost to full rings so far
+    static uint64_t dropped() {
+        return ndropped.load(std::memory_order_relaxed);
+    }
+
+    static const size_t k_ring_slots = 4096;
+    static const size_t k_max_record = 240;
+    static const int k_drain_ms = 10;
+
+private:
+    static void drainLoop();
+    static size_t drain();
+
+    static std::atomic<int> threshold;
+    static std::atomic<uint64_t> ndropped;
+};
+
+#endif // LOG_H
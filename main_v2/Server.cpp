@@ -1,9 +1,73 @@
 #include "Server.h"
 
-// Server class constructor, sets up the server socket
-Server::Server(uint16_t port) : running(true) {
+// Socket option that spreads connections over listeners sharing a port.
+// BSD's plain SO_REUSEPORT does not balance, so it is not used there.
+#if defined(__linux__) && defined(SO_REUSEPORT)
+#define REUSEPORT_LB SO_REUSEPORT
+#elif defined(SO_REUSEPORT_LB)
+#define REUSEPORT_LB SO_REUSEPORT_LB
+#endif
+
+// Connections accepted per loop turn at most
+const int k_accept_budget = 256;
+
+#ifdef REDICPP_IO_URING
+// Io_uring reactor sizing: queue depth, provided recv buffers and the
+// Received bytes a connection may buffer before its recv is cancelled
+const unsigned k_uring_entries = 1024;
+const unsigned k_uring_bufs = 256;
+const unsigned k_uring_bufsize = 4096;
+const size_t k_uring_backlog_max = 1 << 20;
+#endif
+
+// Milliseconds on the monotonic clock
+static uint64_t get_monotonic_msec() {
+    struct timespec tv = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return (uint64_t)tv.tv_sec * 1000 + (uint64_t)tv.tv_nsec / 1000 / 1000;
+}
+
+// Server class constructor, sets up one listening socket per reactor and
+// the optional unix domain socket all of them accept from
+Server::Server(uint16_t port, unsigned nthreads, const char *unixPath) : running(true) {
+    if (nthreads == 0) {
+        nthreads = 1;
+    }
+    if (port == 0) {
+        listeners.assign(nthreads, -1);
+    } else {
+#ifdef REUSEPORT_LB
+        // Every reactor binds its own socket, the kernel shards connections
+        for (unsigned i = 0; i < nthreads; i++) {
+            listeners.push_back(listenOn(port, nthreads > 1));
+        }
+#else
+        // No balancing option: all reactors accept from the same socket
+        int lfd = listenOn(port, false);
+        for (unsigned i = 0; i < nthreads; i++) {
+            listeners.push_back(lfd);
+        }
+#endif
+    }
+    if (unixPath) {
+        unixfd = listenUnix(unixPath);
+        this->unixPath = unixPath;
+    } else if (port == 0) {
+        die("no listener");
+    }
+
+    // Pipe written by stop() so blocked reactors wake up right away
+    if (pipe(wakefd)) {
+        die("pipe()");
+    }
+    fd_set_nb(wakefd[0]);
+    fd_set_nb(wakefd[1]);
+}
+
+// Create a non-blocking listening socket bound to the given port
+int Server::listenOn(uint16_t port, bool reuseport) {
     // Create a socket file descriptor
-    fd = socket(AF_INET, SOCK_STREAM, 0);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
     if (fd < 0) {
         die("socket()"); // Handle socket creation error
     }
@@ -11,6 +75,14 @@ Server::Server(uint16_t port) : running(true) {
     // Set socket option to reuse address
     int val = 1;
     setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
+#ifdef REUSEPORT_LB
+    // Let the other reactors bind the same port
+    if (reuseport && setsockopt(fd, SOL_SOCKET, REUSEPORT_LB, &val, sizeof(val))) {
+        die("setsockopt(SO_REUSEPORT)");
+    }
+#else
+    (void)reuseport;
+#endif
 
     // Set up server address structure
     struct sockaddr_in addr = {};
@@ -29,54 +101,197 @@ Server::Server(uint16_t port) : running(true) {
     if (rv) {
         die("listen()"); // Handle listen error
     }
+    fd_set_nb(fd);
+    return fd;
+}
+
+// Create a non-blocking listening unix domain socket at path
+int Server::listenUnix(const char *path) {
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        die("unix socket path");
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        die("socket()");
+    }
+    // Replace a socket left behind by a previous run, but never a regular
+    // file that happens to have the same name
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+    if (bind(fd, (const sockaddr *)&addr, sizeof(addr))) {
+        die("bind()");
+    }
+    if (listen(fd, SOMAXCONN)) {
+        die("listen()");
+    }
+    fd_set_nb(fd);
+    return fd;
 }
 
-// Server class destructor, closes the socket file descriptor
+// Server class destructor, closes the socket file descriptors
 Server::~Server() {
-    close(fd);
+    for (size_t i = 0; i < listeners.size(); i++) {
+        // A shared listener appears several times, close it once
+        if (listeners[i] >= 0 && (i == 0 || listeners[i] != listeners[0])) {
+            close(listeners[i]);
+        }
+    }
+    if (unixfd >= 0) {
+        close(unixfd);
+        unlink(unixPath.c_str());
+    }
+    close(wakefd[0]);
+    close(wakefd[1]);
 }
 
-// Run the server, accepting and handling incoming connections
+// Select the io_uring backend, used when the build and the kernel support it
+void Server::useIoUring(bool on) {
+    ioUring = on;
+}
+
+size_t Server::wbufHighWater = 64 * 1024;
+
+// Set the amount of queued output above which a connection stops reading
+// requests until the client has consumed some of its responses
+void Server::setWbufHighWater(size_t bytes) {
+    wbufHighWater = bytes ? bytes : 1;
+}
+
+size_t Server::getWbufHighWater() {
+    return wbufHighWater;
+}
+
+uint64_t Server::idleTimeoutMs = 300 * 1000;
+
+// Close connections that show no activity for this long, 0 disables it
+void Server::setIdleTimeout(uint64_t ms) {
+    idleTimeoutMs = ms;
+}
+
+uint64_t Server::getIdleTimeout() {
+    return idleTimeoutMs;
+}
+
+// Run the server: reactor 0 runs on the calling thread, the others get
+// their own thread, each with its own listener, loop and fd2conn table
 int Server::run() {
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < listeners.size(); i++) {
+        threads.emplace_back([this, i] { startReactor(listeners[i]); });
+    }
+    int rv = startReactor(listeners[0]);
+    for (std::thread &t : threads) {
+        t.join();
+    }
+    return rv;
+}
+
+// Run one reactor on the io_uring backend if requested and available,
+// otherwise on the EventLoop backend
+int Server::startReactor(int fd) {
+#ifdef REDICPP_IO_URING
+    if (ioUring) {
+        Uring *ring = Uring::create(k_uring_entries, k_uring_bufs, k_uring_bufsize);
+        if (ring) {
+            int rv = runUringReactor(fd, ring);
+            delete ring;
+            return rv;
+        }
+        msg("io_uring not supported, using the event loop");
+    }
+#else
+    if (ioUring) {
+        msg("built without io_uring, using the event loop");
+    }
+#endif
+    return runReactor(fd);
+}
+
+// One reactor: accept and serve connections from the listener fd and the
+// unix domain socket, either of which may be missing (-1)
+int Server::runReactor(int fd) {
+    std::vector<Conn *> fd2conn;
+    DList idle; // Connections ordered by last activity, oldest first
+    EventLoop *loop = EventLoop::create();
+    // The listeners and the wakeup pipe stay level-triggered,
+    // connections are edge-triggered (see acceptNewConn)
+    const int lfds[2] = {fd, unixfd};
+    for (int lfd : lfds) {
+        if (lfd >= 0 && loop->add(lfd, LOOP_READ)) {
+            die("EventLoop::add()");
+        }
+    }
+    if (loop->add(wakefd[0], LOOP_READ)) {
+        die("EventLoop::add()");
+    }
+    std::vector<LoopEvent> events;
     while (running) {
-        std::vector<Conn *> fd2conn;
-        fd_set_nb(fd);
-        std::vector<struct pollfd> pollArgs;
-        while (true) {
-            pollArgs.clear();
-            struct pollfd pfd = {fd, POLLIN, 0};
-            pollArgs.push_back(pfd);
-            for (Conn *conn: fd2conn) {
-                if (!conn) {
-                    continue;
-                }
-                struct pollfd pfd = {};
-                pfd.fd = conn->fd;
-                pfd.events = (conn->state == STATE_REQ) ? POLLIN : POLLOUT;
-                pfd.events |= POLLERR;
-                pollArgs.push_back(pfd);
+        // Sleep until the oldest connection would time out
+        int rv = loop->wait(events, idleWait(&idle, get_monotonic_msec()));
+        if (rv < 0) {
+            die(loop->name());
+        }
+        uint64_t now = get_monotonic_msec();
+        bool acceptReady[2] = {false, false};
+        for (const LoopEvent &ev : events) {
+            if (ev.fd == lfds[0] || ev.fd == lfds[1]) {
+                acceptReady[ev.fd == lfds[1]] = true;
+                continue;
             }
-            int rv = poll(pollArgs.data(), (nfds_t)pollArgs.size(), 10000);
-            if (rv < 0) {
-                die("poll()");
+            if (ev.fd == wakefd[0]) {
+                // Left undrained so that every reactor sees it
+                continue;
             }
-            for (size_t i = 1; i < pollArgs.size(); i++) {
-                if (pollArgs[i].revents) {
-                    Conn *conn = fd2conn[pollArgs[i].fd];
-                    connectionIO(conn);
-                    if (conn->state == STATE_DONE) {
-                        fd2conn[conn->fd] = NULL;
-                        (void)close(conn->fd);
-                        delete conn;
-                    }
+            if ((size_t)ev.fd >= fd2conn.size() || !fd2conn[ev.fd]) {
+                continue;
+            }
+            Conn *conn = fd2conn[ev.fd];
+            connectionIO(conn);
+            if (conn->state == STATE_DONE) {
+                connDone(fd2conn, loop, conn);
+                continue;
+            }
+            connTouch(&idle, conn, now);
+            connRelease(conn);
+            // Only touch the interest set when it actually changes
+            uint32_t want = connInterest(conn);
+            if (want != conn->interest) {
+                conn->interest = want;
+                if (loop->modify(conn->fd, want | LOOP_EDGE)) {
+                    connDone(fd2conn, loop, conn);
                 }
             }
+        }
 
-            if (pollArgs[0].revents) {
-                (void)acceptNewConn(fd2conn, fd);
+        for (int l = 0; l < 2; l++) {
+            if (!acceptReady[l]) {
+                continue;
             }
+            // Drain the accept queue, bounded so that a reconnect storm
+            // cannot starve the clients already connected
+            for (int i = 0; i < k_accept_budget; i++) {
+                if (acceptNewConn(fd2conn, loop, &idle, lfds[l]) < 0) {
+                    break;
+                }
+            }
+        }
+        reapIdle(fd2conn, loop, &idle, now);
+    }
+
+    // Release the remaining connections
+    for (Conn *conn : fd2conn) {
+        if (conn) {
+            connDone(fd2conn, loop, conn);
         }
     }
+    delete loop;
     return 0;
 }
 
@@ -87,8 +302,12 @@ void Server::die(const char *msg) {
     abort();
 }
 
-// Print a message to stderr
+// Print a message to stderr, or queue it for the log when one is open
 void Server::msg(const char *msg) {
+    if (Log::enabled(LOG_INFO)) {
+        Log::write(LOG_INFO, "%s", msg);
+        return;
+    }
     fprintf(stderr, "%s\n", msg);
 }
 
@@ -120,6 +339,28 @@ int32_t Server::write_all(int fd, const char *buf, size_t n) {
 
 // Maximum message length
 const size_t maxMsgLen = 4096;
+// rbuf never holds more than one partial request past this
+const size_t k_rbuf_size = 4 + maxMsgLen;
+// Freed Conn objects kept per reactor thread for the next accept
+const size_t k_conn_pool_keep = 1024;
+
+struct ConnPool : public std::vector<void *> {
+    ~ConnPool() {
+        for (void *mem : *this) {
+            ::operator delete(mem);
+        }
+    }
+};
+
+// Conn memory of this thread's reactor, recycled instead of freed
+static thread_local ConnPool t_conn_pool;
+
+// Responses are written once per turn already, Nagle would only delay them.
+// On a unix domain socket the option does not exist and the call just fails
+void Server::fd_set_nodelay(int fd) {
+    int val = 1;
+    (void)setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val));
+}
 
 void Server::fd_set_nb(int fd) {
     errno = 0;
@@ -136,6 +377,41 @@ void Server::fd_set_nb(int fd) {
     }
 }
 
+Conn *Server::connNew() {
+    void *mem = NULL;
+    if (!t_conn_pool.empty()) {
+        mem = t_conn_pool.back();
+        t_conn_pool.pop_back();
+    } else {
+        mem = ::operator new(sizeof(Conn));
+    }
+    return new (mem) Conn();
+}
+
+void Server::connFree(Conn *conn) {
+    conn->~Conn();
+    if (t_conn_pool.size() < k_conn_pool_keep) {
+        t_conn_pool.push_back(conn);
+    } else {
+        ::operator delete(conn);
+    }
+}
+
+// End of a turn: drained buffers go back to the pool
+void Server::connRelease(Conn *conn) {
+    if (conn->rbuf.cap && !conn->rbuf.pending()) {
+        conn->rbuf.release();
+    }
+    if (conn->wbuf.cap && !conn->wbuf.pending()) {
+        conn->wbuf.release();
+    }
+#ifdef REDICPP_IO_URING
+    if (conn->sending.cap && !conn->sending.pending()) {
+        conn->sending.release();
+    }
+#endif
+}
+
 void Server::connPut(std::vector<Conn*> &fd2conn, struct Conn *conn) {
     if (fd2conn.size() <= (size_t)conn->fd) {
         fd2conn.resize(conn->fd + 1);
@@ -143,67 +419,152 @@ void Server::connPut(std::vector<Conn*> &fd2conn, struct Conn *conn) {
     fd2conn[conn->fd] = conn;
 }
 
-std::mutex Server::accept_mutex;
+// Unregister, close and free a connection
+void Server::connDone(std::vector<Conn*> &fd2conn, EventLoop *loop, Conn *conn) {
+    fd2conn[conn->fd] = NULL;
+    (void)loop->remove(conn->fd);
+    (void)close(conn->fd);
+    conn->detach();
+    connFree(conn);
+}
 
-int32_t Server::acceptNewConn(std::vector<Conn*> &fd2conn, int fd) {
-    struct sockaddr_in client_addr = {};
-    socklen_t socklen = sizeof(client_addr);
-    std::lock_guard<std::mutex> guard(accept_mutex);
-    int connfd = accept(fd, (struct sockaddr *)&client_addr, &socklen);
-    if (connfd < 0) {
-        // std::cerr << "accept() failed with errno " << errno << " (" << strerror(errno) << ")" << std::endl;
-        msg("accept() error");
+// Record activity: the connection moves to the tail of the idle list, O(1)
+void Server::connTouch(DList *idle, Conn *conn, uint64_t now) {
+    conn->idle_start = now;
+    conn->detach();
+    idle->insertBefore(conn);
+}
+
+// Milliseconds until the oldest connection times out, -1 if none can
+int Server::idleWait(const DList *idle, uint64_t now) {
+    if (!idleTimeoutMs || idle->empty()) {
         return -1;
     }
-    fd_set_nb(connfd);
-    struct Conn *conn = new Conn();
-    if (!conn) {
-        close(connfd);
+    uint64_t deadline = static_cast<const Conn *>(idle->next)->idle_start + idleTimeoutMs;
+    return deadline <= now ? 0 : (int)std::min(deadline - now, (uint64_t)INT32_MAX);
+}
+
+// Close the timed out connections. The list is ordered, so this stops at
+// the first live one and costs O(expired), not O(connections).
+void Server::reapIdle(std::vector<Conn*> &fd2conn, EventLoop *loop, DList *idle, uint64_t now) {
+    while (idleWait(idle, now) == 0) {
+        connDone(fd2conn, loop, static_cast<Conn *>(idle->next));
+    }
+}
+
+// Accept a connection that is already non-blocking and close-on-exec
+static int accept_nb(int fd) {
+#if defined(__linux__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
+    return accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+    int connfd = accept(fd, NULL, NULL);
+    if (connfd >= 0) {
+        Server::fd_set_nb(connfd);
+        (void)fcntl(connfd, F_SETFD, FD_CLOEXEC);
+    }
+    return connfd;
+#endif
+}
+
+int32_t Server::acceptNewConn(std::vector<Conn*> &fd2conn, EventLoop *loop, DList *idle, int fd) {
+    int connfd = accept_nb(fd);
+    if (connfd < 0) {
+        // EAGAIN once the queue is drained, or when another reactor won the race
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNABORTED) {
+            msg("accept() error");
+        }
         return -1;
     }
+    fd_set_nodelay(connfd);
+    struct Conn *conn = connNew();
     conn->fd = connfd;
     conn->state = STATE_REQ;
-    conn->rbuf_size = 0;
-    conn->wbuf_size = 0;
-    conn->wbuf_sent = 0;
+    conn->interest = LOOP_READ;
     connPut(fd2conn, conn);
+    connTouch(idle, conn, get_monotonic_msec());
+    // Edge-triggered: stateRequest / stateResponse drain until EAGAIN
+    if (loop->add(connfd, LOOP_READ | LOOP_EDGE)) {
+        msg("EventLoop::add() error");
+        fd2conn[connfd] = NULL;
+        close(connfd);
+        conn->detach();
+        connFree(conn);
+        return -1;
+    }
     return 0;
 }
 
-bool Server::tryOneRequest(Conn *conn) {
-    if (conn->rbuf_size < 4) {
+// Move the unread bytes to the front of rbuf. Called once before each
+// read instead of once per request, so pipelining stays O(bytes).
+void Server::compactRbuf(Conn *conn) {
+    Buffer &rbuf = conn->rbuf;
+    size_t rem = rbuf.pending();
+    if (rem && rbuf.head) {
+        memmove(rbuf.data, &rbuf.data[rbuf.head], rem);
+    }
+    rbuf.head = 0;
+    rbuf.size = rem;
+}
+
+// Append the echo of one buffered request to wbuf. Returns false if no
+// complete request is buffered or the output queue is above the high-water
+// mark.
+bool Server::handleOneRequest(Conn *conn) {
+    size_t avail = conn->rbuf.pending();
+    if (avail < 4) {
         return false;
     }
+    const uint8_t *req = &conn->rbuf.data[conn->rbuf.head];
     uint32_t len = 0;
-    memcpy(&len, &conn->rbuf[0], 4);
+    memcpy(&len, req, 4);
     if (len > maxMsgLen) {
         msg("message too long");
         conn->state = STATE_DONE;
         return false;
     }
-    if (4 + len > conn->rbuf_size) {
+    if (4 + len > avail) {
+        return false;
+    }
+    size_t queued = conn->wbuf.pending();
+#ifdef REDICPP_IO_URING
+    queued += conn->sending.pending();
+#endif
+    if (queued >= wbufHighWater) {
         return false;
     }
-    std::cout << "Client says: " << conn->rbuf + 4 << std::endl;
-    memcpy(&conn->wbuf[0], &len, 4);
-    memcpy(&conn->wbuf[4], &conn->rbuf[4], len);
-    conn->wbuf_size = 4 + len;
+    Log::message(LOG_DEBUG, "Client says", req + 4, len);
+    conn->wbuf.append(&req[0], 4 + len);
+
+    // Consume the request by advancing the parse cursor
+    conn->rbuf.consume(4 + len);
+    return true;
+}
 
-    size_t rem = conn->rbuf_size - (4 + len);
-    if (rem) {
-        memmove(conn->rbuf, &conn->rbuf[4 + len], rem);
+// Handle one request and queue its response. The queue is written once
+// per batch by stateRequest(), or early here once it reaches the
+// high-water mark; if the client does not drain it, reading is paused.
+bool Server::tryOneRequest(Conn *conn) {
+    if (conn->wbuf.pending() >= wbufHighWater) {
+        stateResponse(conn);
+        if (conn->state != STATE_REQ) {
+            return false;
+        }
+        if (conn->wbuf.pending() >= wbufHighWater) {
+            conn->state = STATE_RESP;
+            return false;
+        }
     }
-    conn->rbuf_size = rem;
-    stateResponse(conn);
-    return (conn->state == STATE_REQ);
+    return handleOneRequest(conn);
 }
 
 bool Server::tryFillRbuf(Conn *conn) {
-    assert(conn->rbuf_size < sizeof(conn->rbuf));
+    compactRbuf(conn);
+    Buffer &rbuf = conn->rbuf;
+    assert(rbuf.size < k_rbuf_size);
+    (void)rbuf.reserve(k_rbuf_size - rbuf.size);
     ssize_t rv = 0;
     do {
-        size_t c = sizeof(conn->rbuf) - conn->rbuf_size;
-        rv = read(conn->fd, &conn->rbuf[conn->rbuf_size], c);
+        rv = read(conn->fd, &rbuf.data[rbuf.size], rbuf.cap - rbuf.size);
     } while (rv < 0 && errno == EINTR);
     if (rv < 0 && errno == EAGAIN) {
         return false;
@@ -214,7 +575,7 @@ bool Server::tryFillRbuf(Conn *conn) {
         return false;
     }
     if (rv == 0) {
-        if (conn->rbuf_size == 0) {
+        if (!rbuf.pending()) {
             msg("Unexpected EOF");
         } else {
             msg("EOF");
@@ -222,21 +583,28 @@ bool Server::tryFillRbuf(Conn *conn) {
         conn->state = STATE_DONE;
         return false;
     }
-    conn->rbuf_size += (size_t)rv;
-    assert(conn->rbuf_size <= sizeof(conn->rbuf));
+    rbuf.size += (size_t)rv;
+    assert(rbuf.size <= rbuf.cap);
     while (tryOneRequest(conn)) {}
     return (conn->state == STATE_REQ);
 }
 
+// Read and handle requests until EAGAIN, then write all their responses
+// with a single flush
 void Server::stateRequest(Conn *conn) {
     while (tryFillRbuf(conn)) {}
+    if (conn->state == STATE_REQ) {
+        stateResponse(conn);
+    }
 }
 
 bool Server::tryFlushWbuf(Conn *conn) {
+    if (!conn->wbuf.pending()) {
+        return false;
+    }
     ssize_t rv = 0;
     do {
-        size_t rem = conn->wbuf_size - conn->wbuf_sent;
-        rv = write(conn->fd, &conn->wbuf[conn->wbuf_sent], rem);
+        rv = write(conn->fd, &conn->wbuf.data[conn->wbuf.head], conn->wbuf.pending());
     } while (rv < 0 && errno == EINTR);
     if (rv < 0 && errno == EAGAIN) {
         return false;
@@ -246,15 +614,8 @@ bool Server::tryFlushWbuf(Conn *conn) {
         conn->state = STATE_DONE;
         return false;
     }
-    conn->wbuf_sent += (size_t)rv;
-    assert(conn->wbuf_sent <= conn->wbuf_size);
-    if (conn->wbuf_sent == conn->wbuf_size) {
-        conn->state = STATE_REQ;
-        conn->wbuf_size = 0;
-        conn->wbuf_sent = 0;
-        return false;
-    }
-    return true;
+    conn->wbuf.consume((size_t)rv);
+    return conn->wbuf.pending() > 0;
 }
 
 void Server::stateResponse(Conn *conn) {
@@ -262,18 +623,333 @@ void Server::stateResponse(Conn *conn) {
 }
 
 void Server::connectionIO(Conn *conn) {
+    assert(conn->state == STATE_REQ || conn->state == STATE_RESP);
+    // Responses left over from the previous turn go out first
+    stateResponse(conn);
+    if (conn->state == STATE_RESP && conn->wbuf.pending() < wbufHighWater) {
+        // Below the high-water mark again: resume reading, starting with
+        // the requests that were left in rbuf
+        conn->state = STATE_REQ;
+        while (tryOneRequest(conn)) {}
+    }
     if (conn->state == STATE_REQ) {
+        // Also reached right after a flush: with edge-triggered readiness
+        // the socket has to be drained now, no new edge may come
         stateRequest(conn);
-    } else if (conn->state == STATE_RESP) {
-        stateResponse(conn);
-    } else {
-        assert(0);
     }
 }
 
-// Stop the server
+// Event loop interest for a connection: write-only while reading is
+// paused, otherwise read, plus write while a flush is blocked on EAGAIN
+uint32_t Server::connInterest(const Conn *conn) {
+    if (conn->state == STATE_RESP) {
+        return LOOP_WRITE;
+    }
+    return LOOP_READ | (conn->wbuf.pending() ? LOOP_WRITE : 0);
+}
+
+// Stop the server, run() returns on its next wakeup
 void Server::stop() {
     std::cout << "stopping" << std::endl;
     running = false;
-    close(fd);
-}
\ No newline at end of file
+    (void)write(wakefd[1], "x", 1);
+}
+
+#ifdef REDICPP_IO_URING
+
+// What a completion belongs to, kept in the low byte of user_data
+enum {
+    URING_ACCEPT = 1,
+    URING_RECV = 2,
+    URING_SEND = 3,
+    URING_WAKE = 4,
+    URING_CANCEL = 5,
+};
+
+static uint64_t uringTag(int fd, uint32_t op) {
+    return ((uint64_t)(uint32_t)fd << 8) | op;
+}
+
+void Server::uringNewConn(std::vector<Conn*> &fd2conn, Uring *ring, DList *idle, int connfd) {
+    fd_set_nodelay(connfd);
+    struct Conn *conn = connNew();
+    conn->fd = connfd;
+    conn->state = STATE_REQ;
+    connPut(fd2conn, conn);
+    connTouch(idle, conn, get_monotonic_msec());
+    if (!uringArmRecv(ring, conn)) {
+        fd2conn[connfd] = NULL;
+        close(connfd);
+        conn->detach();
+        connFree(conn);
+    }
+}
+
+bool Server::uringArmRecv(Uring *ring, Conn *conn) {
+    struct io_uring_sqe *sqe = ring->getSqe();
+    if (!sqe) {
+        return false;
+    }
+    // Multishot: one submission keeps delivering data until it fails
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = Uring::k_buf_group;
+    sqe->user_data = uringTag(conn->fd, URING_RECV);
+    conn->recv_armed = true;
+    conn->uring_pending++;
+    return true;
+}
+
+void Server::uringFlush(Uring *ring, Conn *conn) {
+    if (conn->send_busy) {
+        return;
+    }
+    if (!conn->sending.pending()) {
+        if (!conn->wbuf.pending()) {
+            return;
+        }
+        // Hand over everything queued so far, wbuf keeps growing meanwhile
+        conn->sending.swap(conn->wbuf);
+    }
+    struct io_uring_sqe *sqe = ring->getSqe();
+    if (!sqe) {
+        conn->state = STATE_DONE;
+        return;
+    }
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = conn->fd;
+    sqe->addr = (uint64_t)(uintptr_t)&conn->sending.data[conn->sending.head];
+    sqe->len = (uint32_t)conn->sending.pending();
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = uringTag(conn->fd, URING_SEND);
+    conn->send_busy = true;
+    conn->uring_pending++;
+}
+
+void Server::uringPump(Conn *conn) {
+    while (true) {
+        while (handleOneRequest(conn)) {}
+        size_t pending = conn->backlog.size() - conn->backlog_pos;
+        bool full = conn->wbuf.pending() + conn->sending.pending() >= wbufHighWater;
+        if (conn->state == STATE_DONE || full || !pending) {
+            return;
+        }
+        // Buffered requests are used up: refill rbuf from the backlog
+        compactRbuf(conn);
+        size_t n = std::min(k_rbuf_size - conn->rbuf.size, pending);
+        if (!n) {
+            return;
+        }
+        conn->rbuf.append(&conn->backlog[conn->backlog_pos], n);
+        conn->backlog_pos += n;
+        if (conn->backlog_pos == conn->backlog.size()) {
+            conn->backlog.clear();
+            conn->backlog_pos = 0;
+        } else if (conn->backlog_pos > conn->backlog.size() / 2) {
+            // Drop the consumed half, amortized O(1) per byte
+            conn->backlog.erase(0, conn->backlog_pos);
+            conn->backlog_pos = 0;
+        }
+    }
+}
+
+void Server::uringOnRecv(Uring *ring, Conn *conn, int res, uint32_t flags) {
+    if (!(flags & IORING_CQE_F_MORE)) {
+        conn->recv_armed = false;
+        conn->uring_pending--;
+    }
+    if (flags & IORING_CQE_F_BUFFER) {
+        uint16_t bid = (uint16_t)(flags >> IORING_CQE_BUFFER_SHIFT);
+        if (res > 0 && conn->state != STATE_DONE) {
+            // Whatever does not fit rbuf waits in the backlog
+            const uint8_t *data = ring->bufAt(bid);
+            size_t room = 0;
+            if (conn->backlog.empty()) {
+                compactRbuf(conn);
+                room = k_rbuf_size - conn->rbuf.size;
+            }
+            size_t n = std::min(room, (size_t)res);
+            conn->rbuf.append(data, n);
+            conn->backlog.append((const char *)data + n, (size_t)res - n);
+        }
+        ring->recycleBuf(bid);
+    }
+    if (conn->state == STATE_DONE) {
+        return;
+    }
+    if (res == 0) {
+        msg(conn->rbuf.pending() ? "EOF" : "Unexpected EOF");
+        conn->state = STATE_DONE;
+        return;
+    }
+    if (res < 0 && res != -ENOBUFS && res != -ECANCELED) {
+        msg("recv() error");
+        conn->state = STATE_DONE;
+        return;
+    }
+
+    uringPump(conn);
+    uringFlush(ring, conn);
+    if (conn->backlog.size() - conn->backlog_pos > k_uring_backlog_max) {
+        // The client does not read its responses: stop receiving
+        if (conn->recv_armed) {
+            struct io_uring_sqe *sqe = ring->getSqe();
+            if (sqe) {
+                sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                sqe->addr = uringTag(conn->fd, URING_RECV);
+                sqe->user_data = uringTag(conn->fd, URING_CANCEL);
+            }
+        }
+    } else if (!conn->recv_armed && conn->state != STATE_DONE) {
+        if (!uringArmRecv(ring, conn)) {
+            conn->state = STATE_DONE;
+        }
+    }
+}
+
+void Server::uringOnSend(Uring *ring, Conn *conn, int res) {
+    conn->send_busy = false;
+    conn->uring_pending--;
+    if (conn->state == STATE_DONE) {
+        return;
+    }
+    if (res < 0) {
+        msg("send() error");
+        conn->state = STATE_DONE;
+        return;
+    }
+    conn->sending.consume((size_t)res);
+    // Serve the requests that were waiting for the output queue to drain
+    uringPump(conn);
+    uringFlush(ring, conn);
+    if (!conn->recv_armed && conn->state != STATE_DONE
+        && conn->backlog.size() - conn->backlog_pos <= k_uring_backlog_max) {
+        if (!uringArmRecv(ring, conn)) {
+            conn->state = STATE_DONE;
+        }
+    }
+}
+
+bool Server::uringConnDone(std::vector<Conn*> &fd2conn, Conn *conn) {
+    // A closing connection can no longer time out
+    conn->detach();
+    if (conn->uring_pending) {
+        // Operations still reference the connection: make them complete
+        // And free it when the last one is reaped
+        (void)shutdown(conn->fd, SHUT_RDWR);
+        return false;
+    }
+    fd2conn[conn->fd] = NULL;
+    (void)close(conn->fd);
+    connFree(conn);
+    return true;
+}
+
+int Server::runUringReactor(int fd, Uring *ring) {
+    std::vector<Conn *> fd2conn;
+    DList idle; // Connections ordered by last activity, oldest first
+    size_t nconns = 0;
+    const int lfds[2] = {fd, unixfd};
+    bool acceptArmed[2] = {false, false}; // Multishot accept per listener
+    bool stopping = false;
+
+    // One-shot poll on the wakeup pipe, stop() never drains it
+    struct io_uring_sqe *sqe = ring->getSqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = wakefd[0];
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = uringTag(wakefd[0], URING_WAKE);
+
+    while (true) {
+        if (!running && !stopping) {
+            // Close every connection, then leave once they are all reaped
+            stopping = true;
+            for (Conn *conn : fd2conn) {
+                if (conn) {
+                    conn->state = STATE_DONE;
+                    nconns -= uringConnDone(fd2conn, conn);
+                }
+            }
+        }
+        if (stopping && nconns == 0) {
+            break;
+        }
+        for (int l = 0; l < 2 && !stopping; l++) {
+            if (lfds[l] < 0 || acceptArmed[l] || !(sqe = ring->getSqe())) {
+                continue;
+            }
+            sqe->opcode = IORING_OP_ACCEPT;
+            sqe->fd = lfds[l];
+            sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+            sqe->accept_flags = SOCK_CLOEXEC;
+            sqe->user_data = uringTag(lfds[l], URING_ACCEPT);
+            acceptArmed[l] = true;
+        }
+
+        // Submissions of the whole previous turn and the wait: one syscall
+        int timeout = idleWait(&idle, get_monotonic_msec());
+        if (stopping && (timeout < 0 || timeout > 100)) {
+            timeout = 100;
+        }
+        if (ring->submitAndWait(timeout) < 0) {
+            die("io_uring_enter()");
+        }
+        uint64_t now = get_monotonic_msec();
+
+        struct io_uring_cqe *cqe;
+        while ((cqe = ring->peekCqe()) != NULL) {
+            uint64_t tag = cqe->user_data;
+            int res = cqe->res;
+            uint32_t flags = cqe->flags;
+            ring->seenCqe();
+
+            uint32_t op = (uint32_t)(tag & 0xff);
+            int cfd = (int)(tag >> 8);
+            if (op == URING_ACCEPT) {
+                if (!(flags & IORING_CQE_F_MORE)) {
+                    acceptArmed[cfd == lfds[1]] = false;
+                }
+                if (res >= 0 && stopping) {
+                    close(res);
+                } else if (res >= 0) {
+                    uringNewConn(fd2conn, ring, &idle, res);
+                    nconns += (size_t)res < fd2conn.size() && fd2conn[res];
+                }
+                continue;
+            }
+            if (op != URING_RECV && op != URING_SEND) {
+                continue;
+            }
+            Conn *conn = (size_t)cfd < fd2conn.size() ? fd2conn[cfd] : NULL;
+            if (!conn) {
+                if (flags & IORING_CQE_F_BUFFER) {
+                    ring->recycleBuf((uint16_t)(flags >> IORING_CQE_BUFFER_SHIFT));
+                }
+                continue;
+            }
+            if (op == URING_RECV) {
+                uringOnRecv(ring, conn, res, flags);
+            } else {
+                uringOnSend(ring, conn, res);
+            }
+            if (conn->state == STATE_DONE) {
+                nconns -= uringConnDone(fd2conn, conn);
+            } else {
+                connTouch(&idle, conn, now);
+                connRelease(conn);
+            }
+        }
+
+        // Closed connections leave the list, so this ends at the first live one
+        while (idleWait(&idle, now) == 0) {
+            Conn *conn = static_cast<Conn *>(idle.next);
+            conn->state = STATE_DONE;
+            nconns -= uringConnDone(fd2conn, conn);
+        }
+    }
+    return 0;
+}
+
+#endif
@@ -2,6 +2,11 @@
 #define SERVER_H
 
 #include "Dependencies.h"
+#include "EventLoop.h"
+#include "Uring.h"
+#include "Buffer.h"
+#include "DList.h"
+#include "Log.h"
 
 enum {
     STATE_REQ = 0,
@@ -9,43 +14,88 @@ enum {
     STATE_DONE = 2,
 };
 
-struct Conn {
+// Linked into its reactor's idle list through the DList base
+// Buffers are borrowed from the buffer pool only while they hold pending
+// bytes, so an idle connection costs just this header
+struct Conn : public DList {
     int fd = -1;
     uint32_t state = 0;
-    size_t rbuf_size = 0;
-    uint8_t rbuf[4 + 4096];
-    size_t wbuf_size = 0;
-    size_t wbuf_sent = 0;
-    uint8_t wbuf[4 + 4096];
+    uint64_t idle_start = 0;    // Last activity, monotonic ms
+    Buffer rbuf;                // Unread requests, rbuf.head is the parse
+                                // cursor, never more than k_rbuf_size bytes
+    Buffer wbuf;                // Queued responses, wbuf.head is the sent part
+    uint32_t interest = 0;      // LOOP_* bits registered with the event loop
+#ifdef REDICPP_IO_URING
+    uint32_t uring_pending = 0; // recv / send operations in flight
+    bool recv_armed = false;
+    bool send_busy = false;
+    Buffer sending;             // Responses handed to the kernel, left alone
+                                // until the send completes
+    std::string backlog;        // received bytes that did not fit rbuf
+    size_t backlog_pos = 0;     // bytes of backlog already moved to rbuf
+#endif
 };
 
 class Server {
 public:
-    Server(uint16_t port);
+    // Port 0 disables TCP, unixPath adds a unix domain socket listener
+    Server(uint16_t port, unsigned nthreads = 1, const char *unixPath = NULL);
     ~Server();
     int run();
+    int startReactor(int fd);
+    int runReactor(int fd);
+    void useIoUring(bool on);
+    static void setWbufHighWater(size_t bytes);
+    static size_t getWbufHighWater();
+    static void setIdleTimeout(uint64_t ms);
+    static uint64_t getIdleTimeout();
     void stop();
+    static Conn *connNew();
+    static void connFree(Conn *conn);
+    static void connRelease(Conn *conn);
     static void connPut(std::vector<Conn*> &fd2conn, struct Conn *conn);
-    static int32_t acceptNewConn(std::vector<Conn*> &fd2conn, int fd);
+    static int32_t acceptNewConn(std::vector<Conn*> &fd2conn, EventLoop *loop, DList *idle, int fd);
+    static void connDone(std::vector<Conn*> &fd2conn, EventLoop *loop, Conn *conn);
+    static void connTouch(DList *idle, Conn *conn, uint64_t now);
+    static int idleWait(const DList *idle, uint64_t now);
+    static void reapIdle(std::vector<Conn*> &fd2conn, EventLoop *loop, DList *idle, uint64_t now);
     static void stateRequest(Conn *conn);
     static void stateResponse(Conn *conn);
+    static void compactRbuf(Conn *conn);
+    static bool handleOneRequest(Conn *conn);
     static bool tryOneRequest(Conn *conn);
     static bool tryFillRbuf(Conn *conn);
     static bool tryFlushWbuf(Conn *conn);
     static void connectionIO(Conn *conn);
-    void logRequest(const Conn *conn, const std::string &clientMsg);
+    static uint32_t connInterest(const Conn *conn);
 
 private:
-    int fd;
-    bool running;
+#ifdef REDICPP_IO_URING
+    int runUringReactor(int fd, Uring *ring);
+    static void uringNewConn(std::vector<Conn*> &fd2conn, Uring *ring, DList *idle, int connfd);
+    static bool uringArmRecv(Uring *ring, Conn *conn);
+    static void uringFlush(Uring *ring, Conn *conn);
+    static void uringPump(Conn *conn);
+    static void uringOnRecv(Uring *ring, Conn *conn, int res, uint32_t flags);
+    static void uringOnSend(Uring *ring, Conn *conn, int res);
+    static bool uringConnDone(std::vector<Conn*> &fd2conn, Conn *conn);
+#endif
+    std::vector<int> listeners; // listening socket of each reactor, -1 without TCP
+    int unixfd = -1; // unix domain socket listener, shared by all reactors
+    std::string unixPath;
+    int wakefd[2]; // self-pipe used by stop() to wake up run()
+    std::atomic<bool> running;
+    bool ioUring = false;
+    static size_t wbufHighWater; // Queued output that pauses reading
+    static uint64_t idleTimeoutMs; // Idle time before a connection is closed, 0 never
     static void die(const char *msg);
     static void msg(const char *msg);
     static int32_t read_full(int fd, char *buf, size_t n);
     static int32_t write_all(int fd, const char *buf, size_t n);
     static void fd_set_nb(int fd);
-    static std::mutex accept_mutex;
-    static std::mutex log_mutex;
-    static std::ofstream logfile;
+    static void fd_set_nodelay(int fd);
+    static int listenOn(uint16_t port, bool reuseport);
+    static int listenUnix(const char *path);
 };
 
 #endif // SERVER_H
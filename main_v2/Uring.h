@@ -0,0 +1,70 @@
+#ifndef URING_H
+#define URING_H
+
+#include "Dependencies.h"
+
+#if defined(__linux__) && defined(REDICPP_IO_URING)
+
+#include <linux/io_uring.h>
+
+// Minimal io_uring wrapper on top of the raw kernel interface (no liburing).
+// One instance per reactor thread, not thread safe.
+// Receives use a registered ring of provided buffers (buffer group 0),
+// which is what multishot recv needs.
+class Uring {
+public:
+    // NULL if the kernel lacks io_uring, provided buffer rings or
+    // multishot recv (Linux 6.0+)
+    static Uring *create(unsigned entries, unsigned nbufs, unsigned bufsize);
+    ~Uring();
+
+    // Next free submission entry, zeroed. Flushes the queue if it is full.
+    struct io_uring_sqe *getSqe();
+    // Submit everything queued and wait up to timeout_ms for a completion,
+    // all in one io_uring_enter call
+    int submitAndWait(int timeout_ms);
+    // Oldest unseen completion or NULL, release it with seenCqe()
+    struct io_uring_cqe *peekCqe();
+    void seenCqe();
+
+    uint8_t *bufAt(uint16_t bid) {
+        return &bufs[(size_t)bid * bufsize];
+    }
+    // Hand a provided buffer back to the kernel
+    void recycleBuf(uint16_t bid);
+
+    static const uint16_t k_buf_group = 0;
+
+private:
+    Uring() {}
+    int enter(unsigned toSubmit, unsigned minComplete, unsigned flags, int timeout_ms);
+
+    int ringfd = -1;
+    void *ringMem = NULL;
+    size_t ringMemSize = 0;
+    struct io_uring_sqe *sqes = NULL;
+    size_t sqesSize = 0;
+
+    unsigned *sqTail = NULL;
+    unsigned sqMask = 0;
+    unsigned sqEntries = 0;
+    unsigned sqLocalTail = 0;   // queued but not yet published
+    unsigned sqPublished = 0;   // published but not yet submitted
+    unsigned *sqHead = NULL;
+
+    unsigned *cqHead = NULL;
+    unsigned *cqTail = NULL;
+    unsigned cqMask = 0;
+    struct io_uring_cqe *cqes = NULL;
+
+    struct io_uring_buf_ring *bufRing = NULL;
+    size_t bufRingSize = 0;
+    unsigned bufMask = 0;
+    uint16_t bufTail = 0;
+    uint8_t *bufs = NULL;
+    size_t bufsize = 0;
+};
+
+#endif
+
+#endif // URING_H
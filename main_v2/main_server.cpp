@@ -1,7 +1,43 @@
 #include "Server.h"
 
-int main() {
-    Server server(1234);
+// Usage: server [nthreads] [--io-uring] [--wbuf-high-water bytes] [--idle-timeout ms]
+//               [--unix path] [--no-tcp] [--log path|-] [--log-level debug|info|warn|error]
+int main(int argc, char **argv) {
+    unsigned nthreads = 1;
+    bool ioUring = false;
+    const char *unixPath = NULL;
+    uint16_t port = 1234;
+    const char *logPath = NULL;
+    LogLevel logLevel = LOG_INFO;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--io-uring") == 0) {
+            ioUring = true;
+        } else if (strcmp(argv[i], "--wbuf-high-water") == 0 && i + 1 < argc) {
+            Server::setWbufHighWater((size_t)atoll(argv[++i]));
+        } else if (strcmp(argv[i], "--idle-timeout") == 0 && i + 1 < argc) {
+            Server::setIdleTimeout((uint64_t)atoll(argv[++i]));
+        } else if (strcmp(argv[i], "--unix") == 0 && i + 1 < argc) {
+            unixPath = argv[++i];
+        } else if (strcmp(argv[i], "--no-tcp") == 0) {
+            port = 0;
+        } else if (strcmp(argv[i], "--log") == 0 && i + 1 < argc) {
+            logPath = argv[++i];
+        } else if (strcmp(argv[i], "--log-level") == 0 && i + 1 < argc) {
+            if (!Log::parseLevel(argv[++i], logLevel)) {
+                fprintf(stderr, "--log-level: debug, info, warn or error\n");
+                return 1;
+            }
+        } else {
+            nthreads = (unsigned)atoi(argv[i]);
+        }
+    }
+    if (logPath && !Log::open(logPath, logLevel)) {
+        perror(logPath);
+        return 1;
+    }
+    Server server(port, nthreads, unixPath);
+    server.useIoUring(ioUring);
     server.run();
+    Log::close();
     return 0;
 }
\ No newline at end of file
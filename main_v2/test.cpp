@@ -19,9 +19,9 @@ protected:
     }
 
     void TearDown() override {
-        // Stop the server thread
+        // Stop the server thread, run() returns once it is woken up
         server.stop();
-        serverThread.detach();
+        serverThread.join();
     }
 };
 
@@ -88,6 +88,273 @@ TEST_F(ClientServerTest, InvalidMessageLength) {
     EXPECT_NE(result, 0) << "Server should reject messages longer than maxMsgLen";
 }
 
+// pipelining test: many requests land in one read and are parsed in place
+TEST_F(ClientServerTest, PipelinedRequests) {
+    Client client(1234, "127.0.0.1");
+    const int num_requests = 100;
+    for (int i = 0; i < num_requests; ++i) {
+        std::string message = "hello" + std::to_string(i);
+        int32_t result = client.sendRequest(client.getFd(), message.c_str());
+        EXPECT_EQ(result, 0) << "Query failed with error code " << result;
+    }
+    for (int i = 0; i < num_requests; ++i) {
+        int32_t result = client.readRequest(client.getFd());
+        EXPECT_EQ(result, 0) << "Query failed with error code " << result;
+    }
+}
+
+// Changes a process-wide server setting for one test. The old value is
+// put back on the way out, also when an assertion ends the test early.
+template <class T>
+class ScopedSetting {
+public:
+    ScopedSetting(T (*get)(), void (*set)(T), T value) : set(set), old(get()) {
+        set(value);
+    }
+    ~ScopedSetting() {
+        set(old);
+    }
+
+private:
+    void (*set)(T);
+    T old;
+};
+
+TEST_F(ClientServerTest, OutputQueueHighWater) {
+    // A tiny high-water mark makes the server pause reading over and over
+    ScopedSetting<size_t> highWater(Server::getWbufHighWater, Server::setWbufHighWater, 256);
+    Client client(1234, "127.0.0.1");
+    const int num_requests = 2000;
+    std::thread sender([&client] {
+        for (int i = 0; i < num_requests; ++i) {
+            std::string message = "hello" + std::to_string(i);
+            EXPECT_EQ(client.sendRequest(client.getFd(), message.c_str()), 0);
+        }
+    });
+    for (int i = 0; i < num_requests; ++i) {
+        int32_t result = client.readRequest(client.getFd());
+        EXPECT_EQ(result, 0) << "Query failed with error code " << result;
+    }
+    sender.join();
+}
+
+TEST_F(ClientServerTest, IdleConnectionReaped) {
+    ScopedSetting<uint64_t> timeout(Server::getIdleTimeout, Server::setIdleTimeout, 200);
+    Client idle(1234, "127.0.0.1");
+    Client active(1234, "127.0.0.1");
+    for (int i = 0; i < 6; ++i) {
+        EXPECT_EQ(active.sendRequest(active.getFd(), "ping"), 0);
+        EXPECT_EQ(active.readRequest(active.getFd()), 0);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    // The idle client was closed by the server, the active one was not
+    char c;
+    EXPECT_EQ(recv(idle.getFd(), &c, 1, MSG_DONTWAIT), 0);
+    EXPECT_EQ(active.sendRequest(active.getFd(), "ping"), 0);
+    EXPECT_EQ(active.readRequest(active.getFd()), 0);
+}
+
+TEST_F(ClientServerTest, ConnectionBurst) {
+    // All of them wait in the accept queue before the first request
+    const int num_clients = 500;
+    std::vector<std::unique_ptr<Client>> clients;
+    for (int i = 0; i < num_clients; ++i) {
+        clients.emplace_back(new Client(1234, "127.0.0.1"));
+    }
+    for (auto &client : clients) {
+        EXPECT_EQ(client->sendRequest(client->getFd(), "hello"), 0);
+    }
+    for (auto &client : clients) {
+        EXPECT_EQ(client->readRequest(client->getFd()), 0);
+    }
+}
+
+// Idle connections hold no buffers, freed Conns and blocks are recycled
+TEST(ConnPoolTest, RecyclesConnsAndBuffers) {
+    Conn *conn = Server::connNew();
+    EXPECT_EQ(conn->rbuf.cap, 0u);
+    EXPECT_EQ(conn->wbuf.cap, 0u);
+    conn->wbuf.append("hello", 5);
+    EXPECT_EQ(conn->wbuf.cap, k_pool_block);
+    uint8_t *block = conn->wbuf.data;
+    conn->wbuf.consume(5);
+    Server::connRelease(conn);
+    EXPECT_EQ(conn->wbuf.cap, 0u);
+    Server::connFree(conn);
+
+    Conn *again = Server::connNew();
+    EXPECT_EQ(again, conn);
+    EXPECT_EQ(again->fd, -1);
+    again->rbuf.append("x", 1);
+    EXPECT_EQ(again->rbuf.data, block);
+    Server::connFree(again);
+}
+
+// Server running several reactors, each with its own SO_REUSEPORT listener
+class MultiReactorTest : public ::testing::Test {
+protected:
+    std::thread serverThread;
+    Server server{1235, 4};
+
+    void SetUp() override {
+        serverThread = std::thread([this] {
+            server.run();
+        });
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+
+    void TearDown() override {
+        // stop() wakes every reactor, run() joins them before returning
+        server.stop();
+        serverThread.join();
+    }
+};
+
+TEST_F(MultiReactorTest, ManyClientsAcrossReactors) {
+    const int num_clients = 16;
+    std::vector<std::thread> client_threads;
+    for (int i = 0; i < num_clients; ++i) {
+        client_threads.emplace_back([i] {
+            Client client(1235, "127.0.0.1");
+            for (int j = 0; j < 10; ++j) {
+                std::string message = "hello" + std::to_string(i) + "-" + std::to_string(j);
+                int32_t result = client.sendRequest(client.getFd(), message.c_str());
+                EXPECT_EQ(result, 0) << "Query failed with error code " << result;
+                result = client.readRequest(client.getFd());
+                EXPECT_EQ(result, 0) << "Query failed with error code " << result;
+            }
+        });
+    }
+    for (auto& t : client_threads) {
+        t.join();
+    }
+}
+
+// Server running the io_uring backend (falls back to the event loop
+// when it is not compiled in or the kernel lacks support)
+class UringServerTest : public ::testing::Test {
+protected:
+    std::thread serverThread;
+    Server server{1236, 2};
+
+    void SetUp() override {
+        server.useIoUring(true);
+        serverThread = std::thread([this] {
+            server.run();
+        });
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+
+    void TearDown() override {
+        server.stop();
+        serverThread.join();
+    }
+};
+
+TEST_F(UringServerTest, PipelinedRequests) {
+    Client client(1236, "127.0.0.1");
+    // Queue more requests than one receive buffer holds before reading
+    const int num_requests = 200;
+    for (int i = 0; i < num_requests; ++i) {
+        std::string message = "hello" + std::to_string(i);
+        int32_t result = client.sendRequest(client.getFd(), message.c_str());
+        EXPECT_EQ(result, 0) << "Query failed with error code " << result;
+    }
+    for (int i = 0; i < num_requests; ++i) {
+        int32_t result = client.readRequest(client.getFd());
+        EXPECT_EQ(result, 0) << "Query failed with error code " << result;
+    }
+}
+
+// Server listening on a unix domain socket next to its TCP port
+class UnixSocketTest : public ::testing::Test {
+protected:
+    static constexpr const char *path = "/tmp/redicpp_test.sock";
+    std::thread serverThread;
+    Server server{1237, 2, path};
+
+    void SetUp() override {
+        serverThread = std::thread([this] {
+            server.run();
+        });
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+
+    void TearDown() override {
+        server.stop();
+        serverThread.join();
+    }
+};
+
+TEST_F(UnixSocketTest, ServesBothTransports) {
+    Client tcp(1237, "127.0.0.1");
+    Client local(path);
+    for (int i = 0; i < 20; ++i) {
+        std::string message = "hello" + std::to_string(i);
+        for (Client *client : {&tcp, &local}) {
+            int32_t result = client->sendRequest(client->getFd(), message.c_str());
+            EXPECT_EQ(result, 0) << "Query failed with error code " << result;
+            result = client->readRequest(client->getFd());
+            EXPECT_EQ(result, 0) << "Query failed with error code " << result;
+        }
+    }
+}
+
+// Records written to the log file, by their text
+static size_t countLogLines(const char *path, const char *text) {
+    std::ifstream in(path);
+    std::string line;
+    size_t n = 0;
+    while (std::getline(in, line)) {
+        n += line.find(text) != std::string::npos;
+    }
+    return n;
+}
+
+// Records from several threads all reach the file, those below the level don't
+TEST(LogTest, FiltersByLevelAndKeepsEveryRecord) {
+    const char *path = "/tmp/redicpp_test_log1.log";
+    unlink(path);
+    uint64_t dropped = Log::dropped();
+    ASSERT_TRUE(Log::open(path, LOG_INFO));
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([t] {
+            for (int i = 0; i < 500; ++i) {
+                Log::write(LOG_INFO, "kept %d %d", t, i);
+                Log::write(LOG_DEBUG, "filtered %d %d", t, i);
+            }
+        });
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+    Log::close();
+    EXPECT_EQ(Log::dropped(), dropped);
+    EXPECT_EQ(countLogLines(path, " I kept "), 2000u);
+    EXPECT_EQ(countLogLines(path, "filtered"), 0u);
+    unlink(path);
+}
+
+// A thread outrunning the drainer loses records but never blocks, and
+// every record is either written or counted as dropped
+TEST(LogTest, CountsDroppedRecords) {
+    const char *path = "/tmp/redicpp_test_log2.log";
+    unlink(path);
+    uint64_t dropped = Log::dropped();
+    ASSERT_TRUE(Log::open(path, LOG_DEBUG));
+    const size_t n = 50000;
+    for (size_t i = 0; i < n; ++i) {
+        Log::write(LOG_DEBUG, "rec %zu", i);
+    }
+    Log::close();
+    EXPECT_EQ(countLogLines(path, " D rec ") + (Log::dropped() - dropped), n);
+    if (Log::dropped() != dropped) {
+        EXPECT_GE(countLogLines(path, "records dropped"), 1u);
+    }
+    unlink(path);
+}
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();